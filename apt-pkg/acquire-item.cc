@@ -554,19 +554,30 @@ bool pkgAcqTransactionItem::TransactionState(TransactionStates const state)
 	       }
 	       for (auto const &ext: APT::Configuration::getCompressorExtensions())
 	       {
-		  auto const Final = FinalFile + ext;
-		  if (FileExists(Final))
+		  for (auto const &Final : { FinalFile + ext, SeekIndexFileName(FinalFile + ext) })
 		  {
-		     if(Debug == true)
-			std::clog << "rm " << Final << " # " << DescURI() << std::endl;
-		     if (RemoveFile("TransactionStates-Cleanup", Final) == false)
-			return false;
+		     if (FileExists(Final))
+		     {
+			if(Debug == true)
+			   std::clog << "rm " << Final << " # " << DescURI() << std::endl;
+			if (RemoveFile("TransactionStates-Cleanup", Final) == false)
+			   return false;
+		     }
 		  }
 	       }
 	       if(Debug == true)
 		  std::clog << "mv " << PartialFile << " -> "<< DestFile << " # " << DescURI() << std::endl;
 	       if (Rename(PartialFile, DestFile) == false)
 		  return false;
+	       // the block offsets of a seekable index move along with it
+	       std::string const PartialIndex = SeekIndexFileName(PartialFile);
+	       if (RealFileExists(PartialIndex))
+	       {
+		  if(Debug == true)
+		     std::clog << "mv " << PartialIndex << " -> "<< SeekIndexFileName(DestFile) << " # " << DescURI() << std::endl;
+		  if (Rename(PartialIndex, SeekIndexFileName(DestFile)) == false)
+		     return false;
+	       }
 	    }
 	    else if(Debug == true)
 	       std::clog << "keep " << PartialFile << " # " << DescURI() << std::endl;
@@ -576,6 +587,9 @@ bool pkgAcqTransactionItem::TransactionState(TransactionStates const state)
 	       std::clog << "rm " << DestFile << " # " << DescURI() << std::endl;
 	    if (RemoveFile("TransItem::TransactionCommit", DestFile) == false)
 	       return false;
+	    if (RealFileExists(SeekIndexFileName(DestFile)) &&
+		  RemoveFile("TransItem::TransactionCommit", SeekIndexFileName(DestFile)) == false)
+	       return false;
 	 }
 	 break;
    }
@@ -2986,6 +3000,11 @@ string pkgAcqIndex::Custom600Headers() const
    if(Target.IsOptional)
       msg += "\nFail-Ignore: true";
 
+   // methods seeing the data can decompress it while they download it
+   if (Stage == STAGE_DOWNLOAD && CurrentCompressionExtension != "uncompressed" &&
+	 Target.KeepCompressed == false && _config->FindB("Acquire::Decompress-While-Downloading", true))
+      msg += "\nDecompress-To: " + GetPartialFileNameFromURI(Target.URI);
+
    return msg;
 }
 									/*}}}*/
@@ -3083,6 +3102,21 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
       SetActiveSubprocess(::URI(Desc.URI).Access);
       return;
    }
+   // the method decompressed the file already while downloading it
+   else if (Target.KeepCompressed == false && AltFilename.empty() == false &&
+	 AltFilename == GetPartialFileNameFromURI(Target.URI) && CurrentCompressionExtension != "uncompressed")
+   {
+      Stage = STAGE_DECOMPRESS_AND_VERIFY;
+      if (VerifyDecompressedAlternative(Message))
+      {
+	 if (Filename != AltFilename)
+	    EraseFileName = Filename;
+	 DestFile = AltFilename;
+	 return StageDecompressDone();
+      }
+      // let the store method have a look at the download instead
+      RemoveFile("pkgAcqIndex::StageDownloadDone", AltFilename);
+   }
    // methods like file:// give us an alternative (uncompressed) file
    else if (Target.KeepCompressed == false && AltFilename.empty() == false)
    {
@@ -3106,7 +3140,10 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
 
    Stage = STAGE_DECOMPRESS_AND_VERIFY;
    DestFile = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI), Target);
-   if (Filename != DestFile && flExtension(Filename) == flExtension(DestFile))
+   // seekable indexes are recompressed in blocks by the store method
+   bool const Seekable = Target.KeepCompressed && CurrentCompressionExtension != "uncompressed" &&
+      _config->FindB("Acquire::Seekable-Indexes", false);
+   if (Filename != DestFile && flExtension(Filename) == flExtension(DestFile) && Seekable == false)
       Desc.URI = "copy:" + Filename;
    else
       Desc.URI = "store:" + Filename;
@@ -3114,7 +3151,10 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
    {
       if (CurrentCompressionExtension == "uncompressed")
 	 return StageDecompressDone();
-      DestFile = "/dev/null";
+      else if (Seekable)
+	 DestFile = GetKeepCompressedFileName(GetPartialFileNameFromURI(Target.URI) + ".seekable", Target);
+      else
+	 DestFile = "/dev/null";
    }
 
    if (EraseFileName.empty() && Filename != AltFilename)
@@ -3125,6 +3165,45 @@ void pkgAcqIndex::StageDownloadDone(string const &Message)
    SetActiveSubprocess(::URI(Desc.URI).Access);
 }
 									/*}}}*/
+// AcqIndex::VerifyDecompressedAlternative - check on-the-fly result	/*{{{*/
+/* The hashes the method calculated while decompressing are checked just
+   like the worker would check the hashes reported by the store method.
+   Everything which would need a closer look is left to the store method. */
+bool pkgAcqIndex::VerifyDecompressedAlternative(std::string const &Message) const
+{
+   if (_config->Find("Acquire::ForceHash").empty() == false)
+      return false;
+
+   HashStringList AltHashes;
+   for (char const * const * type = HashString::SupportedHashes(); *type != NULL; ++type)
+   {
+      std::string const tagname = std::string("Alt-") + *type + "-Hash";
+      std::string const hashsum = LookupTag(Message, tagname.c_str());
+      if (hashsum.empty() == false)
+	 AltHashes.push_back(HashString(*type, hashsum));
+   }
+
+   HashStringList const ExpectedHashes = GetExpectedHashes();
+   bool Okay;
+   if (ExpectedHashes.empty() == false)
+      Okay = AltHashes.empty() == false && AltHashes == ExpectedHashes;
+   else
+      Okay = HashesRequired() == false;
+
+   if (_config->FindB("Debug::pkgAcquire::Auth", false) == true)
+   {
+      std::clog << "Decompressed while downloading: " << DescURI() << std::endl
+	 << "ReceivedHash:" << std::endl;
+      for (auto const &hs : AltHashes)
+	 std::clog << "\t- " << hs.toStr() << std::endl;
+      std::clog << "ExpectedHash:" << std::endl;
+      for (auto const &hs : ExpectedHashes)
+	 std::clog << "\t- " << hs.toStr() << std::endl;
+      std::clog << (Okay ? "accepted" : "left to the store method") << std::endl << std::endl;
+   }
+   return Okay;
+}
+									/*}}}*/
 // AcqIndex::StageDecompressDone - Final verification			/*{{{*/
 void pkgAcqIndex::StageDecompressDone()
 {
@@ -3332,7 +3411,27 @@ bool pkgAcqArchive::QueueNext()
       // Create the item
       Local = false;
       ++Vf;
-      QueueURI(Desc);
+      std::vector<std::string> URIs{Desc.URI};
+      if (_config->FindI("Acquire::Segments", 1) > 1)
+      {
+	 // other sources with the same file can serve segments of it as well
+	 for (pkgCache::VerFileIterator Alt = Vf; Alt.end() == false; ++Alt)
+	 {
+	    pkgCache::PkgFileIterator const AltF = Alt.File();
+	    pkgIndexFile *AltIndex;
+	    if (AltF.Flagged(pkgCache::Flag::NotSource) ||
+		  Sources->FindIndex(AltF, AltIndex) == false ||
+		  (Trusted && AltIndex->IsTrusted() == false))
+	       continue;
+	    pkgRecords::Parser &AltParse = Recs->Lookup(Alt);
+	    if (_error->PendingError() == true)
+	       return false;
+	    if (AltParse.Hashes() == ExpectedHashes)
+	       URIs.push_back(AltIndex->ArchiveURI(AltParse.FileName()));
+	 }
+      }
+      if (pkgAcqSegment::QueueSegments(this, URIs, ExpectedHashes) == false)
+	 QueueURI(Desc);
       return true;
    }
    return false;
@@ -3426,6 +3525,242 @@ std::string pkgAcqArchive::ShortDesc() const				/*{{{*/
 									/*}}}*/
 pkgAcqArchive::~pkgAcqArchive() {}
 
+// AcqSegment::pkgAcqSegment - Constructor				/*{{{*/
+struct APT_HIDDEN pkgAcqSegmentGroup
+{
+   pkgAcquire::Item * const Parent;
+   HashStringList const ExpectedHashes;
+   unsigned long long const FileSize;
+   std::vector<pkgAcqSegment *> Segments;
+   size_t Pending;
+   bool Failed;
+
+   pkgAcqSegmentGroup(pkgAcquire::Item * const Parent, HashStringList const &ExpectedHashes) :
+      Parent(Parent), ExpectedHashes(ExpectedHashes), FileSize(Parent->FileSize),
+      Pending(0), Failed(false) {}
+};
+pkgAcqSegment::pkgAcqSegment(pkgAcquire * const Owner, std::shared_ptr<pkgAcqSegmentGroup> const &Group,
+      std::string const &URI, unsigned long long const RangeStart, unsigned long long const RangeEnd) :
+   Item(Owner), Group(Group), RangeStart(RangeStart), RangeEnd(RangeEnd)
+{
+   Group->Segments.push_back(this);
+   ++Group->Pending;
+
+   auto const &ParentDesc = Group->Parent->GetItemDesc();
+   DestFile = Group->Parent->DestFile + ".segment" + std::to_string(Group->Segments.size());
+   // segments are never resumed as the parts we have might not fit together
+   if (RealFileExists(DestFile))
+      RemoveFile("pkgAcqSegment", DestFile);
+
+   FileSize = RangeEnd - RangeStart + 1;
+   Desc.URI = URI;
+   Desc.Description = ParentDesc.Description;
+   Desc.ShortDesc = ParentDesc.ShortDesc;
+   Desc.Owner = this;
+   QueueURI(Desc);
+}
+									/*}}}*/
+// AcqSegment::QueueSegments - Split the download of an item		/*{{{*/
+bool pkgAcqSegment::QueueSegments(pkgAcquire::Item * const Parent,
+      std::vector<std::string> const &URIs, HashStringList const &ExpectedHashes)
+{
+   int const MaxSegments = _config->FindI("Acquire::Segments", 1);
+   if (MaxSegments < 2 || Parent->FileSize == 0 || Parent->PartialSize != 0 ||
+	 ExpectedHashes.usable() == false)
+      return false;
+
+   // only http(s) sources support the range requests we need
+   std::vector<std::string> Sources;
+   for (auto const &U: URIs)
+   {
+      std::string Access = ::URI(U).Access;
+      auto const plus = Access.find('+');
+      if (plus != std::string::npos)
+	 Access.erase(0, plus + 1);
+      if ((Access == "http" || Access == "https") &&
+	    std::find(Sources.begin(), Sources.end(), U) == Sources.end())
+	 Sources.push_back(U);
+   }
+   if (Sources.empty())
+      return false;
+
+   unsigned long long const MinSize = std::max(1, _config->FindI("Acquire::Segments::Min-Size", 16 * 1024 * 1024));
+   unsigned long long const Count = std::min<unsigned long long>(MaxSegments, Parent->FileSize / MinSize);
+   if (Count < 2)
+      return false;
+
+   if (_config->FindB("Debug::pkgAcquire::Segments", false) == true)
+      std::clog << "Split download of " << Parent->DescURI() << " (" << Parent->FileSize
+	 << " bytes) into " << Count << " segments from " << Sources.size() << " sources" << std::endl;
+
+   // each segment is assigned to the source with the least bytes queued,
+   // so that all sources are estimated to finish at about the same time
+   std::vector<unsigned long long> Load(Sources.size(), 0);
+   pkgAcquire * const Owner = Parent->GetOwner();
+   for (auto I = Owner->ItemsBegin(); I != Owner->ItemsEnd(); ++I)
+   {
+      if (*I == Parent || (*I)->Complete == true || (*I)->Local == true ||
+	    ((*I)->Status != StatIdle && (*I)->Status != StatFetching))
+	 continue;
+      std::string const Site = URI::SiteOnly((*I)->GetItemDesc().URI);
+      for (size_t j = 0; j < Sources.size(); ++j)
+	 if (URI::SiteOnly(Sources[j]) == Site)
+	    Load[j] += (*I)->FileSize;
+   }
+
+   auto const Group = std::make_shared<pkgAcqSegmentGroup>(Parent, ExpectedHashes);
+   unsigned long long const Length = Parent->FileSize / Count;
+   for (unsigned long long i = 0; i < Count; ++i)
+   {
+      unsigned long long const Start = i * Length;
+      unsigned long long const End = (i + 1 == Count) ? Group->FileSize - 1 : Start + Length - 1;
+      auto const Least = std::distance(Load.begin(), std::min_element(Load.begin(), Load.end()));
+      Load[Least] += End - Start + 1;
+      new pkgAcqSegment(Owner, Group, Sources[Least], Start, End);
+   }
+   // the bytes are accounted for by the segments while they are fetched
+   Parent->FileSize = 0;
+   return true;
+}
+									/*}}}*/
+// AcqSegment::Done - Segment fetched					/*{{{*/
+void pkgAcqSegment::Done(std::string const &Message, HashStringList const &Hashes,
+      pkgAcquire::MethodConfig const * const Cnf)
+{
+   Item::Done(Message, Hashes, Cnf);
+   Complete = true;
+   SegmentFinished(Cnf);
+}
+									/*}}}*/
+// AcqSegment::Failed - Segment failed					/*{{{*/
+/* The failure isn't fatal as the parent falls back to fetching the complete
+   file, so the segment is settled to not report it as an error later on. */
+void pkgAcqSegment::Failed(std::string const &Message, pkgAcquire::MethodConfig const * const Cnf)
+{
+   Item::Failed(Message, Cnf);
+   Group->Failed = true;
+   Status = StatDone;
+   Complete = true;
+   SegmentFinished(Cnf);
+}
+									/*}}}*/
+// AcqSegment::SegmentFinished - Reassemble the file after the last segment/*{{{*/
+static bool ConcatSegments(std::vector<pkgAcqSegment *> const &Segments, std::string const &DestFile, Hashes &Calc)
+{
+   FileFd Out(DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::None, 0644);
+   if (Out.IsOpen() == false || Out.Failed())
+      return false;
+   constexpr size_t BufSize = 64 * 1024;
+   std::unique_ptr<unsigned char[]> Buf(new unsigned char[BufSize]);
+   for (auto const Seg: Segments)
+   {
+      FileFd In(Seg->DestFile, FileFd::ReadOnly, FileFd::None);
+      if (In.IsOpen() == false || In.Failed())
+	 return false;
+      unsigned long long Actual = 0;
+      do {
+	 if (In.Read(Buf.get(), BufSize, &Actual) == false ||
+	       Calc.Add(Buf.get(), Actual) == false ||
+	       Out.Write(Buf.get(), Actual) == false)
+	    return false;
+      } while (Actual != 0);
+   }
+   return Out.Close();
+}
+void pkgAcqSegment::SegmentFinished(pkgAcquire::MethodConfig const * const Cnf)
+{
+   if (--Group->Pending != 0)
+      return;
+
+   pkgAcquire::Item * const Parent = Group->Parent;
+   pkgAcquire::ItemDesc &ParentDesc = Parent->GetItemDesc();
+   // the bytes are accounted for by the parent again from here on
+   for (auto const Seg: Group->Segments)
+      Seg->FileSize = 0;
+   Parent->FileSize = Group->FileSize;
+
+   if (Group->Failed == true)
+   {
+      if (_config->FindB("Debug::pkgAcquire::Segments", false) == true)
+	 std::clog << "Segmented download of " << Parent->DescURI() << " failed, fetch it complete" << std::endl;
+      for (auto const Seg: Group->Segments)
+	 RemoveFile("pkgAcqSegment::SegmentFinished", Seg->DestFile);
+      Owner->Enqueue(ParentDesc);
+      return;
+   }
+
+   std::string Message;
+   Hashes Calc(Group->ExpectedHashes);
+   _error->PushToStack();
+   bool const Okay = ConcatSegments(Group->Segments, Parent->DestFile, Calc);
+   if (Okay == false)
+   {
+      std::ostringstream msg;
+      _error->DumpErrors(msg, GlobalError::DEBUG, false);
+      strprintf(Message, "400 URI Failure\nURI: %s\nMessage: %s", ParentDesc.URI.c_str(),
+	    SubstVar(msg.str(), "\n", " ").c_str());
+   }
+   _error->RevertToStack();
+   for (auto const Seg: Group->Segments)
+      RemoveFile("pkgAcqSegment::SegmentFinished", Seg->DestFile);
+   if (Okay == false)
+   {
+      Parent->Status = StatError;
+      Parent->Failed(Message, Cnf);
+      return;
+   }
+
+   HashStringList const ReceivedHashes = Calc.GetHashStringList();
+   std::string HashTags;
+   for (auto const &hs: ReceivedHashes)
+      HashTags.append("\n").append(hs.HashType()).append("-Hash: ").append(hs.HashValue());
+
+   if (Group->ExpectedHashes != ReceivedHashes)
+   {
+      strprintf(Message, "400 URI Failure\nURI: %s\nFilename: %s\nFailReason: HashSumMismatch%s",
+	    ParentDesc.URI.c_str(), Parent->DestFile.c_str(), HashTags.c_str());
+      Parent->Status = StatAuthError;
+      Parent->Failed(Message, Cnf);
+      return;
+   }
+
+   strprintf(Message, "201 URI Done\nURI: %s\nFilename: %s\nSize: %llu%s",
+	 ParentDesc.URI.c_str(), Parent->DestFile.c_str(), Group->FileSize, HashTags.c_str());
+   Parent->Done(Message, ReceivedHashes, Cnf);
+}
+									/*}}}*/
+std::string pkgAcqSegment::Custom600Headers() const			/*{{{*/
+{
+   std::string Header;
+   strprintf(Header, "\nRange-Start: %llu\nRange-End: %llu", RangeStart, RangeEnd);
+   return Group->Parent->Custom600Headers() + Header;
+}
+									/*}}}*/
+std::string pkgAcqSegment::DescURI() const				/*{{{*/
+{
+   return Desc.URI;
+}
+									/*}}}*/
+HashStringList pkgAcqSegment::GetExpectedHashes() const			/*{{{*/
+{
+   // the complete file is verified once all segments are fetched
+   HashStringList List;
+   List.FileSize(RangeEnd - RangeStart + 1);
+   return List;
+}
+									/*}}}*/
+APT_CONST bool pkgAcqSegment::HashesRequired() const			/*{{{*/
+{
+   return false;
+}
+									/*}}}*/
+bool pkgAcqSegment::IsTrusted() const					/*{{{*/
+{
+   return Group->Parent->IsTrusted();
+}
+									/*}}}*/
+pkgAcqSegment::~pkgAcqSegment() {}
+
 // AcqChangelog::pkgAcqChangelog - Constructors				/*{{{*/
 class pkgAcqChangelog::Private
 {
@@ -3721,7 +4056,8 @@ pkgAcqFile::pkgAcqFile(pkgAcquire * const Owner,string const &URI, HashStringLis
 	 PartialSize = Buf.st_size;
    }
 
-   QueueURI(Desc);
+   if (pkgAcqSegment::QueueSegments(this, {URI}, ExpectedHashes) == false)
+      QueueURI(Desc);
 }
 									/*}}}*/
 // AcqFile::Done - Item downloaded OK					/*{{{*/
@@ -29,6 +29,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #ifndef APT_8_CLEANER_HEADERS
 #include <apt-pkg/sourcelist.h>
@@ -645,6 +646,9 @@ class APT_HIDDEN pkgAcqIndex : public pkgAcqBaseIndex
     */
    void StageDecompressDone();
 
+   /** \brief check the file the download method decompressed on the fly */
+   APT_HIDDEN bool VerifyDecompressedAlternative(std::string const &Message) const;
+
    /** \brief If \b set, this partially downloaded file will be
     *  removed when the download completes.
     */
@@ -1041,6 +1045,54 @@ class pkgAcqArchive : public pkgAcquire::Item
    virtual ~pkgAcqArchive();
 };
 									/*}}}*/
+struct pkgAcqSegmentGroup;
+/** \brief Retrieves a byte range of a file for an item whose download	{{{
+ *  is split into segments.
+ *
+ *  Large archives and files can be split into segments which are
+ *  fetched concurrently from different sources or over multiple
+ *  connections to the same host (see Acquire::Segments). Once all
+ *  segments are done they are concatenated into the partial file of the
+ *  item they belong to, which is verified as a whole and handed to its
+ *  Done() method as if it was downloaded in one go. If one of the
+ *  segments fails the item falls back to downloading the complete file.
+ */
+class APT_HIDDEN pkgAcqSegment : public pkgAcquire::Item
+{
+   std::shared_ptr<pkgAcqSegmentGroup> const Group;
+   unsigned long long const RangeStart;
+   unsigned long long const RangeEnd;
+
+   void SegmentFinished(pkgAcquire::MethodConfig const * const Cnf);
+
+   public:
+   virtual void Failed(std::string const &Message,pkgAcquire::MethodConfig const * const Cnf) APT_OVERRIDE;
+   virtual void Done(std::string const &Message, HashStringList const &Hashes,
+		     pkgAcquire::MethodConfig const * const Cnf) APT_OVERRIDE;
+   virtual std::string DescURI() const APT_OVERRIDE;
+   virtual std::string Custom600Headers() const APT_OVERRIDE;
+   virtual HashStringList GetExpectedHashes() const APT_OVERRIDE;
+   virtual bool HashesRequired() const APT_OVERRIDE;
+   virtual bool IsTrusted() const APT_OVERRIDE;
+
+   /** \brief Queue segments for the download of \a Parent if enabled
+    *
+    *  \param Parent is the item downloading the complete file to its DestFile
+    *  \param URIs the file can be downloaded from, each segment is
+    *  assigned to the one with the least bytes queued
+    *  \param ExpectedHashes the complete file is verified against
+    *
+    *  \return \b true if segments were queued, \b false if the
+    *  file should be downloaded as usual
+    */
+   static bool QueueSegments(pkgAcquire::Item * const Parent,
+	 std::vector<std::string> const &URIs, HashStringList const &ExpectedHashes);
+
+   pkgAcqSegment(pkgAcquire * const Owner, std::shared_ptr<pkgAcqSegmentGroup> const &Group,
+	 std::string const &URI, unsigned long long const RangeStart, unsigned long long const RangeEnd);
+   virtual ~pkgAcqSegment();
+};
+									/*}}}*/
 /** \brief Retrieve the changelog for the given version			{{{
  *
  *  Downloads the changelog to a temporary file it will also remove again
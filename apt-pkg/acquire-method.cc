@@ -173,14 +173,14 @@ void pkgAcqMethod::URIStart(FetchResult &Res)
 // AcqMethod::URIDone - A URI is finished				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-static void printHashStringList(HashStringList const * const list)
+static void printHashStringList(HashStringList const * const list, char const * const prefix = "")
 {
       for (HashStringList::const_iterator hash = list->begin(); hash != list->end(); ++hash)
       {
 	 // very old compatibility name for MD5Sum
 	 if (hash->HashType() == "MD5Sum")
-	    std::cout << "MD5-Hash: " << hash->HashValue() << "\n";
-	 std::cout << hash->HashType() << "-Hash: " << hash->HashValue() << "\n";
+	    std::cout << prefix << "MD5-Hash: " << hash->HashValue() << "\n";
+	 std::cout << prefix << hash->HashType() << "-Hash: " << hash->HashValue() << "\n";
       }
 }
 void pkgAcqMethod::URIDone(FetchResult &Res, FetchResult *Alt)
@@ -229,7 +229,7 @@ void pkgAcqMethod::URIDone(FetchResult &Res, FetchResult *Alt)
       if (Alt->LastModified != 0)
 	 std::cout << "Alt-Last-Modified: " << TimeRFC1123(Alt->LastModified, true) << "\n";
 
-      printHashStringList(&Alt->Hashes);
+      printHashStringList(&Alt->Hashes, "Alt-");
 
       if (Alt->IMSHit == true)
 	 std::cout << "Alt-IMS-Hit: true\n";
@@ -391,6 +391,9 @@ int pkgAcqMethod::Run(bool Single)
 	       Tmp->MaximumSize = Tmp->ExpectedHashes.FileSize();
 	    else
 	       Tmp->MaximumSize = strtoll(LookupTag(Message, "Maximum-Size", "0").c_str(), &End, 10);
+	    Tmp->Range(strtoull(LookupTag(Message, "Range-Start", "0").c_str(), &End, 10),
+		       strtoull(LookupTag(Message, "Range-End", "0").c_str(), &End, 10));
+	    Tmp->DecompressTo(LookupTag(Message, "Decompress-To"));
 	    Tmp->Next = 0;
 	    
 	    // Append it to the list
@@ -491,10 +494,42 @@ void pkgAcqMethod::Dequeue() {						/*{{{*/
 									/*}}}*/
 pkgAcqMethod::~pkgAcqMethod() {}
 
+struct pkgAcqMethod::FetchItem::Private
+{
+   unsigned long long RangeStart = 0;
+   unsigned long long RangeEnd = 0;
+   std::string DecompressTo;
+};
 pkgAcqMethod::FetchItem::FetchItem() :
    Next(nullptr), DestFileFd(-1), LastModified(0), IndexFile(false),
-   FailIgnore(false), MaximumSize(0), d(nullptr)
+   FailIgnore(false), MaximumSize(0), d(new Private())
 {}
-pkgAcqMethod::FetchItem::~FetchItem() {}
+unsigned long long pkgAcqMethod::FetchItem::RangeStart() const
+{
+   return d->RangeStart;
+}
+unsigned long long pkgAcqMethod::FetchItem::RangeEnd() const
+{
+   return d->RangeEnd;
+}
+void pkgAcqMethod::FetchItem::Range(unsigned long long const Start, unsigned long long const End)
+{
+   if (End < Start)
+      d->RangeStart = d->RangeEnd = 0;
+   else
+   {
+      d->RangeStart = Start;
+      d->RangeEnd = End;
+   }
+}
+std::string pkgAcqMethod::FetchItem::DecompressTo() const
+{
+   return d->DecompressTo;
+}
+void pkgAcqMethod::FetchItem::DecompressTo(std::string const &File)
+{
+   d->DecompressTo = File;
+}
+pkgAcqMethod::FetchItem::~FetchItem() { delete d; }
 
 pkgAcqMethod::FetchResult::~FetchResult() {}
@@ -53,10 +53,28 @@ class pkgAcqMethod
       // filesize (like a InRelease file)
       unsigned long long MaximumSize;
 
+      /** \brief inclusive byte range of the file requested by the item
+       *
+       * If RangeEnd() is zero the complete file is requested, otherwise
+       * only the given bytes are to be stored in DestFile (which starts
+       * with the byte at RangeStart()). */
+      unsigned long long RangeStart() const;
+      unsigned long long RangeEnd() const;
+      void Range(unsigned long long const Start, unsigned long long const End);
+
+      /** \brief file the (compressed) download can be decompressed into
+       *
+       * Methods which see the data while it is downloaded can decompress it
+       * on the fly and report the result as alternative file, so that the
+       * acquire system doesn't need to read the download again. */
+      std::string DecompressTo() const;
+      void DecompressTo(std::string const &File);
+
       FetchItem();
       virtual ~FetchItem();
       private:
-      void * const d;
+      struct Private;
+      Private * const d;
    };
    
    struct FetchResult
@@ -24,26 +24,35 @@
 #include <apt-pkg/hashes.h>
 
 #include <algorithm>
+#include <list>
 #include <string>
 #include <vector>
 #include <iostream>
 
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sstream>
+#include <time.h>
 
 #include <apti18n.h>
 									/*}}}*/
 
 using namespace std;
 
+struct pkgAcquire::Worker::Private
+{
+   // the last configuration sent to the method
+   std::string SentConfiguration;
+};
+
 // Worker::Worker - Constructor for Queue startup			/*{{{*/
 pkgAcquire::Worker::Worker(Queue *Q, MethodConfig *Cnf, pkgAcquireStatus *log) :
-   d(NULL), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
+   d(new Private()), OwnerQ(Q), Log(log), Config(Cnf), Access(Cnf->Access),
    CurrentItem(nullptr), CurrentSize(0), TotalSize(0)
 {
    Construct();
@@ -85,6 +94,7 @@ pkgAcquire::Worker::~Worker()
 	 kill(Process,SIGINT);
       ExecWait(Process,Access.c_str(),true);
    }   
+   delete d;
 }
 									/*}}}*/
 // Worker::Start - Start the worker process				/*{{{*/
@@ -197,6 +207,7 @@ enum class APT_HIDDEN MessageType {
    STATUS = 102,
    REDIRECT = 103,
    WARNING = 104,
+   PIPELINE_DEPTH = 105,
    URI_START = 200,
    URI_DONE = 201,
    URI_FAILURE = 400,
@@ -329,6 +340,25 @@ bool pkgAcquire::Worker::RunMessages()
 	    _error->Warning("%s: %s", Itm->Owner->DescURI().c_str(), LookupTag(Message,"Message").c_str());
 	    break;
 
+	 case MessageType::PIPELINE_DEPTH:
+	 {
+	    // the method can only adapt the depth if we allowed pipelining
+	    if (OwnerQ == nullptr || Config->Pipeline == false)
+	       break;
+	    unsigned long Depth = strtoul(LookupTag(Message,"Depth","0").c_str(), NULL, 10);
+	    if (Depth == 0)
+	    {
+	       _error->Error("Method gave invalid 105 Pipeline Depth message");
+	       break;
+	    }
+	    Depth = std::min(Depth, static_cast<unsigned long>(std::max(1, _config->FindI("Acquire::Max-Pipeline-Depth",10))));
+	    if (Debug == true && Depth != OwnerQ->MaxPipeDepth)
+	       clog << "Pipeline depth of queue " << OwnerQ->Name << " changes from " << OwnerQ->MaxPipeDepth << " to " << Depth << endl;
+	    OwnerQ->MaxPipeDepth = Depth;
+	    OwnerQ->Cycle();
+	    break;
+	 }
+
 	 case MessageType::URI_START:
 	 {
 	    if (Itm == nullptr)
@@ -365,6 +395,13 @@ bool pkgAcquire::Worker::RunMessages()
 	    }
 
 	    PrepareFiles("201::URIDone", Itm);
+	    {
+	       // files a method decompressed on the fly are created next to the download
+	       std::string const altfilename = LookupTag(Message, "Alt-Filename");
+	       if (altfilename.empty() == false && flNotFile(altfilename) == flNotFile(Itm->Owner->DestFile) &&
+		     RealFileExists(altfilename))
+		  ChangeOwnerAndPermissionOfFile("201::URIDone", altfilename.c_str(), "root", ROOT_GROUP, 0644);
+	    }
 
 	    // Display update before completion
 	    if (Log != 0 && Log->MorePulses == true)
@@ -628,6 +665,16 @@ bool pkgAcquire::Worker::MediaChange(string Message)
 }
 									/*}}}*/
 // Worker::SendConfiguration - Send the config to the method		/*{{{*/
+static std::string ConfigurationMessage()
+{
+   /* Write out all of the configuration directives by walking the
+      configuration tree */
+   std::ostringstream Message;
+   Message << "601 Configuration\n";
+   _config->Dump(Message, NULL, "Config-Item: %F=%V\n", false);
+   Message << '\n';
+   return Message.str();
+}
 // ---------------------------------------------------------------------
 /* */
 bool pkgAcquire::Worker::SendConfiguration()
@@ -638,17 +685,12 @@ bool pkgAcquire::Worker::SendConfiguration()
    if (OutFd == -1)
       return false;
 
-   /* Write out all of the configuration directives by walking the
-      configuration tree */
-   std::ostringstream Message;
-   Message << "601 Configuration\n";
-   _config->Dump(Message, NULL, "Config-Item: %F=%V\n", false);
-   Message << '\n';
-
+   std::string const Message = ConfigurationMessage();
    if (Debug == true)
-      clog << " -> " << Access << ':' << QuoteString(Message.str(),"\n") << endl;
-   OutQueue += Message.str();
+      clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
+   OutQueue += Message;
    OutReady = true;
+   d->SentConfiguration = Message;
 
    return true;
 }
@@ -791,6 +833,9 @@ void pkgAcquire::Worker::PrepareFiles(char const * const caller, pkgAcquire::Que
    if (RealFileExists(Itm->Owner->DestFile))
    {
       ChangeOwnerAndPermissionOfFile(caller, Itm->Owner->DestFile.c_str(), "root", ROOT_GROUP, 0644);
+      std::string const seekindex = SeekIndexFileName(Itm->Owner->DestFile);
+      if (RealFileExists(seekindex))
+	 ChangeOwnerAndPermissionOfFile(caller, seekindex.c_str(), "root", ROOT_GROUP, 0644);
       std::string const filename = Itm->Owner->DestFile;
       for (pkgAcquire::Queue::QItem::owner_iterator O = Itm->Owners.begin(); O != Itm->Owners.end(); ++O)
       {
@@ -816,3 +861,171 @@ void pkgAcquire::Worker::PrepareFiles(char const * const caller, pkgAcquire::Que
    }
 }
 									/*}}}*/
+// Worker::Park - Keep an idle method for later acquire runs		/*{{{*/
+// ---------------------------------------------------------------------
+/* The pool is process-wide so that it outlives the pkgAcquire instances.
+   The parked workers own a copy of the method capabilities as the
+   MethodConfig of the pkgAcquire they were started for is gone by the
+   time they are reused or destructed. The pool is intentionally never
+   destructed, so that no worker is stopped during static destruction. */
+namespace {
+struct PooledWorker
+{
+   pkgAcquire::Worker * Work = nullptr;
+   std::string QueueName;
+   std::string SandboxUser;
+   time_t Parked = 0;
+   pkgAcquire::MethodConfig Config;
+   ~PooledWorker() { delete Work; }
+};
+}
+static std::list<PooledWorker> &WorkerPool = *new std::list<PooledWorker>();
+static std::string SandboxUserFor(std::string const &Access)
+{
+   // a method which dropped its privileges can't regain them for a new run
+   std::string const conf = "Binary::" + Access + "::APT::Sandbox::User";
+   Configuration::Item const * const Itm = _config->Tree(conf.c_str());
+   if (Itm != nullptr)
+      return Itm->Value;
+   return _config->Find("APT::Sandbox::User");
+}
+static void CopyCapabilities(pkgAcquire::MethodConfig * const To, pkgAcquire::MethodConfig const * const From)
+{
+   To->Access = From->Access;
+   To->Version = From->Version;
+   To->SingleInstance = From->SingleInstance;
+   To->Pipeline = From->Pipeline;
+   To->SendConfig = From->SendConfig;
+   To->LocalOnly = From->LocalOnly;
+   To->NeedsCleanup = From->NeedsCleanup;
+   To->Removable = From->Removable;
+}
+static bool IsWorkerAlive(pid_t const Process)
+{
+   return Process > 0 && waitpid(Process, nullptr, WNOHANG) == 0;
+}
+static void ExpireWorkerPool()
+{
+   time_t const Now = time(nullptr);
+   int const Timeout = _config->FindI("Acquire::Worker-Pool::Idle-Timeout", 300);
+   WorkerPool.remove_if([&](PooledWorker const &P) {
+      return P.Work == nullptr || (Timeout > 0 && Now - P.Parked > Timeout);
+   });
+}
+bool pkgAcquire::Worker::Park()
+{
+   if (_config->FindB("Acquire::Worker-Pool", false) == false)
+      return false;
+   // methods dealing with media or cleanup are bound to their run
+   if (Config == nullptr || Config->NeedsCleanup == true || Config->Removable == true)
+      return false;
+   if (Process <= 0 || InFd == -1 || OutFd == -1 || CurrentItem != nullptr ||
+	 OutQueue.empty() == false || MessageQueue.empty() == false)
+      return false;
+   // the method would report on items nobody waits for anymore
+   if (OwnerQ != nullptr)
+      for (pkgAcquire::Queue::QItem const *I = OwnerQ->Items; I != nullptr; I = I->Next)
+	 if (I->Worker == this)
+	    return false;
+
+   ExpireWorkerPool();
+   int const MaxIdle = _config->FindI("Acquire::Worker-Pool::Max-Idle", 16);
+   if (MaxIdle <= 0)
+      return false;
+   while (WorkerPool.size() >= static_cast<size_t>(MaxIdle))
+      WorkerPool.pop_front();
+
+   WorkerPool.emplace_back();
+   PooledWorker &P = WorkerPool.back();
+   if (OwnerQ != nullptr)
+      P.QueueName = OwnerQ->Name;
+   P.SandboxUser = SandboxUserFor(Access);
+   P.Parked = time(nullptr);
+   CopyCapabilities(&P.Config, Config);
+   P.Work = this;
+
+   Config = &P.Config;
+   OwnerQ = nullptr;
+   Log = nullptr;
+   NextQueue = nullptr;
+   NextAcquire = nullptr;
+   Status.clear();
+   CurrentSize = TotalSize = ResumePoint = 0;
+
+   if (Debug == true)
+      clog << "Parked method " << Access << " (" << Process << ") of queue " << P.QueueName << endl;
+   return true;
+}
+									/*}}}*/
+// Worker::Unpark - Reuse an idle method from the pool			/*{{{*/
+pkgAcquire::Worker * pkgAcquire::Worker::Unpark(Queue * const OwnerQ, MethodConfig * const Config, pkgAcquireStatus * const Log)
+{
+   if (_config->FindB("Acquire::Worker-Pool", false) == false || WorkerPool.empty())
+      return nullptr;
+   ExpireWorkerPool();
+
+   std::string const SandboxUser = SandboxUserFor(Config->Access);
+   auto Found = WorkerPool.end();
+   for (auto P = WorkerPool.begin(); P != WorkerPool.end();)
+   {
+      if (P->Work->Access != Config->Access || P->SandboxUser != SandboxUser)
+      {
+	 ++P;
+	 continue;
+      }
+      if (IsWorkerAlive(P->Work->Process) == false)
+      {
+	 P->Work->Process = -1;
+	 P = WorkerPool.erase(P);
+	 continue;
+      }
+      Found = P;
+      // a method which talked to the same host might still be connected
+      if (OwnerQ != nullptr && P->QueueName == OwnerQ->Name)
+	 break;
+      ++P;
+   }
+   if (Found == WorkerPool.end())
+      return nullptr;
+
+   Worker * const Work = Found->Work;
+   Found->Work = nullptr;
+   WorkerPool.erase(Found);
+
+   Work->OwnerQ = OwnerQ;
+   Work->Config = Config;
+   Work->Log = Log;
+   Work->Debug = _config->FindB("Debug::pkgAcquire::Worker",false);
+   if (Work->Debug == true)
+      clog << "Reusing method " << Work->Access << " (" << Work->Process << ")" << endl;
+
+   // the method discards its old configuration if it gets a new one
+   if (Config->SendConfig == true && Work->d->SentConfiguration != ConfigurationMessage())
+      Work->SendConfiguration();
+   return Work;
+}
+									/*}}}*/
+// Worker::DrainPool - Stop idle methods which can't be reused		/*{{{*/
+void pkgAcquire::Worker::DrainPool()
+{
+   if (_config->FindB("Acquire::Worker-Pool", false) == false)
+      WorkerPool.clear();
+   else
+      ExpireWorkerPool();
+}
+									/*}}}*/
+// Worker::PooledCapabilities - Capabilities of an idle method		/*{{{*/
+bool pkgAcquire::Worker::PooledCapabilities(MethodConfig * const Config)
+{
+   if (_config->FindB("Acquire::Worker-Pool", false) == false)
+      return false;
+   for (auto const &P: WorkerPool)
+   {
+      if (P.Work == nullptr || P.Config.Access != Config->Access)
+	 continue;
+      CopyCapabilities(Config, &P.Config);
+      return true;
+   }
+   return false;
+}
+									/*}}}*/
@@ -46,8 +46,8 @@
  */
 class pkgAcquire::Worker : public WeakPointable
 {
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   struct Private;
+   Private * const d;
   
    friend class pkgAcquire;
    
@@ -56,7 +56,7 @@ class pkgAcquire::Worker : public WeakPointable
 
    /** \brief The next link on the Queue list.
     *
-    *  \todo This is always NULL; is it just for future use?
+    *  Only non-NULL if the queue uses more than one connection.
     */
    Worker *NextQueue;
 
@@ -327,6 +327,39 @@ class pkgAcquire::Worker : public WeakPointable
    virtual ~Worker();
 
 private:
+   /** \brief hand this idle worker over to the process-wide pool
+    *
+    *  With Acquire::Worker-Pool enabled the method process of a worker
+    *  which has nothing in flight is kept alive after the acquire run,
+    *  so that a later pkgAcquire instance can reuse it instead of
+    *  starting a new one.
+    *
+    *  \return \b true if the pool took over the worker, otherwise the
+    *  caller still owns it and has to delete it.
+    */
+   APT_HIDDEN bool Park();
+   /** \brief take a running worker for the given access from the pool
+    *
+    *  The method receives the current configuration again if it
+    *  changed since it was last sent, in which case the method discards
+    *  its previous configuration.
+    *
+    *  \return the worker or \b nullptr if no suitable one is idle
+    */
+   static APT_HIDDEN Worker * Unpark(Queue * const OwnerQ, MethodConfig * const Config, pkgAcquireStatus * const Log);
+   /** \brief fill in the capabilities from an idle worker in the pool
+    *
+    *  \return \b false if no worker for this access is idle
+    */
+   static APT_HIDDEN bool PooledCapabilities(MethodConfig * const Config);
+   /** \brief stop the idle workers in the pool which can't be reused
+    *
+    *  These are the ones which exceeded Acquire::Worker-Pool::Idle-Timeout
+    *  or all of them if the pool was disabled. Called as each pkgAcquire
+    *  instance is shut down, as the pool itself is never destructed: The
+    *  methods still idle on exit terminate as their input is closed.
+    */
+   static APT_HIDDEN void DrainPool();
    APT_HIDDEN void PrepareFiles(char const * const caller, pkgAcquire::Queue::QItem const * const Itm);
 };
 
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <limits>
 #include <memory>
 
 #include <stdio.h>
@@ -209,6 +210,7 @@ void pkgAcquire::Shutdown()
       Queues = Queues->Next;
       delete Jnk;
    }   
+   Worker::DrainPool();
 }
 									/*}}}*/
 // Acquire::Add - Add a new item					/*{{{*/
@@ -478,9 +480,12 @@ pkgAcquire::MethodConfig *pkgAcquire::GetConfig(string Access)
    Configs = Conf;
 
    // Create the worker to fetch the configuration
-   Worker Work(Conf);
-   if (Work.Start() == false)
-      return 0;
+   if (Worker::PooledCapabilities(Conf) == false)
+   {
+      Worker Work(Conf);
+      if (Work.Start() == false)
+	 return 0;
+   }
 
    /* if a method uses DownloadLimit, we switch to SingleInstance mode */
    if(_config->FindI("Acquire::"+Access+"::Dl-Limit",0) > 0)
@@ -660,10 +665,35 @@ static void CheckDropPrivsMustBeDisabled(pkgAcquire const &Fetcher)
    if (setgroups(old_gidlist_nr, old_gidlist.get()))
       _error->FatalE("setgroups", "setgroups %u failed", 0);
 }
+/* The methods share the name resolutions they did in this file. It only
+   lives as long as the run as the methods can write to it: Kept for later
+   runs a compromised method could poison it for all methods to come. */
+static std::string CreateResolverCache()
+{
+   if (_config->FindB("Acquire::Connect::Cache", true) == false)
+      return "";
+   std::string const SandboxUser = _config->Find("APT::Sandbox::User");
+   std::string const Template = flCombine(GetTempDir(SandboxUser), "apt.dnscache.XXXXXX");
+   std::unique_ptr<char, decltype(std::free) *> File { strdup(Template.c_str()), std::free };
+   int const Fd = mkstemp(File.get());
+   if (Fd == -1)
+      return "";
+   if (getuid() == 0 && SandboxUser.empty() == false && SandboxUser != "root")
+   {
+      struct passwd const * const pw = getpwnam(SandboxUser.c_str());
+      if (pw != NULL && fchown(Fd, pw->pw_uid, -1) != 0)
+	 _error->WarningE("CreateResolverCache", "chown to %s of file %s failed", SandboxUser.c_str(), File.get());
+   }
+   close(Fd);
+   return File.get();
+}
 pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
 {
    _error->PushToStack();
    CheckDropPrivsMustBeDisabled(*this);
+   std::string const ResolverCache = CreateResolverCache();
+   if (ResolverCache.empty() == false)
+      _config->Set("Acquire::Connect::Cache::File", ResolverCache);
 
    Running = true;
    
@@ -730,6 +760,12 @@ pkgAcquire::RunResult pkgAcquire::Run(int PulseIntervall)
    for (ItemIterator I = Items.begin(); I != Items.end(); ++I)
       (*I)->Finished();
 
+   if (ResolverCache.empty() == false)
+   {
+      RemoveFile("pkgAcquire::Run", ResolverCache);
+      _config->Clear("Acquire::Connect::Cache::File");
+   }
+
    bool const newError = _error->PendingError();
    _error->MergeWithStack();
    if (newError)
@@ -794,7 +830,8 @@ bool pkgAcquire::Clean(string Dir)
       // Look in the get list
       ItemCIterator I = Items.begin();
       for (; I != Items.end(); ++I)
-	 if (flNotDir((*I)->DestFile) == Dir->d_name)
+	 if (flNotDir((*I)->DestFile) == Dir->d_name ||
+	       flNotDir(SeekIndexFileName((*I)->DestFile)) == Dir->d_name)
 	    break;
       
       // Nothing found, nuke it
@@ -895,6 +932,19 @@ pkgAcquire::Queue::~Queue()
    }
 }
 									/*}}}*/
+static bool IsLargestFirst()						/*{{{*/
+{
+   return _config->Find("Acquire::Queue-Order", "fifo") == "largest-first";
+}
+									/*}}}*/
+static unsigned long long ExpectedSize(pkgAcquire::Item const * const Owner)/*{{{*/
+{
+   unsigned long long const Size = Owner->GetExpectedHashes().FileSize();
+   if (Size != 0)
+      return Size;
+   return Owner->FileSize;
+}
+									/*}}}*/
 // Queue::Enqueue - Queue an item to the queue				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -916,11 +966,21 @@ bool pkgAcquire::Queue::Enqueue(ItemDesc &Item)
       }
       return true;
    };
+   // segments request only a part of the file, so they can't be combined
+   // with any other item for the same URI
+   auto IsSegment = [](pkgAcquire::Item const * const Owner) {
+      return dynamic_cast<pkgAcqSegment const *>(Owner) != nullptr;
+   };
+   // with largest-first ordering items of the same priority are sorted by
+   // size so that no big file is started last on an otherwise idle link
+   bool const LargestFirst = IsLargestFirst();
+   unsigned long long const ItemSize = LargestFirst ? ExpectedSize(Item.Owner) : 0;
    QItem **OptimalI = &Items;
    QItem **I = &Items;
    // move to the end of the queue and check for duplicates here
    for (; *I != 0; ) {
-      if (Item.URI == (*I)->URI && MetaKeysMatch(Item, *I))
+      if (Item.URI == (*I)->URI && MetaKeysMatch(Item, *I) &&
+	    IsSegment(Item.Owner) == false && IsSegment((*I)->Owner) == false)
       {
 	 if (_config->FindB("Debug::pkgAcquire::Worker",false) == true)
 	    std::cerr << " @ Queue: Action combined for " << Item.URI << " and " << (*I)->URI << std::endl;
@@ -929,11 +989,13 @@ bool pkgAcquire::Queue::Enqueue(ItemDesc &Item)
 	 return false;
       }
       // Determine the optimal position to insert: before anything with a
-      // higher priority.
+      // higher priority (and with largest-first before smaller items).
       int priority = (*I)->GetPriority();
+      bool const larger = LargestFirst == false || (*I)->GetExpectedSize() >= ItemSize;
 
       I = &(*I)->Next;
-      if (priority >= Item.Owner->Priority()) {
+      if (priority > Item.Owner->Priority() ||
+	    (priority == Item.Owner->Priority() && larger)) {
 	 OptimalI = I;
       }
    }
@@ -983,6 +1045,38 @@ bool pkgAcquire::Queue::Dequeue(Item *Owner)
 // ---------------------------------------------------------------------
 /* It is possible for this to be called with a pre-existing set of
    workers. */
+static unsigned long GetConnectionsForQueue(std::string const &Name, pkgAcquire::MethodConfig const * const Cnf)
+{
+   // methods which are limited to one instance can't have more connections
+   if (Cnf->SingleInstance == true || Cnf->LocalOnly == true || Cnf->Removable == true)
+      return 1;
+
+   // queue names are either "access" or "access:host"
+   std::string const Access = Cnf->Access;
+   std::string Host;
+   if (Name.length() > Access.length() + 1 && Name[Access.length()] == ':')
+      Host = Name.substr(Access.length() + 1);
+
+   int Connections = _config->FindI("Acquire::" + Access + "::Connections", 1);
+   if (Host.empty() == false)
+      Connections = _config->FindI("Acquire::" + Access + "::" + Host + "::Connections", Connections);
+   return Connections < 1 ? 1 : Connections;
+}
+bool pkgAcquire::Queue::StartWorker(pkgAcquire::MethodConfig * const Cnf)
+{
+   pkgAcquire::Worker * Work = Worker::Unpark(this,Cnf,Owner->Log);
+   bool const Reused = Work != nullptr;
+   if (Reused == false)
+      Work = new Worker(this,Cnf,Owner->Log);
+   Work->NextQueue = Workers;
+   Workers = Work;
+   Owner->Add(Work);
+   if (Reused == false && Work->Start() == false)
+      return false;
+   if (Owner->Debug == true && Work->NextQueue != nullptr)
+      clog << "Started another worker for queue " << Name << endl;
+   return true;
+}
 bool pkgAcquire::Queue::Startup()
 {
    if (Workers == 0)
@@ -1002,11 +1096,10 @@ bool pkgAcquire::Queue::Startup()
 	 I = INext;
       }
 
-      Workers = new Worker(this,Cnf,Owner->Log);
-      Owner->Add(Workers);
-      if (Workers->Start() == false)
+      // further connections are started by Cycle once they are needed
+      if (StartWorker(Cnf) == false)
 	 return false;
-      
+
       /* When pipelining we commit 10 items. This needs to change when we
          added other source retry to have cycle maintain a pipeline depth
          on its own. */
@@ -1034,7 +1127,9 @@ bool pkgAcquire::Queue::Shutdown(bool Final)
       {
 	 *Cur = Jnk->NextQueue;
 	 Owner->Remove(Jnk);
-	 delete Jnk;
+	 // idle workers can be reused by later runs if the pool is enabled
+	 if (Final == true || Jnk->Park() == false)
+	    delete Jnk;
       }
       else
 	 Cur = &(*Cur)->NextQueue;      
@@ -1091,10 +1186,17 @@ bool pkgAcquire::Queue::Cycle()
    if (PipeDepth < 0)
       return _error->Error("Pipedepth failure");
 
+   // the pipeline depth is per connection, more are started on demand
+   signed long Connections = 0;
+   unsigned long MaxConnections = 0;
+   pkgAcquire::MethodConfig * Cnf = nullptr;
+   for (pkgAcquire::Worker *W = Workers; W != 0; W = W->NextQueue)
+      ++Connections;
+
    // Look for a queable item
    QItem *I = Items;
    int ActivePriority = 0;
-   while (PipeDepth < (signed)MaxPipeDepth)
+   while (true)
    {
       for (; I != 0; I = I->Next) {
 	 if (I->Owner->Status == pkgAcquire::Item::StatFetching)
@@ -1111,11 +1213,68 @@ bool pkgAcquire::Queue::Cycle()
       // the queue is idle
       if (I->GetPriority() < ActivePriority)
 	 return true;
-      I->Worker = Workers;
+
+      /* Each worker is a connection of its own, so if the host allows it
+         and all connections are busy we start another worker for the item.
+         Otherwise it is handed to the connection with the fewest items in
+         flight, with largest-first to the one with the fewest bytes. */
+      pkgAcquire::Worker *Work = nullptr;
+      bool Idle = false;
+      if (Connections == 1)
+      {
+	 Idle = PipeDepth == 0;
+	 if (PipeDepth < (signed)MaxPipeDepth)
+	    Work = Workers;
+      }
+      else
+      {
+	 bool const LargestFirst = IsLargestFirst();
+	 unsigned long long WorkLoad = std::numeric_limits<unsigned long long>::max();
+	 for (pkgAcquire::Worker *W = Workers; W != 0; W = W->NextQueue)
+	 {
+	    signed long Depth = 0;
+	    unsigned long long Bytes = 0;
+	    for (QItem const *J = Items; J != 0; J = J->Next)
+	       if (J->Worker == W && J->Owner->Status == pkgAcquire::Item::StatFetching)
+	       {
+		  ++Depth;
+		  Bytes += J->GetExpectedSize();
+	       }
+	    if (Depth == 0)
+	       Idle = true;
+	    if (Depth >= (signed)MaxPipeDepth)
+	       continue;
+	    unsigned long long const Load = LargestFirst ? Bytes : Depth;
+	    if (Load < WorkLoad)
+	    {
+	       Work = W;
+	       WorkLoad = Load;
+	    }
+	 }
+      }
+      if (Idle == false)
+      {
+	 if (MaxConnections == 0)
+	 {
+	    Cnf = Owner->GetConfig(Workers->GetConf()->Access);
+	    MaxConnections = Cnf == nullptr ? 1 : GetConnectionsForQueue(Name, Cnf);
+	 }
+	 if ((unsigned long)Connections < MaxConnections)
+	 {
+	    if (StartWorker(Cnf) == false)
+	       return false;
+	    Work = Workers;
+	    ++Connections;
+	 }
+      }
+      if (Work == nullptr)
+	 return true;
+
+      I->Worker = Work;
       for (auto const &O: I->Owners)
 	 O->Status = pkgAcquire::Item::StatFetching;
       PipeDepth++;
-      if (Workers->QueueItem(I) == false)
+      if (Work->QueueItem(I) == false)
 	 return false;
    }
 
@@ -1176,6 +1335,14 @@ APT_PURE unsigned long long pkgAcquire::Queue::QItem::GetMaximumSize() const	/*{
    return Maximum;
 }
 									/*}}}*/
+APT_PURE unsigned long long pkgAcquire::Queue::QItem::GetExpectedSize() const/*{{{*/
+{
+   unsigned long long Size = 0;
+   for (auto const &O: Owners)
+      Size = std::max(Size, ExpectedSize(O));
+   return Size;
+}
+									/*}}}*/
 APT_PURE int pkgAcquire::Queue::QItem::GetPriority() const		/*{{{*/
 {
    int Priority = 0;
@@ -1230,7 +1397,12 @@ std::string pkgAcquire::Queue::QItem::Custom600Headers() const		/*{{{*/
 // AcquireStatus::pkgAcquireStatus - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgAcquireStatus::pkgAcquireStatus() : d(NULL), Percent(-1), Update(true), MorePulses(false)
+struct pkgAcquireStatus::Private
+{
+   unsigned long long FirstEstimatedTime = 0;
+   unsigned long long EstimatedTime = 0;
+};
+pkgAcquireStatus::pkgAcquireStatus() : d(new Private()), Percent(-1), Update(true), MorePulses(false)
 {
    Start();
 }
@@ -1314,6 +1486,17 @@ bool pkgAcquireStatus::Pulse(pkgAcquire *Owner)
       LastBytes = CurrentBytes - ResumeSize;
       ElapsedTime = (unsigned long long)Delta;
       Time = NewTime;
+
+      // estimate when we will be done to compare it later on with reality
+      if (CurrentCPS > 0 && ExpectAdditionalItems == false)
+      {
+	 unsigned long long const Running = NewTime.tv_sec - StartTime.tv_sec;
+	 // sizes can be unknown or larger than announced, nothing is left then
+	 unsigned long long const Remaining = CurrentBytes < TotalBytes ? TotalBytes - CurrentBytes : 0;
+	 d->EstimatedTime = Running + Remaining / CurrentCPS;
+	 if (d->FirstEstimatedTime == 0)
+	    d->FirstEstimatedTime = d->EstimatedTime;
+      }
    }
 
    double const OldPercent = Percent;
@@ -1387,6 +1570,8 @@ void pkgAcquireStatus::Start()
    ElapsedTime = 0;
    TotalItems = 0;
    CurrentItems = 0;
+   d->FirstEstimatedTime = 0;
+   d->EstimatedTime = 0;
 }
 									/*}}}*/
 // AcquireStatus::Stop - Finished downloading				/*{{{*/
@@ -1408,6 +1593,16 @@ void pkgAcquireStatus::Stop()
       CurrentCPS = FetchedBytes/Delta;
    LastBytes = CurrentBytes;
    ElapsedTime = (unsigned long long)Delta;
+
+   if (_config->FindB("Debug::acquire::progress", false) == true)
+      std::clog << "Download took " << TimeToStr(ElapsedTime)
+	 << " (estimated: " << TimeToStr(EstimatedTime())
+	 << ", first estimation: " << TimeToStr(EstimatedTime(true)) << ")" << std::endl;
+}
+									/*}}}*/
+APT_PURE unsigned long long pkgAcquireStatus::EstimatedTime(bool const First) const/*{{{*/
+{
+   return First ? d->FirstEstimatedTime : d->EstimatedTime;
 }
 									/*}}}*/
 // AcquireStatus::Fetched - Called when a byte set has been fetched	/*{{{*/
@@ -1430,4 +1625,4 @@ pkgAcquire::UriIterator::UriIterator(pkgAcquire::Queue *Q) : d(NULL), CurQ(Q), C
 
 APT_CONST pkgAcquire::UriIterator::~UriIterator() {}
 APT_CONST pkgAcquire::MethodConfig::~MethodConfig() {}
-APT_CONST pkgAcquireStatus::~pkgAcquireStatus() {}
+pkgAcquireStatus::~pkgAcquireStatus() { delete d; }
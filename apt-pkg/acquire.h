@@ -112,6 +112,7 @@ class pkgAcquire
    struct ItemDesc;
    friend class Item;
    friend class pkgAcqMetaBase;
+   friend class pkgAcqSegment;
    friend class Queue;
 
    typedef std::vector<Item *>::iterator ItemIterator;
@@ -466,6 +467,8 @@ class pkgAcquire::Queue
       std::string Custom600Headers() const;
       /** @return the maximum priority of this item */
       int APT_HIDDEN GetPriority() const;
+      /** @return the biggest expected size of all owners (or 0 if unknown) */
+      unsigned long long APT_HIDDEN GetExpectedSize() const;
    };
 
    /** \brief The name of this queue. */
@@ -479,10 +482,10 @@ class pkgAcquire::Queue
 
    /** \brief The head of the list of workers associated with this queue.
     *
-    *  \todo This is plural because support exists in Queue for
-    *  multiple workers.  However, it does not appear that there is
-    *  any way to actually associate more than one worker with a
-    *  queue.
+    *  Usually a queue has a single worker, but the number of
+    *  connections for a method (and host) can be increased with
+    *  Acquire::<method>::Connections and Acquire::<method>::<host>::Connections
+    *  in which case each of these workers is fed items by Cycle().
     *
     *  \todo Why not just use a std::set?
     */
@@ -497,9 +500,12 @@ class pkgAcquire::Queue
    signed long PipeDepth;
 
    /** \brief The maximum number of entries that this queue will
-    *  attempt to download at once.
+    *  attempt to download at once per worker.
     */
    unsigned long MaxPipeDepth;
+
+   /** \brief Start another worker (or reuse a parked one) for this queue. */
+   APT_HIDDEN bool StartWorker(MethodConfig * const Cnf);
    
    public:
    
@@ -567,6 +573,9 @@ class pkgAcquire::Queue
    /** \brief Send idle items to the worker process.
     *
     *  Fills up the pipeline by inserting idle items into the worker's queue.
+    *  If all workers are busy and the host allows more connections another
+    *  worker is started, otherwise the item is given to the worker with
+    *  the fewest items in flight.
     */
    bool Cycle();
 
@@ -696,8 +705,8 @@ struct pkgAcquire::MethodConfig
  */
 class pkgAcquireStatus
 {
-   /** \brief dpointer placeholder (for later in case we need it) */
-   void * const d;
+   struct Private;
+   Private * const d;
 
    protected:
    
@@ -825,6 +834,18 @@ class pkgAcquireStatus
     */
    virtual bool Pulse(pkgAcquire *Owner);
 
+   /** \brief The estimated duration of the whole download in seconds.
+    *
+    *  The estimation is based on the expected sizes of all items and the
+    *  current rate of download and is updated with every Pulse(). Once the
+    *  download is stopped it can be compared with the #ElapsedTime it
+    *  actually took. 0 if no estimation could be made (yet).
+    *
+    *  \param First if \b true return the first estimation made instead
+    *  of the most recent one.
+    */
+   unsigned long long EstimatedTime(bool const First = false) const;
+
    /** \brief Invoked when the Acquire process starts running. */
    virtual void Start();
 
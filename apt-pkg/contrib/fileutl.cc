@@ -53,6 +53,8 @@
 #include <set>
 #include <algorithm>
 #include <memory>
+#include <fstream>
+#include <sstream>
 
 #ifdef HAVE_ZLIB
 	#include <zlib.h>
@@ -66,11 +68,19 @@
 #ifdef HAVE_LZ4
 	#include <lz4frame.h>
 #endif
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
 #include <endian.h>
 #include <stdint.h>
 
 #if __gnu_linux__
 #include <sys/prctl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SENDFILE_H
+#include <sys/sendfile.h>
 #endif
 
 #include <apti18n.h>
@@ -156,15 +166,90 @@ bool RunScripts(const char *Cnf)
 }
 									/*}}}*/
 
+// KernelCopyFile - Copy a file without passing the data through us	/*{{{*/
+// ---------------------------------------------------------------------
+/* Lets the kernel copy the rest of From to the end of To with a reflink,
+   copy_file_range() or sendfile(). Returns false without an error if it
+   can't be used for these files, so that the caller falls back to the
+   buffered copy of the rest. */
+static bool KernelCopyFile(FileFd &From, FileFd &To)
+{
+   if (From.IsCompressed() == true || To.IsCompressed() == true)
+      return false;
+   struct stat Buf;
+   if (fstat(From.Fd(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false)
+      return false;
+   unsigned long long const FromSize = Buf.st_size;
+   if (To.Flush() == false || fstat(To.Fd(), &Buf) != 0 || S_ISREG(Buf.st_mode) == false)
+      return false;
+   unsigned long long const ToSize = Buf.st_size;
+   // the positions of the FileFds include their buffers, not the ones of the fds
+   off_t InOff = From.Tell();
+   off_t OutOff = To.Tell();
+   if (static_cast<unsigned long long>(InOff) >= FromSize)
+      return true;
+
+   bool Done = false;
+#ifdef FICLONE
+   // a copy-on-write clone of the whole file is just a metadata update
+   if (InOff == 0 && OutOff == 0 && ToSize == 0 && ioctl(To.Fd(), FICLONE, From.Fd()) == 0)
+   {
+      InOff = OutOff = FromSize;
+      Done = true;
+   }
+#else
+   (void)ToSize;
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+   while (Done == false)
+   {
+      ssize_t const Res = copy_file_range(From.Fd(), &InOff, To.Fd(), &OutOff, APT_BUFFER_SIZE * 16, 0);
+      if (Res > 0)
+	 continue;
+      else if (Res == 0)
+	 Done = true;
+      else if (errno != EINTR)
+	 break;
+   }
+#endif
+#ifdef HAVE_SENDFILE_H
+   // sendfile writes at the current position of the output fd
+   if (Done == false && lseek(To.Fd(), OutOff, SEEK_SET) == OutOff)
+   {
+      while (Done == false)
+      {
+	 off_t const Start = InOff;
+	 ssize_t const Res = sendfile(To.Fd(), From.Fd(), &InOff, APT_BUFFER_SIZE * 16);
+	 if (Res > 0)
+	    OutOff += InOff - Start;
+	 else if (Res == 0)
+	    Done = true;
+	 else if (errno != EINTR)
+	    break;
+      }
+   }
+#endif
+   // resync the FileFds with the data the kernel wrote for us
+   if (From.Seek(InOff) == false || To.Seek(OutOff) == false)
+      return false;
+   return Done;
+}
+									/*}}}*/
 // CopyFile - Buffered copy of a file					/*{{{*/
 // ---------------------------------------------------------------------
-/* The caller is expected to set things so that failure causes erasure */
+/* The caller is expected to set things so that failure causes erasure.
+   Uncompressed regular files are copied inside the kernel if possible. */
 bool CopyFile(FileFd &From,FileFd &To)
 {
    if (From.IsOpen() == false || To.IsOpen() == false ||
 	 From.Failed() == true || To.Failed() == true)
       return false;
 
+   if (KernelCopyFile(From, To) == true)
+      return true;
+   if (From.Failed() == true || To.Failed() == true)
+      return false;
+
    // Buffered copy between fds
    constexpr size_t BufSize = APT_BUFFER_SIZE;
    std::unique_ptr<unsigned char[]> Buf(new unsigned char[BufSize]);
@@ -1000,6 +1085,92 @@ struct APT_HIDDEN simple_buffer {							/*{{{*/
    }
 };
 									/*}}}*/
+// SeekIndex - block offsets of FileFd::BlockCompress files		/*{{{*/
+/* A file written with FileFd::BlockCompress consists of blocks which are
+   complete streams of the compressor, which all our compressors
+   (except bzip2 and lzma-alone) decompress as if it were one stream.
+   The offsets of the blocks are stored in a small text file next to it,
+   so a seek can start decompressing at the block containing the offset
+   instead of at the start of the file. The first line of the index
+   identifies the compressed file by size and its last bytes, so that an
+   index isn't used for a file which was changed without it. */
+struct APT_HIDDEN SeekBlock {
+   unsigned long long uncompressed;
+   unsigned long long compressed;
+};
+static bool SeekIndexIdentity(std::string const &File, std::string &Identity)
+{
+   int const fd = open(File.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return false;
+   struct stat Buf;
+   unsigned char tail[16];
+   bool okay = fstat(fd, &Buf) == 0;
+   off_t const start = Buf.st_size > 16 ? Buf.st_size - 16 : 0;
+   if (okay == true)
+      okay = pread(fd, tail, Buf.st_size - start, start) == Buf.st_size - start;
+   close(fd);
+   if (okay == false)
+      return false;
+   strprintf(Identity, "%llu ", static_cast<unsigned long long>(Buf.st_size));
+   for (off_t i = 0; i < Buf.st_size - start; ++i)
+   {
+      char hex[3];
+      snprintf(hex, sizeof(hex), "%02x", tail[i]);
+      Identity.append(hex);
+   }
+   return true;
+}
+static bool ReadSeekIndex(std::string const &File, std::vector<SeekBlock> &Blocks, unsigned long long &Size)
+{
+   std::string const IndexFile = SeekIndexFileName(File);
+   if (RealFileExists(IndexFile) == false)
+      return false;
+   std::ifstream index(IndexFile);
+   std::string line, identity;
+   if (!std::getline(index, line) || line != "APT-Seek-Index: 1" ||
+	 !std::getline(index, line) || SeekIndexIdentity(File, identity) == false ||
+	 line != "Compressed: " + identity)
+   {
+      if (_config->FindB("Debug::FileFd::SeekIndex", false) == true)
+	 std::clog << "Ignore seek index " << IndexFile << " as it doesn't belong to " << File << std::endl;
+      return false;
+   }
+   if (!std::getline(index, line) || sscanf(line.c_str(), "Uncompressed: %llu", &Size) != 1)
+      return false;
+   SeekBlock block;
+   while (index >> block.uncompressed >> block.compressed)
+   {
+      if (Blocks.empty() ? block.uncompressed != 0 :
+	    (block.uncompressed <= Blocks.back().uncompressed || block.compressed <= Blocks.back().compressed))
+	 return false;
+      Blocks.push_back(block);
+   }
+   return index.eof() && Blocks.empty() == false && Blocks.back().uncompressed <= Size;
+}
+static bool WriteSeekIndex(std::string const &File, std::string const &IndexFile,
+      std::vector<SeekBlock> const &Blocks, unsigned long long const Size)
+{
+   std::string identity;
+   if (SeekIndexIdentity(File, identity) == false)
+      return _error->Errno("open", _("Could not open file %s"), File.c_str());
+   std::ostringstream index;
+   index << "APT-Seek-Index: 1\n"
+      << "Compressed: " << identity << "\n"
+      << "Uncompressed: " << Size << "\n";
+   for (auto const &block : Blocks)
+      index << block.uncompressed << ' ' << block.compressed << '\n';
+   std::string const content = index.str();
+   FileFd out(IndexFile, FileFd::WriteAtomic);
+   if (out.Write(content.c_str(), content.length()) == false)
+      return false;
+   return out.Close();
+}
+std::string SeekIndexFileName(std::string const &File)
+{
+   return File + ".seekindex";
+}
+									/*}}}*/
 
 class APT_HIDDEN FileFdPrivate {							/*{{{*/
    friend class BufferedWriteFileFdPrivate;
@@ -1013,10 +1184,23 @@ protected:
    unsigned int openmode;
    unsigned long long seekpos;
 public:
+   // blocks of a FileFd::BlockCompress file (while writing or from its index)
+   std::vector<SeekBlock> seekblocks;
+   // uncompressed size of a block while writing, 0 if blocks aren't used
+   unsigned long long seekblocksize;
+   // uncompressed bytes written so far
+   unsigned long long blockwritten;
+   // -1 if not yet tried to load the index, 0 if there is no usable one
+   int seekindex;
+   // uncompressed size of the file according to the index
+   unsigned long long seekindexsize;
+   // uncompressed offset the decompressor was started at
+   unsigned long long blockbase;
 
    explicit FileFdPrivate(FileFd * const pfilefd) : filefd(pfilefd),
       compressed_fd(-1), compressor_pid(-1), is_pipe(false),
-      openmode(0), seekpos(0) {};
+      openmode(0), seekpos(0), seekblocksize(0), blockwritten(0),
+      seekindex(-1), seekindexsize(0), blockbase(0) {};
    virtual APT::Configuration::Compressor get_compressor() const
    {
       return compressor;
@@ -1115,9 +1299,29 @@ public:
       unsigned long long const iseekpos = filefd->Tell();
       if (iseekpos == To)
 	 return true;
+      SeekBlock const * const block = FindSeekBlock(To);
+      if (block != nullptr && (To < iseekpos || block->uncompressed > iseekpos))
+      {
+	 if (Reopen(*block) == false)
+	    return false;
+	 if (To != block->uncompressed)
+	    return filefd->Skip(To - block->uncompressed);
+	 return true;
+      }
       else if (iseekpos < To)
 	 return filefd->Skip(To - iseekpos);
 
+      if (Reopen(SeekBlock{0, 0}) == false)
+	 return false;
+      if (To != 0)
+	 return filefd->Skip(To);
+
+      seekpos = To;
+      return true;
+   }
+   // start decompressing again at the given block
+   bool Reopen(SeekBlock const &block)
+   {
       if ((openmode & FileFd::ReadOnly) != FileFd::ReadOnly)
 	 return filefd->FileFdError("Reopen is only implemented for read-only files!");
       InternalClose(filefd->FileName);
@@ -1136,16 +1340,64 @@ public:
 	 if (filefd->iFd < 0)
 	    return filefd->FileFdError("Reopen is not implemented for pipes opened with FileFd::OpenDescriptor()!");
       }
+      if (block.compressed != 0 && lseek(filefd->iFd, block.compressed, SEEK_SET) != (off_t)block.compressed)
+	 return filefd->FileFdErrno("lseek", "Unable to seek to block at %llu in %s", block.compressed, filefd->FileName.c_str());
 
       if (filefd->OpenInternDescriptor(openmode, compressor) == false)
 	 return filefd->FileFdError("Seek on file %s because it couldn't be reopened", filefd->FileName.c_str());
 
       buffer.reset();
-      set_seekpos(0);
-      if (To != 0)
-	 return filefd->Skip(To);
-
-      seekpos = To;
+      blockbase = block.uncompressed;
+      set_seekpos(block.uncompressed);
+      return true;
+   }
+   // the block containing the uncompressed offset, if the file has an index
+   SeekBlock const * FindSeekBlock(unsigned long long const To)
+   {
+      if (LoadSeekIndex() == false)
+	 return nullptr;
+      auto const b = std::upper_bound(seekblocks.begin(), seekblocks.end(), To,
+	    [](unsigned long long const t, SeekBlock const &b) { return t < b.uncompressed; });
+      if (b == seekblocks.begin())
+	 return nullptr;
+      return &(*(b - 1));
+   }
+   bool LoadSeekIndex()
+   {
+      if (seekindex != -1)
+	 return seekindex == 1;
+      seekindex = 0;
+      if ((filefd->Flags & FileFd::Compressed) != FileFd::Compressed ||
+	    (openmode & FileFd::WriteOnly) == FileFd::WriteOnly ||
+	    filefd->FileName.empty() || InternalConcatenated() == false)
+	 return false;
+      std::vector<SeekBlock> blocks;
+      if (ReadSeekIndex(filefd->FileName, blocks, seekindexsize) == false)
+	 return false;
+      seekblocks.swap(blocks);
+      seekindex = 1;
+      return true;
+   }
+   // finish the compressed stream of the current block and start a new one
+   bool FinishBlock()
+   {
+      if (InternalFlush() == false)
+	 return false;
+      int const fd = dup(filefd->iFd);
+      if (fd == -1)
+	 return filefd->FileFdErrno("dup", "Unable to start a new block in %s", filefd->FileName.c_str());
+      if (InternalClose(filefd->FileName) == false)
+      {
+	 close(fd);
+	 return filefd->FileFdError("Unable to finish block in %s", filefd->FileName.c_str());
+      }
+      filefd->iFd = fd;
+      off_t const offset = lseek(fd, 0, SEEK_CUR);
+      if (offset < 0)
+	 return filefd->FileFdErrno("lseek", "Unable to start a new block in %s", filefd->FileName.c_str());
+      if (InternalOpen(fd, get_openmode()) == false)
+	 return filefd->FileFdError("Unable to start a new block in %s", filefd->FileName.c_str());
+      seekblocks.push_back(SeekBlock{blockwritten, static_cast<unsigned long long>(offset)});
       return true;
    }
    virtual bool InternalSkip(unsigned long long Over)
@@ -1175,6 +1427,8 @@ public:
    }
    virtual unsigned long long InternalSize()
    {
+      if (LoadSeekIndex())
+	 return seekindexsize;
       unsigned long long size = 0;
       unsigned long long const oldSeek = filefd->Tell();
       unsigned long long constexpr ignoresize = 1024;
@@ -1194,6 +1448,8 @@ public:
    virtual bool InternalClose(std::string const &FileName) = 0;
    virtual bool InternalStream() const { return false; }
    virtual bool InternalAlwaysAutoClose() const { return true; }
+   // decompression continues with the next stream if one stream ends
+   virtual bool InternalConcatenated() const { return false; }
 
    virtual ~FileFdPrivate() {}
 };
@@ -1337,6 +1593,10 @@ public:
    {
       return wrapped->InternalAlwaysAutoClose();
    }
+   virtual bool InternalConcatenated() const APT_OVERRIDE
+   {
+      return wrapped->InternalConcatenated();
+   }
    virtual ~BufferedWriteFileFdPrivate()
    {
       delete wrapped;
@@ -1388,6 +1648,8 @@ public:
    }
    virtual bool InternalSeek(unsigned long long const To) APT_OVERRIDE
    {
+      if (FindSeekBlock(To) != nullptr)
+	 return FileFdPrivate::InternalSeek(To);
       off_t const res = gzseek(gz, To, SEEK_SET);
       if (res != (off_t)To)
 	 return filefd->FileFdError("Unable to seek to %llu", To);
@@ -1412,15 +1674,18 @@ public:
       off_t const res = gzseek(gz, Over, SEEK_CUR);
       if (res < 0)
 	 return filefd->FileFdError("Unable to seek ahead %llu",Over);
-      seekpos = res;
+      seekpos = blockbase + res;
       return true;
    }
    virtual unsigned long long InternalTell() APT_OVERRIDE
    {
-      return gztell(gz) - buffer.size();
+      return blockbase + gztell(gz) - buffer.size();
    }
    virtual unsigned long long InternalSize() APT_OVERRIDE
    {
+      // the trailer only knows the size of the last block
+      if (LoadSeekIndex())
+	 return seekindexsize;
       unsigned long long filesize = FileFdPrivate::InternalSize();
       // only check gzsize if we are actually a gzip file, just checking for
       // "gz" is not sufficient as uncompressed files could be opened with
@@ -1464,6 +1729,7 @@ public:
 	 return _error->Errno("close",_("Problem closing the gzip file %s"), FileName.c_str());
       return true;
    }
+   virtual bool InternalConcatenated() const APT_OVERRIDE { return true; }
 
    explicit GzipFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), gz(nullptr) {}
    virtual ~GzipFileFdPrivate() { InternalClose(""); }
@@ -1571,10 +1837,32 @@ public:
    }
    virtual ssize_t InternalUnbufferedRead(void * const To, unsigned long long const Size) APT_OVERRIDE
    {
-      /* Keep reading as long as the compressor still wants to read */
-      while (next_to_load) {
+      /* Keep reading as long as the compressor still wants to read
+	 or as long as there are more frames following the last one */
+      while (true) {
+	 if (next_to_load == 0 && lz4_buffer.size() < 4) {
+	    /* The last frame ended; look if it is followed by another
+	       one rather than by trailing garbage we ignore as always */
+	    char magic[4];
+	    ssize_t const left = lz4_buffer.read(magic, sizeof(magic));
+	    unsigned long long read;
+	    lz4_buffer.reset(APT_BUFFER_SIZE);
+	    if (lz4_buffer.write(magic, left) != left ||
+		  backend.Read(lz4_buffer.getend(), lz4_buffer.free(), &read) == false)
+	       return -1;
+	    lz4_buffer.bufferend += read;
+	 }
+	 if (next_to_load == 0) {
+	    if (lz4_buffer.size() < 4)
+	       return 0;
+	    uint32_t magic;
+	    memcpy(&magic, lz4_buffer.get(), sizeof(magic));
+	    magic = le32toh(magic);
+	    if (magic != 0x184D2204 && (magic & 0xFFFFFFF0) != 0x184D2A50)
+	       return 0;
+	 }
 	 // Fill compressed buffer;
-	 if (lz4_buffer.empty()) {
+	 else if (lz4_buffer.empty()) {
 	    unsigned long long read;
 	    /* Reset - if LZ4 decompressor wants to read more, allocate more */
 	    lz4_buffer.reset(next_to_load);
@@ -1604,8 +1892,6 @@ public:
 	 if (out != 0)
 	    return out;
       }
-
-      return 0;
    }
    virtual bool InternalReadError() APT_OVERRIDE
    {
@@ -1675,12 +1961,187 @@ public:
 
       return LZ4F_isError(res) == false;
    }
+   virtual bool InternalConcatenated() const APT_OVERRIDE { return true; }
 
    explicit Lz4FileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), dctx(nullptr), cctx(nullptr) {}
    virtual ~Lz4FileFdPrivate() {
       InternalClose("");
    }
 #endif
+};
+									/*}}}*/
+class APT_HIDDEN ZstdFileFdPrivate: public FileFdPrivate {				/*{{{*/
+#ifdef HAVE_ZSTD
+   ZSTD_DStream *dctx;
+   ZSTD_CStream *cctx;
+   size_t res;
+   FileFd backend;
+   simple_buffer zstd_buffer;
+   // the last frame was completely decompressed
+   bool frame_done;
+
+   static int findLevel(std::vector<std::string> const &Args)
+   {
+      for (auto a = Args.rbegin(); a != Args.rend(); ++a)
+	 if (a->size() > 1 && (*a)[0] == '-' && (*a)[1] != '-' &&
+	       a->find_first_not_of("0123456789", 1) == std::string::npos)
+	    return std::min(atoi(a->c_str() + 1), ZSTD_maxCLevel());
+      return 3; // the default of zstd itself
+   }
+public:
+   virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
+   {
+      if ((Mode & FileFd::ReadWrite) == FileFd::ReadWrite)
+	 return _error->Error("zstd only supports write or read mode");
+
+      if ((Mode & FileFd::WriteOnly) == FileFd::WriteOnly) {
+	 cctx = ZSTD_createCStream();
+	 res = ZSTD_initCStream(cctx, findLevel(compressor.CompressArgs));
+	 zstd_buffer.reset(ZSTD_CStreamOutSize());
+      } else {
+	 dctx = ZSTD_createDStream();
+	 res = ZSTD_initDStream(dctx);
+	 zstd_buffer.reset(ZSTD_DStreamInSize());
+      }
+
+      filefd->Flags |= FileFd::Compressed;
+
+      if (ZSTD_isError(res))
+	 return false;
+
+      unsigned int flags = (Mode & (FileFd::WriteOnly|FileFd::ReadOnly));
+      if (backend.OpenDescriptor(iFd, flags, FileFd::None, true) == false)
+	 return false;
+
+      return true;
+   }
+   virtual ssize_t InternalUnbufferedRead(void * const To, unsigned long long const Size) APT_OVERRIDE
+   {
+      while (true)
+      {
+	 // Fill compressed buffer
+	 if (zstd_buffer.empty()) {
+	    unsigned long long read;
+	    zstd_buffer.reset(zstd_buffer.buffersize_max);
+	    if (backend.Read(zstd_buffer.getend(), zstd_buffer.free(), &read) == false)
+	       return -1;
+	    zstd_buffer.bufferend += read;
+
+	    if (read == 0) {
+	       // a file can consist of multiple frames, but not of half a one
+	       if (frame_done)
+		  return 0;
+	       res = -1;
+	       return filefd->FileFdError("ZSTD: %s %s",
+					  filefd->FileName.c_str(),
+					  _("Unexpected end of file")), -1;
+	    }
+	 }
+	 // Drain compressed buffer as far as possible.
+	 ZSTD_inBuffer in;
+	 in.src = zstd_buffer.get();
+	 in.size = zstd_buffer.size();
+	 in.pos = 0;
+	 ZSTD_outBuffer out;
+	 out.dst = To;
+	 out.size = Size;
+	 out.pos = 0;
+
+	 res = ZSTD_decompressStream(dctx, &out, &in);
+	 if (ZSTD_isError(res))
+	    return -1;
+	 frame_done = (res == 0);
+	 zstd_buffer.bufferstart += in.pos;
+
+	 if (out.pos != 0)
+	    return out.pos;
+      }
+   }
+   virtual bool InternalReadError() APT_OVERRIDE
+   {
+      char const * const errmsg = ZSTD_getErrorName(res);
+
+      return filefd->FileFdError("ZSTD: %s %s (%zu: %s)", filefd->FileName.c_str(), _("Read error"), res, errmsg);
+   }
+   virtual ssize_t InternalWrite(void const * const From, unsigned long long const Size) APT_OVERRIDE
+   {
+      ZSTD_inBuffer in;
+      in.src = From;
+      in.size = std::min(APT_BUFFER_SIZE, Size);
+      in.pos = 0;
+      ZSTD_outBuffer out;
+      out.dst = zstd_buffer.buffer;
+      out.size = zstd_buffer.buffersize_max;
+      out.pos = 0;
+
+      res = ZSTD_compressStream(cctx, &out, &in);
+      if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
+	 return -1;
+
+      return in.pos;
+   }
+   virtual bool InternalWriteError() APT_OVERRIDE
+   {
+      char const * const errmsg = ZSTD_getErrorName(res);
+
+      return filefd->FileFdError("ZSTD: %s %s (%zu: %s)", filefd->FileName.c_str(), _("Write error"), res, errmsg);
+   }
+   virtual bool InternalStream() const APT_OVERRIDE { return true; }
+
+   virtual bool InternalFlush() APT_OVERRIDE
+   {
+      return backend.Flush();
+   }
+
+   virtual bool InternalClose(std::string const &) APT_OVERRIDE
+   {
+      /* Reset variables */
+      res = 0;
+      frame_done = true;
+
+      if (cctx != nullptr)
+      {
+	 if (filefd->Failed() == false)
+	 {
+	    do {
+	       ZSTD_outBuffer out;
+	       out.dst = zstd_buffer.buffer;
+	       out.size = zstd_buffer.buffersize_max;
+	       out.pos = 0;
+	       res = ZSTD_endStream(cctx, &out);
+	       if (ZSTD_isError(res) || backend.Write(zstd_buffer.buffer, out.pos) == false)
+		  return false;
+	    } while (res > 0);
+	    if (!backend.Flush())
+	       return false;
+	 }
+	 if (!backend.Close())
+	    return false;
+
+	 res = ZSTD_freeCStream(cctx);
+	 cctx = nullptr;
+      }
+
+      if (dctx != nullptr)
+      {
+	 res = ZSTD_freeDStream(dctx);
+	 dctx = nullptr;
+      }
+      if (backend.IsOpen())
+      {
+	 backend.Close();
+	 filefd->iFd = -1;
+      }
+
+      return ZSTD_isError(res) == false;
+   }
+   virtual bool InternalConcatenated() const APT_OVERRIDE { return true; }
+
+   explicit ZstdFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), dctx(nullptr), cctx(nullptr), res(0), frame_done(true) {}
+   virtual ~ZstdFileFdPrivate() {
+      InternalClose("");
+   }
+#endif
 };
 									/*}}}*/
 class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {				/*{{{*/
@@ -1688,7 +2149,7 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {				/*{{{*/
    struct LZMAFILE {
       FILE* file;
       FileFd * const filefd;
-      uint8_t buffer[4096];
+      uint8_t buffer[APT_BUFFER_SIZE];
       lzma_stream stream;
       lzma_ret err;
       bool eof;
@@ -1751,6 +2212,16 @@ class APT_HIDDEN LzmaFileFdPrivate: public FileFdPrivate {				/*{{{*/
 	 }
       return 6;
    }
+#if defined(HAVE_LZMA_ENCODER_MT) || defined(HAVE_LZMA_DECODER_MT)
+   // 1 (the default) uses the single-threaded coders, 0 a thread per CPU
+   static uint32_t findXZthreads()
+   {
+      int const threads = _config->FindI("APT::Compressor::xz::Threads", 1);
+      if (threads == 0)
+	 return std::max(1u, lzma_cputhreads());
+      return std::max(1, threads);
+   }
+#endif
 public:
    virtual bool InternalOpen(int const iFd, unsigned int const Mode) APT_OVERRIDE
    {
@@ -1775,6 +2246,21 @@ public:
 	 uint32_t const xzlevel = findXZlevel(compressor.CompressArgs);
 	 if (compressor.Name == "xz")
 	 {
+#ifdef HAVE_LZMA_ENCODER_MT
+	    uint32_t const threads = findXZthreads();
+	    if (threads > 1)
+	    {
+	       // compresses blocks of three times the dictionary size in parallel
+	       lzma_mt mt;
+	       memset(&mt, 0, sizeof(mt));
+	       mt.threads = threads;
+	       mt.preset = xzlevel;
+	       mt.check = LZMA_CHECK_CRC64;
+	       if (lzma_stream_encoder_mt(&lzma->stream, &mt) != LZMA_OK)
+		  return false;
+	    }
+	    else
+#endif
 	    if (lzma_easy_encoder(&lzma->stream, xzlevel, LZMA_CHECK_CRC64) != LZMA_OK)
 	       return false;
 	 }
@@ -1792,7 +2278,24 @@ public:
 	 uint64_t const memlimit = UINT64_MAX;
 	 if (compressor.Name == "xz")
 	 {
-	    if (lzma_auto_decoder(&lzma->stream, memlimit, 0) != LZMA_OK)
+#ifdef HAVE_LZMA_DECODER_MT
+	    uint32_t const threads = findXZthreads();
+	    if (threads > 1)
+	    {
+	       /* only files with multiple blocks (like the ones written by
+		  the threaded encoder) are decompressed in parallel */
+	       lzma_mt mt;
+	       memset(&mt, 0, sizeof(mt));
+	       mt.flags = LZMA_CONCATENATED;
+	       mt.threads = threads;
+	       mt.memlimit_threading = std::max<uint64_t>(lzma_physmem() / 4, 64 * 1024 * 1024);
+	       mt.memlimit_stop = memlimit;
+	       if (lzma_stream_decoder_mt(&lzma->stream, &mt) != LZMA_OK)
+		  return false;
+	    }
+	    else
+#endif
+	    if (lzma_auto_decoder(&lzma->stream, memlimit, LZMA_CONCATENATED) != LZMA_OK)
 	       return false;
 	 }
 	 else
@@ -1817,7 +2320,8 @@ public:
 	 lzma->stream.next_in = lzma->buffer;
 	 lzma->stream.avail_in = fread(lzma->buffer, 1, sizeof(lzma->buffer)/sizeof(lzma->buffer[0]), lzma->file);
       }
-      lzma->err = lzma_code(&lzma->stream, LZMA_RUN);
+      // with concatenated streams the end is only reported if we say there is no more input
+      lzma->err = lzma_code(&lzma->stream, feof(lzma->file) ? LZMA_FINISH : LZMA_RUN);
       if (lzma->err == LZMA_STREAM_END)
       {
 	 lzma->eof = true;
@@ -1884,6 +2388,7 @@ public:
       lzma = nullptr;
       return true;
    }
+   virtual bool InternalConcatenated() const APT_OVERRIDE { return compressor.Name == "xz"; }
 
    explicit LzmaFileFdPrivate(FileFd * const filefd) : FileFdPrivate(filefd), lzma(nullptr) {}
    virtual ~LzmaFileFdPrivate() { InternalClose(""); }
@@ -2179,6 +2684,7 @@ bool FileFd::Open(string FileName,unsigned int const Mode,CompressMode Compress,
       case Lzma: name = "lzma"; break;
       case Xz: name = "xz"; break;
       case Lz4: name = "lz4"; break;
+      case Zstd: name = "zstd"; break;
       case Auto:
       case Extension:
 	 // Unreachable
@@ -2296,6 +2802,7 @@ bool FileFd::OpenDescriptor(int Fd, unsigned int const Mode, CompressMode Compre
    case Lzma: name = "lzma"; break;
    case Xz: name = "xz"; break;
    case Lz4: name = "lz4"; break;
+   case Zstd: name = "zstd"; break;
    case Auto:
    case Extension:
       if (AutoClose == true && Fd != -1)
@@ -2360,6 +2867,9 @@ bool FileFd::OpenInternDescriptor(unsigned int const Mode, APT::Configuration::C
 #ifdef HAVE_LZ4
       APT_COMPRESS_INIT("lz4", Lz4FileFdPrivate);
 #endif
+#ifdef HAVE_ZSTD
+      APT_COMPRESS_INIT("zstd", ZstdFileFdPrivate);
+#endif
 #undef APT_COMPRESS_INIT
       else if (compressor.Name == "." || compressor.Binary.empty() == true)
 	 d = new DirectFileFdPrivate(this);
@@ -2371,6 +2881,15 @@ bool FileFd::OpenInternDescriptor(unsigned int const Mode, APT::Configuration::C
 
       d->set_openmode(Mode);
       d->set_compressor(compressor);
+      if ((Mode & BlockCompress) == BlockCompress && (Mode & ReadWrite) == WriteOnly &&
+	    FileName.empty() == false && d->InternalConcatenated())
+      {
+	 off_t const offset = lseek(iFd, 0, SEEK_CUR);
+	 if (offset < 0)
+	    return FileFdErrno("lseek", "Unable to start a new block in %s", FileName.c_str());
+	 d->seekblocksize = std::max(1, _config->FindI("APT::FileFd::Block-Size", 1024)) * 1024ull;
+	 d->seekblocks.push_back(SeekBlock{0, static_cast<unsigned long long>(offset)});
+      }
       if ((Flags & AutoClose) != AutoClose && d->InternalAlwaysAutoClose())
       {
 	 // Need to duplicate fd here or gz/bz2 close for cleanup will close the fd as well
@@ -2509,7 +3028,19 @@ bool FileFd::Write(const void *From,unsigned long long Size)
    errno = 0;
    while (Res > 0 && Size > 0)
    {
-      Res = d->InternalWrite(From, Size);
+      unsigned long long towrite = Size;
+      if (d->seekblocksize != 0)
+      {
+	 unsigned long long const blockend = d->seekblocks.back().uncompressed + d->seekblocksize;
+	 if (d->blockwritten == blockend)
+	 {
+	    if (d->FinishBlock() == false)
+	       return false;
+	    continue;
+	 }
+	 towrite = std::min(Size, blockend - d->blockwritten);
+      }
+      Res = d->InternalWrite(From, towrite);
 
       if (Res < 0)
       {
@@ -2525,6 +3056,7 @@ bool FileFd::Write(const void *From,unsigned long long Size)
 
       From = (char const *)From + Res;
       Size -= Res;
+      d->blockwritten += Res;
       if (d != NULL)
 	 d->set_seekpos(d->get_seekpos() + Res);
    }
@@ -2676,6 +3208,9 @@ bool FileFd::Close()
    if (d != NULL)
    {
       Res &= d->InternalClose(FileName);
+      if (Res == true && Failed() == false && d->seekblocksize != 0)
+	 Res &= WriteSeekIndex((Flags & Replace) == Replace ? TemporaryFileName : FileName,
+	       SeekIndexFileName(FileName), d->seekblocks, d->blockwritten);
       delete d;
       d = NULL;
    }
@@ -46,6 +46,7 @@ class FileFd
    friend class Bz2FileFdPrivate;
    friend class LzmaFileFdPrivate;
    friend class Lz4FileFdPrivate;
+   friend class ZstdFileFdPrivate;
    friend class DirectFileFdPrivate;
    friend class PipedFileFdPrivate;
    protected:
@@ -68,6 +69,8 @@ class FileFd
 	Atomic = Exclusive | (1 << 4),
 	Empty = (1 << 5),
 	BufferedWrite = (1 << 6),
+	// compress in independent blocks and write a seek index (see SeekIndexFileName)
+	BlockCompress = (1 << 7),
 
 	WriteEmpty = ReadWrite | Create | Empty,
 	WriteExists = ReadWrite,
@@ -76,7 +79,7 @@ class FileFd
 	ReadOnlyGzip,
 	WriteAtomic = ReadWrite | Create | Atomic
    };
-   enum CompressMode { Auto = 'A', None = 'N', Extension = 'E', Gzip = 'G', Bzip2 = 'B', Lzma = 'L', Xz = 'X', Lz4='4' };
+   enum CompressMode { Auto = 'A', None = 'N', Extension = 'E', Gzip = 'G', Bzip2 = 'B', Lzma = 'L', Xz = 'X', Lz4='4', Zstd='Z' };
    
    inline bool Read(void *To,unsigned long long Size,bool AllowEof)
    {
@@ -237,6 +240,10 @@ std::string flCombine(std::string Dir,std::string File);
 std::string flAbsPath(std::string File);
 /** \brief removes superfluous /./ and // from path */
 APT_HIDDEN std::string flNormalize(std::string file);
+/** \brief name of the file storing the block offsets of a file written
+ * with FileFd::BlockCompress, which allows seeking in it without
+ * decompressing everything before the requested offset */
+APT_HIDDEN std::string SeekIndexFileName(std::string const &File);
 
 // simple c++ glob
 std::vector<std::string> Glob(std::string const &pattern, int flags=0);
@@ -24,7 +24,12 @@
 #include <algorithm>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <memory>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 #include <iostream>
 									/*}}}*/
 
@@ -288,14 +293,143 @@ bool HashStringList::operator!=(HashStringList const &other) const
 }
 									/*}}}*/
 
+// HashHelpers - threads hashing a buffer with further digests		/*{{{*/
+/* If more than one digest is calculated, large buffers are hashed by all
+   of them at the same time: the calling thread hashes with the first
+   digest while helper threads work on the same buffer with the others.
+   Add() returns once all of them are done with the buffer, so a buffer
+   costs as much as the slowest digest instead of the sum.
+
+   The helpers are shared by all Hashes objects of the process and only
+   started once a buffer large enough to be worth it is hashed, so hashing
+   many files or small ones doesn't pay for starting threads each time. */
+namespace {
+class HashHelpers
+{
+   struct Batch
+   {
+      size_t Pending;
+      bool Result;
+   };
+   struct Job
+   {
+      SummationImplementation * Sum;
+      unsigned char const * Data;
+      unsigned long long Size;
+      Batch * Owner;
+   };
+
+   pthread_mutex_t Lock;
+   pthread_cond_t Wakeup;
+   pthread_cond_t Finished;
+   std::vector<Job> Jobs;
+   std::vector<std::thread> Threads;
+
+   void Helper()
+   {
+      pthread_mutex_lock(&Lock);
+      while (true)
+      {
+	 while (Jobs.empty())
+	    pthread_cond_wait(&Wakeup, &Lock);
+	 Job const J = Jobs.back();
+	 Jobs.pop_back();
+	 pthread_mutex_unlock(&Lock);
+	 bool const Res = J.Sum->Add(J.Data, J.Size);
+	 pthread_mutex_lock(&Lock);
+	 if (Res == false)
+	    J.Owner->Result = false;
+	 if (--J.Owner->Pending == 0)
+	    pthread_cond_broadcast(&Finished);
+      }
+   }
+
+   static HashHelpers * Instance;
+   static pthread_mutex_t InstanceLock;
+   /* A forked child has none of the threads of its parent and the state
+      of their lock is undefined, so the child forgets about the helpers
+      without touching them and starts its own if needed. */
+   static void ForgetInChild()
+   {
+      Instance = nullptr;
+      pthread_mutex_init(&InstanceLock, nullptr);
+   }
+
+   HashHelpers()
+   {
+      pthread_mutex_init(&Lock, nullptr);
+      pthread_cond_init(&Wakeup, nullptr);
+      pthread_cond_init(&Finished, nullptr);
+   }
+
+public:
+   /* never destructed as the threads live as long as the process, so the
+      process can exit without waiting for them */
+   static HashHelpers * Get()
+   {
+      static pthread_once_t Registered = PTHREAD_ONCE_INIT;
+      pthread_once(&Registered, [] { pthread_atfork(nullptr, nullptr, &HashHelpers::ForgetInChild); });
+      pthread_mutex_lock(&InstanceLock);
+      if (Instance == nullptr)
+	 Instance = new HashHelpers();
+      HashHelpers * const H = Instance;
+      pthread_mutex_unlock(&InstanceLock);
+      return H;
+   }
+
+   /* hashes the buffer with the first digest in this thread and with all
+      others in the helpers, returns false if no helper could be started */
+   bool Add(std::vector<SummationImplementation *> const &Sums,
+	 unsigned char const * const Buffer, unsigned long long const Length, bool &Res)
+   {
+      Batch B{Sums.size() - 1, true};
+      pthread_mutex_lock(&Lock);
+      try
+      {
+	 while (Threads.size() < B.Pending)
+	    Threads.emplace_back(&HashHelpers::Helper, this);
+      }
+      catch (std::system_error const &)
+      {
+	 // we can live with fewer helpers, but not without
+	 if (Threads.empty())
+	 {
+	    pthread_mutex_unlock(&Lock);
+	    return false;
+	 }
+      }
+      for (auto S = Sums.begin() + 1; S != Sums.end(); ++S)
+	 Jobs.push_back({*S, Buffer, Length, &B});
+      pthread_cond_broadcast(&Wakeup);
+      pthread_mutex_unlock(&Lock);
+
+      Res = Sums.front()->Add(Buffer, Length);
+
+      pthread_mutex_lock(&Lock);
+      while (B.Pending != 0)
+	 pthread_cond_wait(&Finished, &Lock);
+      Res &= B.Result;
+      pthread_mutex_unlock(&Lock);
+      return true;
+   }
+};
+HashHelpers * HashHelpers::Instance = nullptr;
+pthread_mutex_t HashHelpers::InstanceLock = PTHREAD_MUTEX_INITIALIZER;
+}
+									/*}}}*/
 // PrivateHashes							/*{{{*/
 class PrivateHashes {
 public:
    unsigned long long FileSize;
    unsigned int CalcHashes;
+   // -1 = not yet decided, see Parallel()
+   int UseParallel;
+
+   // smaller buffers are cheaper to hash than to hand over to the helpers
+   static constexpr unsigned long long ParallelMinimum = 64 * 1024;
 
-   explicit PrivateHashes(unsigned int const CalcHashes) : FileSize(0), CalcHashes(CalcHashes) {}
-   explicit PrivateHashes(HashStringList const &Hashes) : FileSize(0) {
+   explicit PrivateHashes(unsigned int const CalcHashes) : FileSize(0), CalcHashes(CalcHashes), UseParallel(-1) {}
+   explicit PrivateHashes(HashStringList const &Hashes) : PrivateHashes(0u) {
       unsigned int calcHashes = Hashes.usable() ? 0 : ~0;
       if (Hashes.find("MD5Sum") != NULL)
 	 calcHashes |= Hashes::MD5SUM;
@@ -307,6 +441,37 @@ public:
 	 calcHashes |= Hashes::SHA512SUM;
       CalcHashes = calcHashes;
    }
+
+   bool Parallel()
+   {
+      if (UseParallel == -1)
+	 UseParallel = _config->FindB("APT::Hashes::Parallel", false);
+      return UseParallel == 1;
+   }
+
+   // returns false if parallel hashing isn't used for this buffer
+   bool AddParallel(std::vector<SummationImplementation *> const &Sums,
+	 unsigned char const * const Buffer, unsigned long long const Length, bool &Res)
+   {
+      if (Sums.size() < 2 || Length < ParallelMinimum || Parallel() == false)
+	 return false;
+      if (HashHelpers::Get()->Add(Sums, Buffer, Length, Res) == false)
+      {
+	 // no threads for us, hash the old-fashioned way
+	 UseParallel = 0;
+	 return false;
+      }
+      return true;
+   }
+
+   // size of the buffer used to read files in
+   unsigned long long ReadBufferSize()
+   {
+      unsigned int const Multiple = CalcHashes & (Hashes::MD5SUM | Hashes::SHA1SUM | Hashes::SHA256SUM | Hashes::SHA512SUM);
+      if ((Multiple & (Multiple - 1)) != 0 && Parallel())
+	 return 1024 * 1024;
+      return 64 * 64;
+   }
 };
 									/*}}}*/
 // Hashes::Add* - Add the contents of data or FD			/*{{{*/
@@ -314,17 +479,23 @@ bool Hashes::Add(const unsigned char * const Data, unsigned long long const Size
 {
    if (Size == 0)
       return true;
-   bool Res = true;
+   std::vector<SummationImplementation *> Sums;
+   Sums.reserve(4);
 APT_IGNORE_DEPRECATED_PUSH
-   if ((d->CalcHashes & MD5SUM) == MD5SUM)
-      Res &= MD5.Add(Data, Size);
-   if ((d->CalcHashes & SHA1SUM) == SHA1SUM)
-      Res &= SHA1.Add(Data, Size);
-   if ((d->CalcHashes & SHA256SUM) == SHA256SUM)
-      Res &= SHA256.Add(Data, Size);
+   // the slowest first as it runs in the calling thread
    if ((d->CalcHashes & SHA512SUM) == SHA512SUM)
-      Res &= SHA512.Add(Data, Size);
+      Sums.push_back(&SHA512);
+   if ((d->CalcHashes & SHA256SUM) == SHA256SUM)
+      Sums.push_back(&SHA256);
+   if ((d->CalcHashes & SHA1SUM) == SHA1SUM)
+      Sums.push_back(&SHA1);
+   if ((d->CalcHashes & MD5SUM) == MD5SUM)
+      Sums.push_back(&MD5);
 APT_IGNORE_DEPRECATED_POP
+   bool Res = true;
+   if (d->AddParallel(Sums, Data, Size, Res) == false)
+      for (auto const S : Sums)
+	 Res &= S->Add(Data, Size);
    d->FileSize += Size;
    return Res;
 }
@@ -335,19 +506,20 @@ bool Hashes::Add(const unsigned char * const Data, unsigned long long const Size
 }
 bool Hashes::AddFD(int const Fd,unsigned long long Size)
 {
-   unsigned char Buf[64*64];
+   unsigned long long const BufSize = d->ReadBufferSize();
+   std::unique_ptr<unsigned char[]> const Buf(new unsigned char[BufSize]);
    bool const ToEOF = (Size == UntilEOF);
    while (Size != 0 || ToEOF)
    {
-      unsigned long long n = sizeof(Buf);
+      unsigned long long n = BufSize;
       if (!ToEOF) n = std::min(Size, n);
-      ssize_t const Res = read(Fd,Buf,n);
+      ssize_t const Res = read(Fd,Buf.get(),n);
       if (Res < 0 || (!ToEOF && Res != (ssize_t) n)) // error, or short read
 	 return false;
       if (ToEOF && Res == 0) // EOF
 	 break;
       Size -= Res;
-      if (Add(Buf, Res) == false)
+      if (Add(Buf.get(), Res) == false)
 	 return false;
    }
    return true;
@@ -359,14 +531,15 @@ bool Hashes::AddFD(int const Fd,unsigned long long Size, unsigned int const Hash
 }
 bool Hashes::AddFD(FileFd &Fd,unsigned long long Size)
 {
-   unsigned char Buf[64*64];
+   unsigned long long const BufSize = d->ReadBufferSize();
+   std::unique_ptr<unsigned char[]> const Buf(new unsigned char[BufSize]);
    bool const ToEOF = (Size == 0);
    while (Size != 0 || ToEOF)
    {
-      unsigned long long n = sizeof(Buf);
+      unsigned long long n = BufSize;
       if (!ToEOF) n = std::min(Size, n);
       unsigned long long a = 0;
-      if (Fd.Read(Buf, n, &a) == false) // error
+      if (Fd.Read(Buf.get(), n, &a) == false) // error
 	 return false;
       if (ToEOF == false)
       {
@@ -376,7 +549,7 @@ bool Hashes::AddFD(FileFd &Fd,unsigned long long Size)
       else if (a == 0) // EOF
 	 break;
       Size -= a;
-      if (Add(Buf, a) == false)
+      if (Add(Buf.get(), a) == false)
 	 return false;
    }
    return true;
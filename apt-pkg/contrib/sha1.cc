@@ -32,6 +32,7 @@
 #include <config.h>
 
 #include <apt-pkg/sha1.h>
+#include "sha_hwaccel_internal.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -251,6 +252,8 @@ bool SHA1Summation::Add(const unsigned char *data,unsigned long long len)
    uint8_t *buffer = (uint8_t *)Buffer;
    uint32_t i,j;
 
+   static SHABlocksFunction const Accelerated = SHA1AcceleratedBlocks();
+
    j = (count[0] >> 3) & 63;
    if ((count[0] += len << 3) < (len << 3))
       count[1]++;
@@ -258,10 +261,20 @@ bool SHA1Summation::Add(const unsigned char *data,unsigned long long len)
    if ((j + len) > 63)
    {
       memcpy(&buffer[j],data,(i = 64 - j));
-      SHA1Transform(state,buffer);
-      for (; i + 63 < len; i += 64)
+      if (Accelerated != nullptr)
+      {
+	 Accelerated(state, buffer, 1);
+	 size_t const blocks = (len - i) / 64;
+	 Accelerated(state, &data[i], blocks);
+	 i += blocks * 64;
+      }
+      else
       {
-	 SHA1Transform(state,&data[i]);
+	 SHA1Transform(state,buffer);
+	 for (; i + 63 < len; i += 64)
+	 {
+	    SHA1Transform(state,&data[i]);
+	 }
       }
       j = 0;
    }
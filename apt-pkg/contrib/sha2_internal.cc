@@ -37,6 +37,7 @@
 #include <string.h>	/* memcpy()/memset() or bcopy()/bzero() */
 #include <assert.h>	/* assert() */
 #include "sha2_internal.h"
+#include "sha_hwaccel_internal.h"
 
 /*
  * ASSERT NOTE:
@@ -390,7 +391,7 @@ void SHA256_Init(SHA256_CTX* context) {
 	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
 	j++
 
-static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+static void SHA256_Transform_Portable(SHA256_CTX* context, const sha2_word32* data) {
 	sha2_word32	a, b, c, d, e, f, g, h, s0, s1;
 	sha2_word32	T1, *W256;
 	int		j;
@@ -448,7 +449,7 @@ static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #else /* SHA2_UNROLL_TRANSFORM */
 
-static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+static void SHA256_Transform_Portable(SHA256_CTX* context, const sha2_word32* data) {
 	sha2_word32	a, b, c, d, e, f, g, h, s0, s1;
 	sha2_word32	T1, T2, *W256;
 	int		j;
@@ -528,6 +529,14 @@ static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+static void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+	SHABlocksFunction const accelerated = SHA256AcceleratedBlocks();
+	if (accelerated != NULL)
+		accelerated(context->state, (const sha2_byte*)data, 1);
+	else
+		SHA256_Transform_Portable(context, data);
+}
+
 void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
 
@@ -560,6 +569,15 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			return;
 		}
 	}
+	SHABlocksFunction const accelerated = SHA256AcceleratedBlocks();
+	if (accelerated != NULL && len >= SHA256_BLOCK_LENGTH) {
+		/* Process all complete blocks directly from the input */
+		size_t const blocks = len / SHA256_BLOCK_LENGTH;
+		accelerated(context->state, data, blocks);
+		context->bitcount += (sha2_word64)(blocks * SHA256_BLOCK_LENGTH) << 3;
+		len -= blocks * SHA256_BLOCK_LENGTH;
+		data += blocks * SHA256_BLOCK_LENGTH;
+	}
 	while (len >= SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
 		sha2_byte buffer[SHA256_BLOCK_LENGTH];
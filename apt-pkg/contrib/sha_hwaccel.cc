@@ -0,0 +1,269 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Hardware accelerated SHA-1 and SHA-256 block transforms
+
+   The x86 variants use the SHA extensions (SHA-NI) available in recent
+   Intel and AMD CPUs, the ARM variants the ARMv8 cryptography extension.
+   The functions are compiled with the needed instruction set enabled
+   via target attributes and are only used if the CPU running the code
+   reports support for them.
+
+   The message schedules follow the reference code published by Intel
+   and ARM for these instructions.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/configuration.h>
+#include "sha_hwaccel_internal.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define APT_SHA_X86 1
+#elif defined(__aarch64__) && defined(__GNUC__) && !defined(__clang__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define APT_SHA_ARM 1
+#endif
+									/*}}}*/
+
+static bool AccelerationAllowed()					/*{{{*/
+{
+   return _config->FindB("APT::Hashes::Hardware-Acceleration", true);
+}
+									/*}}}*/
+static uint32_t const SHA256K[64] = {					/*{{{*/
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+									/*}}}*/
+#ifdef APT_SHA_X86
+static bool CPUHasSHAExtensions()					/*{{{*/
+{
+   unsigned int eax, ebx, ecx, edx;
+   if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+      return false;
+   // SSSE3 and SSE4.1 are needed for the shuffles and blends
+   if ((ecx & (1 << 9)) == 0 || (ecx & (1 << 19)) == 0)
+      return false;
+   if (__get_cpuid_max(0, nullptr) < 7)
+      return false;
+   __cpuid_count(7, 0, eax, ebx, ecx, edx);
+   return (ebx & (1 << 29)) != 0;
+}
+									/*}}}*/
+// SHA1BlocksSHANI - SHA-1 with the x86 SHA extensions			/*{{{*/
+#define SHA1_ROUNDS(F) \
+   for (; g < (F + 1) * 5; ++g) \
+   { \
+      if (g >= 4) \
+	 W[g % 4] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(W[g % 4], W[(g + 1) % 4]), W[(g + 2) % 4]), W[(g + 3) % 4]); \
+      E = _mm_sha1nexte_epu32(ESave, W[g % 4]); \
+      ESave = ABCD; \
+      ABCD = _mm_sha1rnds4_epu32(ABCD, E, F); \
+   }
+__attribute__((target("sha,sse4.1")))
+static void SHA1BlocksSHANI(uint32_t * const state, uint8_t const * data, size_t blocks)
+{
+   __m128i const MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+   __m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(state)), 0x1B);
+   __m128i E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      __m128i const ABCDSave = ABCD;
+      __m128i W[4];
+      for (unsigned int i = 0; i < 4; ++i)
+	 W[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + 16 * i)), MASK);
+
+      // the first group adds e directly, all later ones derive it
+      // from the a of the previous group with sha1nexte
+      __m128i E = _mm_add_epi32(E0, W[0]);
+      __m128i ESave = ABCD;
+      ABCD = _mm_sha1rnds4_epu32(ABCD, E, 0);
+      unsigned int g = 1;
+      SHA1_ROUNDS(0)
+      SHA1_ROUNDS(1)
+      SHA1_ROUNDS(2)
+      SHA1_ROUNDS(3)
+
+      E0 = _mm_sha1nexte_epu32(ESave, E0);
+      ABCD = _mm_add_epi32(ABCD, ABCDSave);
+   }
+
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(ABCD, 0x1B));
+   state[4] = _mm_extract_epi32(E0, 3);
+}
+#undef SHA1_ROUNDS
+									/*}}}*/
+// SHA256BlocksSHANI - SHA-256 with the x86 SHA extensions		/*{{{*/
+__attribute__((target("sha,sse4.1")))
+static void SHA256BlocksSHANI(uint32_t * const state, uint8_t const * data, size_t blocks)
+{
+   __m128i const MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+   // the instructions work on the state as ABEF and CDGH
+   __m128i TMP = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(&state[0])), 0xB1);
+   __m128i STATE1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(&state[4])), 0x1B);
+   __m128i STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+   STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      __m128i const ABEFSave = STATE0;
+      __m128i const CDGHSave = STATE1;
+      __m128i W[4];
+      for (unsigned int i = 0; i < 4; ++i)
+	 W[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + 16 * i)), MASK);
+
+      for (unsigned int g = 0; g < 16; ++g)
+      {
+	 if (g >= 4)
+	 {
+	    __m128i const T = _mm_add_epi32(_mm_sha256msg1_epu32(W[g % 4], W[(g + 1) % 4]),
+		  _mm_alignr_epi8(W[(g + 3) % 4], W[(g + 2) % 4], 4));
+	    W[g % 4] = _mm_sha256msg2_epu32(T, W[(g + 3) % 4]);
+	 }
+	 __m128i MSG = _mm_add_epi32(W[g % 4], _mm_loadu_si128(reinterpret_cast<__m128i const *>(&SHA256K[4 * g])));
+	 STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+	 MSG = _mm_shuffle_epi32(MSG, 0x0E);
+	 STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+      }
+
+      STATE0 = _mm_add_epi32(STATE0, ABEFSave);
+      STATE1 = _mm_add_epi32(STATE1, CDGHSave);
+   }
+
+   TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+   STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+   STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+   STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), STATE0);
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), STATE1);
+}
+									/*}}}*/
+#endif
+#ifdef APT_SHA_ARM
+// SHA1BlocksARMv8 - SHA-1 with the ARMv8 cryptography extension	/*{{{*/
+__attribute__((target("+crypto")))
+static void SHA1BlocksARMv8(uint32_t * const state, uint8_t const * data, size_t blocks)
+{
+   static uint32_t const K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+   uint32x4_t ABCD = vld1q_u32(&state[0]);
+   uint32_t E0 = state[4];
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      uint32x4_t const ABCDSave = ABCD;
+      uint32_t E = E0;
+      uint32x4_t W[4];
+      for (unsigned int i = 0; i < 4; ++i)
+	 W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+      for (unsigned int g = 0; g < 20; ++g)
+      {
+	 if (g >= 4)
+	    W[g % 4] = vsha1su1q_u32(vsha1su0q_u32(W[g % 4], W[(g + 1) % 4], W[(g + 2) % 4]), W[(g + 3) % 4]);
+	 uint32x4_t const WK = vaddq_u32(W[g % 4], vdupq_n_u32(K[g / 5]));
+	 uint32_t const ENext = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+	 if (g < 5)
+	    ABCD = vsha1cq_u32(ABCD, E, WK);
+	 else if (g >= 10 && g < 15)
+	    ABCD = vsha1mq_u32(ABCD, E, WK);
+	 else
+	    ABCD = vsha1pq_u32(ABCD, E, WK);
+	 E = ENext;
+      }
+
+      E0 += E;
+      ABCD = vaddq_u32(ABCD, ABCDSave);
+   }
+
+   vst1q_u32(&state[0], ABCD);
+   state[4] = E0;
+}
+									/*}}}*/
+// SHA256BlocksARMv8 - SHA-256 with the ARMv8 cryptography extension	/*{{{*/
+__attribute__((target("+crypto")))
+static void SHA256BlocksARMv8(uint32_t * const state, uint8_t const * data, size_t blocks)
+{
+   uint32x4_t STATE0 = vld1q_u32(&state[0]);
+   uint32x4_t STATE1 = vld1q_u32(&state[4]);
+
+   for (; blocks != 0; --blocks, data += 64)
+   {
+      uint32x4_t const ABCDSave = STATE0;
+      uint32x4_t const EFGHSave = STATE1;
+      uint32x4_t W[4];
+      for (unsigned int i = 0; i < 4; ++i)
+	 W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+      for (unsigned int g = 0; g < 16; ++g)
+      {
+	 if (g >= 4)
+	    W[g % 4] = vsha256su1q_u32(vsha256su0q_u32(W[g % 4], W[(g + 1) % 4]), W[(g + 2) % 4], W[(g + 3) % 4]);
+	 uint32x4_t const WK = vaddq_u32(W[g % 4], vld1q_u32(&SHA256K[4 * g]));
+	 uint32x4_t const ABCD = STATE0;
+	 STATE0 = vsha256hq_u32(STATE0, STATE1, WK);
+	 STATE1 = vsha256h2q_u32(STATE1, ABCD, WK);
+      }
+
+      STATE0 = vaddq_u32(STATE0, ABCDSave);
+      STATE1 = vaddq_u32(STATE1, EFGHSave);
+   }
+
+   vst1q_u32(&state[0], STATE0);
+   vst1q_u32(&state[4], STATE1);
+}
+									/*}}}*/
+#endif
+
+SHABlocksFunction SHA1AcceleratedBlocks()				/*{{{*/
+{
+   static SHABlocksFunction const Func = []() -> SHABlocksFunction {
+      if (AccelerationAllowed() == false)
+	 return nullptr;
+#if defined(APT_SHA_X86)
+      if (CPUHasSHAExtensions())
+	 return SHA1BlocksSHANI;
+#elif defined(APT_SHA_ARM)
+      if ((getauxval(AT_HWCAP) & HWCAP_SHA1) != 0)
+	 return SHA1BlocksARMv8;
+#endif
+      return nullptr;
+   }();
+   return Func;
+}
+									/*}}}*/
+SHABlocksFunction SHA256AcceleratedBlocks()				/*{{{*/
+{
+   static SHABlocksFunction const Func = []() -> SHABlocksFunction {
+      if (AccelerationAllowed() == false)
+	 return nullptr;
+#if defined(APT_SHA_X86)
+      if (CPUHasSHAExtensions())
+	 return SHA256BlocksSHANI;
+#elif defined(APT_SHA_ARM)
+      if ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0)
+	 return SHA256BlocksARMv8;
+#endif
+      return nullptr;
+   }();
+   return Func;
+}
+									/*}}}*/
@@ -0,0 +1,35 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Hardware accelerated SHA-1 and SHA-256 block transforms
+
+   The portable implementations in sha1.cc and sha2_internal.cc use
+   these instead of their own transform if the CPU supports the x86 SHA
+   extensions or the ARMv8 cryptography extension.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef APTPKG_SHA_HWACCEL_INTERNAL_H
+#define APTPKG_SHA_HWACCEL_INTERNAL_H
+
+#include <apt-pkg/macros.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \brief hashes \b blocks complete 64 byte blocks of \b data into \b state */
+typedef void (*SHABlocksFunction)(uint32_t * const state, uint8_t const * data, size_t blocks);
+
+/** \brief accelerated SHA-1 transform for this CPU
+ *
+ *  The decision is made once at the first call and can be disabled with
+ *  APT::Hashes::Hardware-Acceleration.
+ *
+ *  \return the transform or \b nullptr if the portable one has to be used
+ */
+APT_HIDDEN SHABlocksFunction SHA1AcceleratedBlocks();
+/** \brief accelerated SHA-256 transform for this CPU, see SHA1AcceleratedBlocks */
+APT_HIDDEN SHABlocksFunction SHA256AcceleratedBlocks();
+
+#endif
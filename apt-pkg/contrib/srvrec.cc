@@ -16,6 +16,7 @@
 #include <time.h>
 
 #include <algorithm>
+#include <limits>
 #include <tuple>
 
 #include <apt-pkg/configuration.h>
@@ -32,8 +33,15 @@ bool SrvRec::operator==(SrvRec const &other) const
            std::tie(other.target, other.priority, other.weight, other.port));
 }
 
+static bool GetSrvRecords(std::string const &name, std::vector<SrvRec> &Result, unsigned long &TTL);
 bool GetSrvRecords(std::string host, int port, std::vector<SrvRec> &Result)
 {
+   unsigned long TTL;
+   return GetSrvRecords(host, port, Result, TTL);
+}
+bool GetSrvRecords(std::string host, int port, std::vector<SrvRec> &Result, unsigned long &TTL)
+{
+   TTL = 0;
    std::string target;
    int res;
    struct servent s_ent_buf;
@@ -45,11 +53,17 @@ bool GetSrvRecords(std::string host, int port, std::vector<SrvRec> &Result)
       return false;
 
    strprintf(target, "_%s._tcp.%s", s_ent->s_name, host.c_str());
-   return GetSrvRecords(target, Result);
+   return GetSrvRecords(target, Result, TTL);
 }
 
 bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result)
 {
+   unsigned long TTL;
+   return GetSrvRecords(name, Result, TTL);
+}
+static bool GetSrvRecords(std::string const &name, std::vector<SrvRec> &Result, unsigned long &TTL)
+{
+   TTL = 0;
    unsigned char answer[PACKETSZ];
    int answer_len, compressed_name_len;
    int answer_count;
@@ -59,7 +73,12 @@ bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result)
 
    answer_len = res_query(name.c_str(), C_IN, T_SRV, answer, sizeof(answer));
    if (answer_len == -1)
+   {
+      // the name or the record doesn't exist, which is the usual answer
+      if (h_errno == HOST_NOT_FOUND || h_errno == NO_DATA)
+	 TTL = std::numeric_limits<unsigned long>::max();
       return false;
+   }
    if (answer_len < (int)sizeof(HEADER))
       return _error->Warning("Not enough data from res_query (%i)", answer_len);
 
@@ -78,9 +97,11 @@ bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result)
 
    // pt points to the first answer record, go over all of them now
    unsigned char *pt = answer+sizeof(HEADER)+compressed_name_len+QFIXEDSZ;
+   unsigned long min_ttl = std::numeric_limits<unsigned long>::max();
    while ((int)Result.size() < answer_count && pt < answer+answer_len)
    {
       u_int16_t type, klass, priority, weight, port, dlen;
+      u_int32_t ttl;
       char buf[MAXDNAME];
 
       compressed_name_len = dn_skipname(pt, answer+answer_len);
@@ -102,7 +123,11 @@ bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result)
       if(klass != C_IN)
          return _error->Warning("Unexpected class excepted %x != %x",
                                 C_IN, klass);
-      pt += 4;  // ttl
+      ttl = static_cast<u_int32_t>(*pt++) << 24;
+      ttl |= static_cast<u_int32_t>(*pt++) << 16;
+      ttl |= static_cast<u_int32_t>(*pt++) << 8;
+      ttl |= *pt++;
+      min_ttl = std::min<unsigned long>(min_ttl, ttl);
       extract_u16(dlen, pt);
       extract_u16(priority, pt);
       extract_u16(weight, pt);
@@ -118,6 +143,8 @@ bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result)
       // add it to our class
       Result.emplace_back(buf, priority, weight, port);
    }
+   if (Result.empty() == false)
+      TTL = min_ttl;
 
    // implement load balancing as specified in RFC-2782
 
@@ -46,6 +46,14 @@ bool GetSrvRecords(std::string name, std::vector<SrvRec> &Result);
  */
 bool GetSrvRecords(std::string host, int port, std::vector<SrvRec> &Result);
 
+/** \brief Get SRV records from host/port and how long the answer is valid
+ *
+ *  \param[out] TTL is set to the lowest time to live in seconds of the
+ *  returned records, to ULONG_MAX if the DNS said there are no such
+ *  records and to 0 if the query failed otherwise, e.g. temporarily.
+ */
+bool GetSrvRecords(std::string host, int port, std::vector<SrvRec> &Result, unsigned long &TTL);
+
 /** \brief Pop a single SRV record from the vector of SrvRec taking
  *         priority and weight into account
  */
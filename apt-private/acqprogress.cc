@@ -173,7 +173,16 @@ void AcqTextStatus::Stop()
    if (_config->FindB("quiet::NoStatistic", false) == true)
       return;
 
-   if (FetchedBytes != 0 && _error->PendingError() == false)
+   if (FetchedBytes == 0 || _error->PendingError() == true)
+      return;
+   // the first estimation shows how well the time was predicted
+   if (EstimatedTime(true) != 0)
+      ioprintf(out,_("Fetched %sB in %s (%sB/s, estimated %s)\n"),
+	       SizeToStr(FetchedBytes).c_str(),
+	       TimeToStr(ElapsedTime).c_str(),
+	       SizeToStr(CurrentCPS).c_str(),
+	       TimeToStr(EstimatedTime(true)).c_str());
+   else
       ioprintf(out,_("Fetched %sB in %s (%sB/s)\n"),
 	       SizeToStr(FetchedBytes).c_str(),
 	       TimeToStr(ElapsedTime).c_str(),
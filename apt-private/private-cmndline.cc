@@ -158,6 +158,9 @@ static bool addArgumentsAPTFTPArchive(std::vector<CommandLine::Args> &Args, char
    addArg(0,"readonly","APT::FTPArchive::ReadOnlyDB",0);
    addArg(0,"contents","APT::FTPArchive::Contents",0);
    addArg('a',"arch","APT::FTPArchive::Architecture",CommandLine::HasArg);
+   addArg('j',"jobs","APT::FTPArchive::Jobs",CommandLine::HasArg);
+   addArg(0,"previous","APT::FTPArchive::Packages::Previous",CommandLine::HasArg);
+   addArg(0,"change-list","APT::FTPArchive::Packages::ChangeList",CommandLine::HasArg);
    return true;
 }
 									/*}}}*/
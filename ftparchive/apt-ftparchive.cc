@@ -30,15 +30,22 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <atomic>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "cachedb.h"
 #include "override.h"
 #include "apt-ftparchive.h"
 #include "multicompress.h"
+#include "pdiff.h"
 #include "writer.h"
 
 #include <apti18n.h>
@@ -46,6 +53,8 @@
 
 using namespace std;
 unsigned Quiet = 0;
+// set if a patch couldn't be created, so that generate fails
+static std::atomic<bool> PDiffFailed(false);
 
 // struct PackageMap - List of all package files in the config file	/*{{{*/
 // ---------------------------------------------------------------------
@@ -56,6 +65,7 @@ struct PackageMap
    string BaseDir;
    string InternalPrefix;
    string FLFile;
+   string ChangeList;
    string PkgExt;
    string SrcExt;
    
@@ -91,6 +101,11 @@ struct PackageMap
    string PathPrefix;
    unsigned int DeLinkLimit;
    mode_t Permissions;
+
+   // Patches against the previous indexes
+   bool PkgPDiffs;
+   bool SrcPDiffs;
+   unsigned long MaxPatches;
    
    bool ContentsDone;
    bool PkgDone;
@@ -116,19 +131,40 @@ struct PackageMap
    };
    
    void GetGeneral(Configuration &Setup,Configuration &Block);
-   bool GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats);
-   bool GenSources(Configuration &Setup,struct CacheDB::Stats &Stats);
+   bool GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats,
+		    std::ostream &Out,std::ostream &Notices,std::ostream &Err,
+		    TranslationWriter * const Trans);
+   bool GenSources(Configuration &Setup,struct CacheDB::Stats &Stats,
+		   std::ostream &Out,std::ostream &Notices,std::ostream &Err);
    bool GenContents(Configuration &Setup,
 		    vector<PackageMap>::iterator Begin,
 		    vector<PackageMap>::iterator End,
 		    unsigned long &Left);
    
    PackageMap() : IncludeArchAll(true), LongDesc(true), TransWriter(NULL),
-		  DeLinkLimit(0), Permissions(1), ContentsDone(false),
+		  DeLinkLimit(0), Permissions(1), PkgPDiffs(false), SrcPDiffs(false),
+		  MaxPatches(0), ContentsDone(false),
 		  PkgDone(false), SrcDone(false), ContentsMTime(0) {};
 };
 									/*}}}*/
 
+// GenPDiff - Create the patch against the previous index		/*{{{*/
+// ---------------------------------------------------------------------
+/* Called right after the new index replaced the previous one, so that
+   the previous version is only kept open while its index is generated */
+static bool GenPDiff(PDiffWriter &PDiff,std::ostream &Out)
+{
+   string Patch;
+   if (PDiff.Write(Patch) == false)
+   {
+      PDiffFailed = true;
+      return false;
+   }
+   if (Patch.empty() == false)
+      Out << " New patch " << Patch << endl;
+   return true;
+}
+									/*}}}*/
 // PackageMap::GetGeneral - Common per-section definitions		/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -155,8 +191,17 @@ void PackageMap::GetGeneral(Configuration &Setup,Configuration &Block)
    
    Permissions = Setup.FindI("Default::FileMode",0644);
 
+   PkgPDiffs = Block.FindB("Packages::PDiffs",
+			   Setup.FindB("Default::Packages::PDiffs",false));
+   SrcPDiffs = Block.FindB("Sources::PDiffs",
+			   Setup.FindB("Default::Sources::PDiffs",false));
+   MaxPatches = Block.FindI("PDiffs::MaxPatches",
+			    Setup.FindI("Default::PDiffs::MaxPatches",56));
+
    if (FLFile.empty() == false)
       FLFile = flCombine(Setup.Find("Dir::FileListDir"),FLFile);
+   if (ChangeList.empty() == false)
+      ChangeList = flCombine(Setup.Find("Dir::FileListDir"),ChangeList);
    
    if (Contents == " ")
       Contents= string();   
@@ -164,8 +209,12 @@ void PackageMap::GetGeneral(Configuration &Setup,Configuration &Block)
 									/*}}}*/
 // PackageMap::GenPackages - Actually generate a Package file		/*{{{*/
 // ---------------------------------------------------------------------
-/* This generates the Package File described by this object. */
-bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats)
+/* This generates the Package File described by this object. The progress
+   is reported to Out, notices about the packages to Notices and their
+   errors to Err. The descriptions are written to Trans. */
+bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats,
+			     std::ostream &Out,std::ostream &Notices,std::ostream &Err,
+			     TranslationWriter * const Trans)
 {   
    if (PkgFile.empty() == true)
       return true;
@@ -178,14 +227,22 @@ bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats)
    gettimeofday(&StartTime,0);   
    
    PkgDone = true;
+
+   // Keep the previous version around to create a patch against it
+   std::unique_ptr<PDiffWriter> PDiff;
+   if (PkgPDiffs == true)
+      PDiff.reset(new PDiffWriter(flCombine(ArchiveDir,PkgFile),
+				  PkgCompress,Permissions,MaxPatches));
    
    // Create a package writer object.
    MultiCompress Comp(flCombine(ArchiveDir,PkgFile),
 		      PkgCompress,Permissions);
-   PackagesWriter Packages(&Comp.Input, TransWriter, flCombine(CacheDir,BinCacheDB),
+   PackagesWriter Packages(&Comp.Input, Trans, flCombine(CacheDir,BinCacheDB),
 			   flCombine(OverrideDir,BinOverride),
 			   flCombine(OverrideDir,ExtraOverride),
 			   Arch, IncludeArchAll);
+   Packages.Notices = &Notices;
+   Packages.Errors = &Err;
    if (PkgExt.empty() == false && Packages.SetExts(PkgExt) == false)
       return _error->Error(_("Package extension list is too long"));
    if (_error->PendingError() == true)
@@ -203,10 +260,19 @@ bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats)
    if (_error->PendingError() == true)
       return _error->Error(_("Error processing directory %s"),BaseDir.c_str());
    
-   c0out << ' ' << BaseDir << ":" << flush;
+   Out << ' ' << BaseDir << ":" << flush;
    
-   // Do recursive directory searching
-   if (FLFile.empty() == true)
+   // Update the previous Packages file or do recursive directory searching
+   struct stat St;
+   if (ChangeList.empty() == false &&
+       MultiCompress::GetStat(flCombine(ArchiveDir,PkgFile),PkgCompress,St) == true)
+   {
+      FileFd Previous;
+      if (Comp.OpenOld(Previous) == false ||
+	  Packages.UpdateFromList(Previous,flCombine(ArchiveDir,BaseDir),ArchiveDir,ChangeList) == false)
+	 return false;
+   }
+   else if (FLFile.empty() == true)
    {
       if (Packages.RecursiveScan(flCombine(ArchiveDir,BaseDir)) == false)
 	 return false;
@@ -223,31 +289,36 @@ bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats)
    unsigned long long Size;
    if (Comp.Finalize(Size) == false)
    {
-      c0out << endl;
+      Out << endl;
       return _error->Error(_("Error processing directory %s"),BaseDir.c_str());
    }
    
    if (Size != 0)
-      c0out << " New "
-             << SizeToStr(Size) << "B ";
+   {
+      Out << " New "
+	  << SizeToStr(Size) << "B ";
+   }
    else
-      c0out << ' ';
+      Out << ' ';
    
    struct timeval NewTime;
    gettimeofday(&NewTime,0);
    double Delta = NewTime.tv_sec - StartTime.tv_sec + 
                   (NewTime.tv_usec - StartTime.tv_usec)/1000000.0;
 
-   c0out << Packages.Stats.Packages << " files " <<
+   Out << Packages.Stats.Packages << " files " <<
 /*      SizeToStr(Packages.Stats.MD5Bytes) << "B/" << */
       SizeToStr(Packages.Stats.Bytes) << "B " <<
       TimeToStr((long)Delta) << endl;
 
    if(_config->FindB("APT::FTPArchive::ShowCacheMisses", false) == true)
-     c0out << " Misses in Cache: " << Packages.Stats.Misses<< endl;
+     Out << " Misses in Cache: " << Packages.Stats.Misses<< endl;
    
    Stats.Add(Packages.Stats);
    Stats.DeLinkBytes = Packages.Stats.DeLinkBytes;
+
+   if (Size != 0 && PDiff != nullptr && GenPDiff(*PDiff,Out) == false)
+      return false;
    
    return !_error->PendingError();
 }
@@ -255,8 +326,11 @@ bool PackageMap::GenPackages(Configuration &Setup,struct CacheDB::Stats &Stats)
 									/*}}}*/
 // PackageMap::GenSources - Actually generate a Source file		/*{{{*/
 // ---------------------------------------------------------------------
-/* This generates the Sources File described by this object. */
-bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats)
+/* This generates the Sources File described by this object. The progress
+   is reported to Out, notices about the packages to Notices and their
+   errors to Err. */
+bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats,
+			    std::ostream &Out,std::ostream &Notices,std::ostream &Err)
 {   
    if (SrcFile.empty() == true)
       return true;
@@ -269,6 +343,12 @@ bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats)
    gettimeofday(&StartTime,0);   
    
    SrcDone = true;
+
+   // Keep the previous version around to create a patch against it
+   std::unique_ptr<PDiffWriter> PDiff;
+   if (SrcPDiffs == true)
+      PDiff.reset(new PDiffWriter(flCombine(ArchiveDir,SrcFile),
+				  SrcCompress,Permissions,MaxPatches));
    
    // Create a package writer object.
    MultiCompress Comp(flCombine(ArchiveDir,SrcFile),
@@ -277,6 +357,8 @@ bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats)
 			 flCombine(OverrideDir,BinOverride),
 			 flCombine(OverrideDir,SrcOverride),
 			 flCombine(OverrideDir,SrcExtraOverride));
+   Sources.Notices = &Notices;
+   Sources.Errors = &Err;
    if (SrcExt.empty() == false && Sources.SetExts(SrcExt) == false)
       return _error->Error(_("Source extension list is too long"));
    if (_error->PendingError() == true)
@@ -292,7 +374,7 @@ bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats)
    if (_error->PendingError() == true)
       return _error->Error(_("Error processing directory %s"),BaseDir.c_str());
 
-   c0out << ' ' << BaseDir << ":" << flush;
+   Out << ' ' << BaseDir << ":" << flush;
    
    // Do recursive directory searching
    if (FLFile.empty() == true)
@@ -311,29 +393,34 @@ bool PackageMap::GenSources(Configuration &Setup,struct CacheDB::Stats &Stats)
    unsigned long long Size;
    if (Comp.Finalize(Size) == false)
    {
-      c0out << endl;
+      Out << endl;
       return _error->Error(_("Error processing directory %s"),BaseDir.c_str());
    }
       
    if (Size != 0)
-      c0out << " New "
-             << SizeToStr(Size) << "B ";
+   {
+      Out << " New "
+	  << SizeToStr(Size) << "B ";
+   }
    else
-      c0out << ' ';
+      Out << ' ';
    
    struct timeval NewTime;
    gettimeofday(&NewTime,0);
    double Delta = NewTime.tv_sec - StartTime.tv_sec +
                   (NewTime.tv_usec - StartTime.tv_usec)/1000000.0;
    
-   c0out << Sources.Stats.Packages << " pkgs in " <<
+   Out << Sources.Stats.Packages << " pkgs in " <<
       TimeToStr((long)Delta) << endl;
 
    if(_config->FindB("APT::FTPArchive::ShowCacheMisses", false) == true)
-     c0out << " Misses in Cache: " << Sources.Stats.Misses << endl;
+     Out << " Misses in Cache: " << Sources.Stats.Misses << endl;
 
    Stats.Add(Sources.Stats);
    Stats.DeLinkBytes = Sources.Stats.DeLinkBytes;
+
+   if (Size != 0 && PDiff != nullptr && GenPDiff(*PDiff,Out) == false)
+      return false;
    
    return !_error->PendingError();
 }
@@ -481,6 +568,7 @@ static void LoadTree(vector<PackageMap> &PkgList, std::vector<TranslationWriter*
    string DSources = Setup.Find("TreeDefault::Sources",
 				"$(DIST)/$(SECTION)/source/Sources");
    string DFLFile = Setup.Find("TreeDefault::FileList", "");
+   string DChangeList = Setup.Find("TreeDefault::ChangeList", "");
    string DSFLFile = Setup.Find("TreeDefault::SourceFileList", "");
 
    mode_t const Permissions = Setup.FindI("Default::FileMode",0644);
@@ -560,6 +648,7 @@ static void LoadTree(vector<PackageMap> &PkgList, std::vector<TranslationWriter*
 	       Itm.Contents = SubstVar(Block.Find("Contents",DContents.c_str()),Vars);
 	       Itm.ContentsHead = SubstVar(Block.Find("Contents::Header",DContentsH.c_str()),Vars);
 	       Itm.FLFile = SubstVar(Block.Find("FileList",DFLFile.c_str()),Vars);
+	       Itm.ChangeList = SubstVar(Block.Find("ChangeList",DChangeList.c_str()),Vars);
 	       Itm.ExtraOverride = SubstVar(Block.Find("ExtraOverride"),Vars);
 	    }
 
@@ -602,6 +691,7 @@ static void LoadBinDir(vector<PackageMap> &PkgList,Configuration &Setup)
       Itm.SrcOverride = Block.Find("SrcOverride");
       Itm.BaseDir = Top->Tag;
       Itm.FLFile = Block.Find("FileList");
+      Itm.ChangeList = Block.Find("ChangeList");
       Itm.InternalPrefix = Block.Find("InternalPrefix",Top->Tag.c_str());
       Itm.Contents = Block.Find("Contents");
       Itm.ContentsHead = Block.Find("Contents::Header");
@@ -625,6 +715,7 @@ static bool ShowHelp(CommandLine &)					/*{{{*/
       "          release path\n"
       "          generate config [groups]\n"
       "          clean config\n"
+      "          migratedb olddb newdb\n"
       "\n"
       "apt-ftparchive generates index files for Debian archives. It supports\n"
       "many styles of generation from fully automated to functional replacements\n"
@@ -681,8 +772,19 @@ static bool SimpleGenPackages(CommandLine &CmdL)
    if (CmdL.FileSize() >= 4)
       Packages.PathPrefix = CmdL.FileList[3];
    
-   // Do recursive directory searching
-   if (Packages.RecursiveScan(CmdL.FileList[1]) == false)
+   // Update the previous Packages file or do recursive directory searching
+   string const Previous = _config->Find("APT::FTPArchive::Packages::Previous");
+   string const ChangeList = _config->Find("APT::FTPArchive::Packages::ChangeList");
+   if (Previous.empty() == false || ChangeList.empty() == false)
+   {
+      if (Previous.empty() == true || ChangeList.empty() == true)
+	 return _error->Error(_("Updating a Packages file needs the previous file and a change list"));
+      FileFd PreviousFd(Previous, FileFd::ReadOnly, FileFd::Extension);
+      if (PreviousFd.IsOpen() == false ||
+	  Packages.UpdateFromList(PreviousFd, CmdL.FileList[1], "", ChangeList) == false)
+	 return false;
+   }
+   else if (Packages.RecursiveScan(CmdL.FileList[1]) == false)
       return false;
 
    // Give some stats if asked for
@@ -775,6 +877,149 @@ static bool SimpleGenRelease(CommandLine &CmdL)
    return true;
 }
 
+									/*}}}*/
+// GenerateJob - A Packages or Sources file generated in parallel	/*{{{*/
+// ---------------------------------------------------------------------
+/* The output of a job is collected and only passed on once all jobs before
+   it are done, so that the result is the same as the one of a serial run */
+struct GenerateJob
+{
+   PackageMap * const Map;
+   bool const Source;
+   std::unique_ptr<TranslationWriter> Trans;
+   // c0out and c1out of the job share a buffer to keep them in order
+   std::stringbuf Output;
+   std::ostream Out;
+   std::ostream Notices;
+   std::ostringstream Err;
+   struct CacheDB::Stats Stats;
+   bool Done;
+
+   // like the global stream, the job's one doesn't print if quiet
+   std::streambuf * Buffer(std::ostream const &Global)
+   {
+      if (Global.rdbuf() == devnull.rdbuf())
+	 return devnull.rdbuf();
+      return &Output;
+   }
+
+   GenerateJob(PackageMap * const Map, bool const Source) :
+      Map(Map), Source(Source), Out(Buffer(c0out)), Notices(Buffer(c1out)),
+      Done(false) {};
+};
+									/*}}}*/
+// DoGenerateParallel - Generate the given files with multiple threads	/*{{{*/
+// ---------------------------------------------------------------------
+/* Jobs sharing a cache database, an output file or the accounting of a
+   delink limit are grouped and the jobs of a group are run one after the
+   other by the same thread. The groups run in parallel. */
+static void DoGenerateParallel(Configuration &Setup,
+			       vector<PackageMap *> const &Selected,
+			       struct CacheDB::Stats &SrcStats,
+			       struct CacheDB::Stats &Stats,
+			       unsigned long const Threads)
+{
+   vector<std::unique_ptr<GenerateJob>> Jobs;
+   for (auto const I : Selected)
+      if (I->PkgFile.empty() == false)
+	 Jobs.emplace_back(new GenerateJob(I, false));
+   for (auto const I : Selected)
+      if (I->SrcFile.empty() == false)
+	 Jobs.emplace_back(new GenerateJob(I, true));
+   if (Jobs.empty() == true)
+      return;
+
+   // Union all jobs sharing one of their resources
+   vector<size_t> Parent(Jobs.size());
+   for (size_t J = 0; J != Jobs.size(); ++J)
+      Parent[J] = J;
+   auto const Find = [&](size_t J) {
+      while (Parent[J] != J)
+	 J = Parent[J] = Parent[Parent[J]];
+      return J;
+   };
+   std::map<string, size_t> Users;
+   auto const Use = [&](string const &Resource, size_t const J) {
+      auto const U = Users.insert(std::make_pair(Resource, J));
+      if (U.second == false)
+	 Parent[Find(J)] = Find(U.first->second);
+   };
+   for (size_t J = 0; J != Jobs.size(); ++J)
+   {
+      PackageMap const * const I = Jobs[J]->Map;
+      string const &DB = Jobs[J]->Source ? I->SrcCacheDB : I->BinCacheDB;
+      if (DB.empty() == false)
+	 Use("db:" + DB, J);
+      Use("file:" + (Jobs[J]->Source ? I->SrcFile : I->PkgFile), J);
+      if (I->DeLinkLimit != 0)
+	 Use(Jobs[J]->Source ? "delink:src" : "delink:pkg", J);
+   }
+   vector<vector<size_t>> Groups;
+   vector<size_t> GroupOf(Jobs.size(), Jobs.size());
+   for (size_t J = 0; J != Jobs.size(); ++J)
+   {
+      size_t &G = GroupOf[Find(J)];
+      if (G == Jobs.size())
+      {
+	 G = Groups.size();
+	 Groups.emplace_back();
+      }
+      Groups[G].push_back(J);
+   }
+
+   std::atomic<size_t> Next(0);
+   std::mutex OutputLock;
+   size_t Committed = 0;
+   auto const Worker = [&]() {
+      for (size_t G; (G = Next++) < Groups.size();)
+      {
+	 unsigned long long PkgDeLinkBytes = 0, SrcDeLinkBytes = 0;
+	 for (auto const J : Groups[G])
+	 {
+	    GenerateJob &Job = *Jobs[J];
+	    unsigned long long &DeLinkBytes = Job.Source ? SrcDeLinkBytes : PkgDeLinkBytes;
+	    unsigned long long const DeLinkBefore = DeLinkBytes;
+	    Job.Stats.DeLinkBytes = DeLinkBytes;
+	    bool Okay;
+	    if (Job.Source == true)
+	       Okay = Job.Map->GenSources(Setup, Job.Stats, Job.Out, Job.Notices, Job.Err);
+	    else
+	    {
+	       if (Job.Map->TransWriter != NULL)
+		  Job.Trans.reset(new TranslationWriter(Job.Map->TransWriter));
+	       Okay = Job.Map->GenPackages(Setup, Job.Stats, Job.Out, Job.Notices, Job.Err, Job.Trans.get());
+	    }
+	    if (Okay == false || _error->empty() == false)
+	       _error->DumpErrors(Job.Err);
+	    DeLinkBytes = Job.Stats.DeLinkBytes;
+	    Job.Stats.DeLinkBytes -= DeLinkBefore;
+
+	    // Pass on the output of all jobs which are done in order
+	    std::lock_guard<std::mutex> Lock(OutputLock);
+	    Job.Done = true;
+	    for (; Committed != Jobs.size() && Jobs[Committed]->Done == true; ++Committed)
+	    {
+	       GenerateJob &C = *Jobs[Committed];
+	       // if c1out doesn't print, c0out doesn't either
+	       c1out << C.Output.str() << flush;
+	       cerr << C.Err.str() << flush;
+	       C.Output.str(string());
+	       C.Err.str(string());
+	       if (C.Trans != nullptr && C.Trans->Flush() == false)
+		  _error->DumpErrors();
+	       C.Trans.reset();
+	       (C.Source ? SrcStats : Stats).Add(C.Stats);
+	    }
+	 }
+      }
+   };
+   vector<std::thread> Helpers;
+   for (size_t T = 1; T < std::min<size_t>(Threads, Groups.size()); ++T)
+      Helpers.emplace_back(Worker);
+   Worker();
+   for (auto &T : Helpers)
+      T.join();
+}
 									/*}}}*/
 // DoGeneratePackagesAndSources - Helper for Generate                   /*{{{*/
 // ---------------------------------------------------------------------
@@ -784,14 +1029,11 @@ static bool DoGeneratePackagesAndSources(Configuration &Setup,
 					 struct CacheDB::Stats &Stats,
 					 CommandLine &CmdL)
 {
+   vector<PackageMap *> Selected;
    if (CmdL.FileSize() <= 2)
    {
       for (vector<PackageMap>::iterator I = PkgList.begin(); I != PkgList.end(); ++I)
-	 if (I->GenPackages(Setup,Stats) == false)
-	    _error->DumpErrors();
-      for (vector<PackageMap>::iterator I = PkgList.begin(); I != PkgList.end(); ++I)
-	 if (I->GenSources(Setup,SrcStats) == false)
-	    _error->DumpErrors();
+	 Selected.push_back(&(*I));
    }
    else
    {
@@ -818,34 +1060,33 @@ static bool DoGeneratePackagesAndSources(Configuration &Setup,
       }
       _error->DumpErrors();
       
-      // Do the generation for Packages
-      for (End = List; End->Str != 0; ++End)
-      {
-	 if (End->Hit == false)
-	    continue;
-	 
-	 PackageMap * const I = static_cast<PackageMap *>(End->UserData);
-	 if (I->PkgDone == true)
-	    continue;
-	 if (I->GenPackages(Setup,Stats) == false)
-	    _error->DumpErrors();
-      }
-      
-      // Do the generation for Sources
+      // Do the generation for everything matched
       for (End = List; End->Str != 0; ++End)
       {
 	 if (End->Hit == false)
 	    continue;
 	 
 	 PackageMap * const I = static_cast<PackageMap *>(End->UserData);
-	 if (I->SrcDone == true)
-	    continue;
-	 if (I->GenSources(Setup,SrcStats) == false)
-	    _error->DumpErrors();
+	 if (std::find(Selected.begin(), Selected.end(), I) == Selected.end())
+	    Selected.push_back(I);
       }
       
       delete [] List;
    }
+
+   unsigned long const Jobs = _config->FindI("APT::FTPArchive::Jobs", 1);
+   if (Jobs > 1)
+   {
+      DoGenerateParallel(Setup, Selected, SrcStats, Stats, Jobs);
+      return true;
+   }
+
+   for (auto const I : Selected)
+      if (I->GenPackages(Setup,Stats,c0out,c1out,cerr,I->TransWriter) == false)
+	 _error->DumpErrors();
+   for (auto const I : Selected)
+      if (I->GenSources(Setup,SrcStats,c0out,c1out,cerr) == false)
+	 _error->DumpErrors();
    return true;
 }
 
@@ -973,7 +1214,7 @@ static bool Generate(CommandLine &CmdL)
          << " archives. Took " << TimeToStr((long)Delta) << endl;
 
    UnloadTree(TransList);
-   return true;
+   return PDiffFailed == false;
 }
 
                                                                         /*}}}*/
@@ -1029,6 +1270,38 @@ static bool Clean(CommandLine &CmdL)
 }
 									/*}}}*/
 
+// MigrateDB - Copy a cache database into one of another format	/*{{{*/
+// ---------------------------------------------------------------------
+/* The new database is created in the format APT::FTPArchive::DBFormat
+   names, which is the LogDB by default here. */
+static bool MigrateDB(CommandLine &CmdL)
+{
+   if (CmdL.FileSize() != 3)
+      return ShowHelp(CmdL);
+
+   std::string const From = CmdL.FileList[1];
+   std::string const To = CmdL.FileList[2];
+   if (FileExists(From) == false)
+      return _error->Error(_("Could not open file %s"), From.c_str());
+   if (FileExists(To) == true)
+      return _error->Error(_("File %s already exists"), To.c_str());
+
+   _config->CndSet("APT::FTPArchive::DBFormat", "log");
+   CacheDB Old(From);
+   CacheDB New(To);
+   if (Old.Loaded() == false || New.Loaded() == false)
+      return false;
+   if (Old.CopyTo(New) == false || New.ReadyDB() == false)
+   {
+      New.ReadyDB();
+      RemoveFile("MigrateDB", To);
+      RemoveFile("MigrateDB", To + ".idx");
+      return false;
+   }
+   return true;
+}
+									/*}}}*/
+
 static std::vector<aptDispatchWithHelp> GetCommands()			/*{{{*/
 {
    return {
@@ -1038,6 +1311,7 @@ static std::vector<aptDispatchWithHelp> GetCommands()			/*{{{*/
       {"release",&SimpleGenRelease, nullptr},
       {"generate",&Generate, nullptr},
       {"clean",&Clean, nullptr},
+      {"migratedb",&MigrateDB, nullptr},
       {nullptr, nullptr, nullptr}
    };
 }
@@ -1050,6 +1324,9 @@ int main(int argc, const char *argv[])					/*{{{*/
 
    _config->CndSet("quiet",0);
    Quiet = _config->FindI("quiet",0);
+   // most files are hashed with several digests
+   if (std::thread::hardware_concurrency() > 1)
+      _config->CndSet("APT::Hashes::Parallel", "true");
    InitOutput(clog.rdbuf());
 
    return DispatchCommandLine(CmdL, Cmds);
@@ -35,7 +35,7 @@
 									/*}}}*/
 
 CacheDB::CacheDB(std::string const &DB)
-   : Dbp(0), Fd(NULL), DebFile(0)
+   : Dbp(0), SharedDB(false), Fd(NULL), DebFile(0)
 {
    TmpKey[0]='\0';
    ReadyDB(DB);
@@ -58,12 +58,15 @@ bool CacheDB::ReadyDB(std::string const &DB)
    ReadOnly = _config->FindB("APT::FTPArchive::ReadOnlyDB",false);
    
    // Close the old DB
-   if (Dbp != 0) 
+   if (Dbp != 0 && SharedDB == false)
       Dbp->close(Dbp,0);
+   bool Closed = true;
+   if (Log != nullptr && SharedDB == false)
+      Closed = Log->Close();
    
    /* Check if the DB was disabled while running and deal with a 
       corrupted DB */
-   if (DBFailed() == true)
+   if (DBFailed() == true && SharedDB == false)
    {
       _error->Warning(_("DB was corrupted, file renamed to %s.old"),DBFile.c_str());
       rename(DBFile.c_str(),(DBFile+".old").c_str());
@@ -71,10 +74,29 @@ bool CacheDB::ReadyDB(std::string const &DB)
    
    DBLoaded = false;
    Dbp = 0;
+   Log.reset();
    DBFile = std::string();
+   SharedDB = false;
+   DBLock.reset();
    
    if (DB.empty())
+      return Closed;
+
+   /* An existing DB is used in the format it has, new ones are created
+      in the configured one */
+   if (LogDB::IsLogDB(DB) == true || (FileExists(DB) == false &&
+	    _config->Find("APT::FTPArchive::DBFormat", "bdb") == "log"))
+   {
+      Log = std::make_shared<LogDB>();
+      if (Log->Open(DB, ReadOnly) == false)
+      {
+	 Log.reset();
+	 return false;
+      }
+      DBFile = DB;
+      DBLoaded = true;
       return true;
+   }
 
    db_create(&Dbp, NULL, 0);
    if ((err = Dbp->open(Dbp, NULL, DB.c_str(), NULL, DB_BTREE,
@@ -108,6 +130,81 @@ bool CacheDB::ReadyDB(std::string const &DB)
    return true;
 }
 									/*}}}*/
+// CacheDB::ShareDB - Use the DB of another instance			/*{{{*/
+// ---------------------------------------------------------------------
+/* A DB handle can't be used by multiple threads at the same time, so all
+   instances sharing it serialise their access with a common lock. The
+   lock has to be created before the instances are used by other threads. */
+void CacheDB::ShareDB(CacheDB &Other)
+{
+   ReadyDB();
+   if (Other.Log != nullptr)
+   {
+      // a LogDB can be used by multiple threads itself
+      Log = Other.Log;
+      DBLoaded = Other.DBLoaded;
+      ReadOnly = Other.ReadOnly;
+      DBFile = Other.DBFile;
+      SharedDB = true;
+      return;
+   }
+   if (Other.Dbp == 0)
+      return;
+   if (Other.DBLock == nullptr)
+      Other.DBLock = std::make_shared<std::mutex>();
+   Dbp = Other.Dbp;
+   DBLoaded = Other.DBLoaded;
+   ReadOnly = Other.ReadOnly;
+   DBFile = Other.DBFile;
+   SharedDB = true;
+   DBLock = Other.DBLock;
+}
+									/*}}}*/
+// CacheDB::LockedGet - Get from a shared DB				/*{{{*/
+// ---------------------------------------------------------------------
+/* The memory of a result belongs to the handle and is reused by the next
+   access of any thread, so a copy is kept unless the caller provided the
+   memory itself. */
+bool CacheDB::LockedGet()
+{
+   std::lock_guard<std::mutex> Lock(*DBLock);
+   if (Dbp->get(Dbp,0,&Key,&Data,0) != 0)
+      return false;
+   if ((Data.flags & DB_DBT_USERMEM) == 0)
+   {
+      GetBuffer.assign(static_cast<char const *>(Data.data), Data.size);
+      Data.data = &GetBuffer[0];
+   }
+   return true;
+}
+									/*}}}*/
+// CacheDB::LogGet - Get from a LogDB					/*{{{*/
+// ---------------------------------------------------------------------
+/* Behaves like a get from Berkeley DB: The size of the result is set even
+   if it doesn't fit into the memory provided by the caller. */
+bool CacheDB::LogGet()
+{
+   if (Log->Get(Key.data, Key.size, GetBuffer) == false)
+      return false;
+   Data.size = GetBuffer.size();
+   if ((Data.flags & DB_DBT_USERMEM) == 0)
+   {
+      Data.data = &GetBuffer[0];
+      return true;
+   }
+   if (Data.ulen < Data.size)
+      return false;
+   memcpy(Data.data, GetBuffer.data(), Data.size);
+   return true;
+}
+									/*}}}*/
+// CacheDB::LockedPut - Put into a shared DB				/*{{{*/
+int CacheDB::LockedPut()
+{
+   std::lock_guard<std::mutex> Lock(*DBLock);
+   return Dbp->put(Dbp,0,&Key,&Data,0);
+}
+									/*}}}*/
 // CacheDB::OpenFile - Open the file					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -534,14 +631,34 @@ bool CacheDB::Finish()
    return true;
 }
 									/*}}}*/
+// KeepRecord - Check if the record of a key is still needed		/*{{{*/
+// ---------------------------------------------------------------------
+/* A record is kept if it has a known type and the file still exists. */
+static bool KeepRecord(const char *Key, size_t const Size)
+{
+   const char *Colon = (const char *)memrchr(Key, ':', Size);
+   if (Colon == NULL)
+      return false;
+   if (stringcmp(Colon + 1, Key + Size, "st") != 0 &&
+       stringcmp(Colon + 1, Key + Size, "cl") != 0 &&
+       stringcmp(Colon + 1, Key + Size, "cs") != 0 &&
+       stringcmp(Colon + 1, Key + Size, "cn") != 0)
+      return false;
+   return FileExists(std::string(Key, Colon));
+}
+									/*}}}*/
 // CacheDB::Clean - Clean the Database					/*{{{*/
 // ---------------------------------------------------------------------
-/* Tidy the database by removing files that no longer exist at all. */
+/* Tidy the database by removing files that no longer exist at all. A
+   LogDB is compacted by this, Berkeley DB is asked to free the space. */
 bool CacheDB::Clean()
 {
    if (DBLoaded == false)
       return true;
 
+   if (Log != nullptr)
+      return Log->Compact(KeepRecord);
+
    /* I'm not sure what VERSION_MINOR should be here.. 2.4.14 certainly
       needs the lower one and 2.7.7 needs the upper.. */
    DBC *Cursor;
@@ -554,20 +671,8 @@ bool CacheDB::Clean()
    memset(&Data,0,sizeof(Data));
    while ((errno = Cursor->c_get(Cursor,&Key,&Data,DB_NEXT)) == 0)
    {
-      const char *Colon = (char*)memrchr(Key.data, ':', Key.size);
-      if (Colon)
-      {
-         if (stringcmp(Colon + 1, (char *)Key.data+Key.size,"st") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cl") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cs") == 0 ||
-             stringcmp(Colon + 1, (char *)Key.data+Key.size,"cn") == 0)
-	 {
-            std::string FileName = std::string((const char *)Key.data,Colon);
-            if (FileExists(FileName) == true) {
-		continue;
-            }
-	 }
-      }
+      if (KeepRecord((const char *)Key.data, Key.size) == true)
+	 continue;
       Cursor->c_del(Cursor,0);
    }
    int res = Dbp->compact(Dbp, NULL, NULL, NULL, NULL, DB_FREE_SPACE, NULL);
@@ -581,3 +686,51 @@ bool CacheDB::Clean()
    return true;
 }
 									/*}}}*/
+// CacheDB::ForEach - Visit all records					/*{{{*/
+bool CacheDB::ForEach(std::function<bool(const void *Key, size_t KeyLength,
+	 const void *Data, size_t Length)> const &Visit)
+{
+   if (DBLoaded == false)
+      return true;
+
+   if (Log != nullptr)
+      return Log->ForEach(Visit);
+
+   DBC *Cursor;
+   if ((errno = Dbp->cursor(Dbp, NULL, &Cursor, 0)) != 0)
+      return _error->Error(_("Unable to get a cursor"));
+
+   DBT Key;
+   DBT Data;
+   memset(&Key,0,sizeof(Key));
+   memset(&Data,0,sizeof(Data));
+   bool Res = true;
+   while ((errno = Cursor->c_get(Cursor,&Key,&Data,DB_NEXT)) == 0)
+   {
+      if (Visit(Key.data, Key.size, Data.data, Data.size) == false)
+      {
+	 Res = false;
+	 break;
+      }
+   }
+   Cursor->c_close(Cursor);
+   return Res;
+}
+									/*}}}*/
+// CacheDB::CopyTo - Copy all records into another DB			/*{{{*/
+// ---------------------------------------------------------------------
+/* The records are copied as they are, so the other DB can be of another
+   format, but has to be used by the same version. */
+bool CacheDB::CopyTo(CacheDB &Target)
+{
+   if (Target.DBLoaded == false)
+      return false;
+   return ForEach([&](const void *Key, size_t KeyLength, const void *Data, size_t Length) {
+      memset(&Target.Key, 0, sizeof(Target.Key));
+      memset(&Target.Data, 0, sizeof(Target.Data));
+      Target.Key.data = (void *)Key;
+      Target.Key.size = KeyLength;
+      return Target.Put(Data, Length);
+   });
+}
+									/*}}}*/
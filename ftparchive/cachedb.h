@@ -17,12 +17,16 @@
 
 #include <db.h>
 #include <errno.h>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
 
 #include "contents.h"
+#include "logdb.h"
 #include "sources.h"
 
 class FileFd;
@@ -37,10 +41,20 @@ class CacheDB
    DBT Data;
    char TmpKey[600];
    DB *Dbp;
+   // Used instead of Dbp if the DB is a LogDB
+   std::shared_ptr<LogDB> Log;
    bool DBLoaded;
    bool ReadOnly;
    std::string DBFile;
 
+   // Access to a handle shared with instances in other threads, see ShareDB
+   bool SharedDB;
+   std::shared_ptr<std::mutex> DBLock;
+   std::string GetBuffer;
+   bool LockedGet();
+   int LockedPut();
+   bool LogGet();
+
    // Generate a key for the DB of a given type
    void _InitQuery(const char *Type)
    {
@@ -65,6 +79,10 @@ class CacheDB
 
    inline bool Get() 
    {
+      if (Log != nullptr)
+	 return LogGet();
+      if (DBLock != nullptr)
+	 return LockedGet();
       return Dbp->get(Dbp,0,&Key,&Data,0) == 0;
    };
    inline bool Put(const void *In,unsigned long const &Length) 
@@ -73,7 +91,17 @@ class CacheDB
 	 return true;
       Data.size = Length;
       Data.data = (void *)In;
-      if (DBLoaded == true && (errno = Dbp->put(Dbp,0,&Key,&Data,0)) != 0)
+      if (Log != nullptr)
+      {
+	 if (DBLoaded == true && Log->Put(Key.data, Key.size, In, Length) == false)
+	 {
+	    DBLoaded = false;
+	    return false;
+	 }
+	 return true;
+      }
+      if (DBLoaded == true &&
+	  (errno = (DBLock != nullptr ? LockedPut() : Dbp->put(Dbp,0,&Key,&Data,0))) != 0)
       {
 	 DBLoaded = false;
 	 return false;
@@ -169,7 +197,9 @@ class CacheDB
    } Stats;
    
    bool ReadyDB(std::string const &DB = "");
-   inline bool DBFailed() {return Dbp != 0 && DBLoaded == false;};
+   // Use the DB of Other, which has to outlive this instance
+   void ShareDB(CacheDB &Other);
+   inline bool DBFailed() {return (Dbp != 0 || Log != nullptr) && DBLoaded == false;};
    inline bool Loaded() {return DBLoaded == true;};
    
    inline unsigned long long GetFileSize(void) {return CurStat.FileSize;}
@@ -188,6 +218,11 @@ class CacheDB
    bool Finish();   
    
    bool Clean();
+   // Call Visit for each record in the DB
+   bool ForEach(std::function<bool(const void *Key, size_t KeyLength,
+	    const void *Data, size_t Length)> const &Visit);
+   // Copy all records into the DB of Target
+   bool CopyTo(CacheDB &Target);
    
    explicit CacheDB(std::string const &DB);
    ~CacheDB();
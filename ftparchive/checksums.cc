@@ -0,0 +1,254 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   ChecksumsManifest
+
+   The manifest has one line for each file with its name, size, inode,
+   mtime and the checksums in the form type:value, all separated by a
+   single space. It is locked while it is read or written, so that
+   concurrent runs don't lose each others records.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "checksums.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+char const * const ChecksumsManifest::FileName = ".apt-ftparchive-checksums";
+
+static struct {
+   unsigned int Flag;
+   char const *Type;
+} const HashTypes[] = {
+   {Hashes::MD5SUM, "MD5Sum"},
+   {Hashes::SHA1SUM, "SHA1"},
+   {Hashes::SHA256SUM, "SHA256"},
+   {Hashes::SHA512SUM, "SHA512"},
+};
+
+// ReadManifest - Read the whole manifest from the locked file		/*{{{*/
+static bool ReadManifest(FileFd &Fd, std::string &Data)
+{
+   Data.resize(Fd.Size());
+   if (Data.empty() == false && Fd.Read(&Data[0], Data.size()) == false)
+      return false;
+   return true;
+}
+									/*}}}*/
+// ChecksumsManifest::Parse - Read the entries of a manifest		/*{{{*/
+// ---------------------------------------------------------------------
+/* Lines which can't be parsed are ignored, the file is hashed again */
+bool ChecksumsManifest::Parse(std::string const &Data, std::map<std::string, Entry> &Entries)
+{
+   std::istringstream In(Data);
+   std::string Line;
+   while (std::getline(In, Line))
+   {
+      std::istringstream Fields(Line);
+      std::string Name, MTime;
+      Entry E;
+      if (!(Fields >> Name >> E.Size >> E.Inode >> MTime))
+	 continue;
+      if (sscanf(MTime.c_str(), "%lld.%ld", &E.MTime, &E.MTimeNSec) != 2)
+	 continue;
+      std::string Sum;
+      while (Fields >> Sum)
+	 E.Hashes.push_back(HashString(Sum));
+      E.Hashes.FileSize(E.Size);
+      Entries[Name] = E;
+   }
+   return true;
+}
+									/*}}}*/
+// ChecksumsManifest::Current - Check that a file is still unchanged	/*{{{*/
+bool ChecksumsManifest::Current(std::string const &Name, Entry const &E) const
+{
+   struct stat St;
+   if (stat(flCombine(Dir, Name).c_str(), &St) != 0)
+      return false;
+   return (unsigned long long)St.st_size == E.Size &&
+      (unsigned long long)St.st_ino == E.Inode &&
+      St.st_mtim.tv_sec == E.MTime && St.st_mtim.tv_nsec == E.MTimeNSec;
+}
+									/*}}}*/
+// ChecksumsManifest::Load - Read the manifest of a directory		/*{{{*/
+bool ChecksumsManifest::Load(std::string const &Directory)
+{
+   Dir = Directory;
+   Entries.clear();
+   std::string const File = flCombine(Dir, FileName);
+   if (FileExists(File) == false)
+      return true;
+
+   FileFd Fd(File, FileFd::ReadOnly);
+   if (Fd.IsOpen() == false)
+      return false;
+   if (flock(Fd.Fd(), LOCK_SH) != 0)
+      return _error->Errno("flock", _("Couldn't lock %s"), File.c_str());
+   std::string Data;
+   if (ReadManifest(Fd, Data) == false)
+      return false;
+   return Parse(Data, Entries);
+}
+									/*}}}*/
+// ChecksumsManifest::Find - Get the checksums of an unchanged file	/*{{{*/
+// ---------------------------------------------------------------------
+/* Only the requested checksums are returned, if one of them wasn't
+   recorded, the file has to be hashed again. */
+bool ChecksumsManifest::Find(std::string const &Name, unsigned int const DoHashes,
+			     HashStringList &Hashes) const
+{
+   auto const E = Entries.find(Name);
+   if (E == Entries.end() || Current(Name, E->second) == false)
+      return false;
+
+   HashStringList Found;
+   for (auto const &T : HashTypes)
+   {
+      if ((DoHashes & T.Flag) != T.Flag)
+	 continue;
+      HashString const * const Sum = E->second.Hashes.find(T.Type);
+      if (Sum == NULL)
+	 return false;
+      Found.push_back(*Sum);
+   }
+   Found.FileSize(E->second.Size);
+   Hashes = Found;
+   return true;
+}
+									/*}}}*/
+// ChecksumsManifest::Add - Record the checksums of a file		/*{{{*/
+bool ChecksumsManifest::Add(std::string const &Name, HashStringList const &Hashes)
+{
+   std::string const File = flCombine(Dir, Name);
+   struct stat St;
+   if (stat(File.c_str(), &St) != 0)
+      return _error->Errno("stat", _("Failed to stat %s"), File.c_str());
+
+   Entry &E = Entries[Name];
+   E.Size = St.st_size;
+   E.Inode = St.st_ino;
+   E.MTime = St.st_mtim.tv_sec;
+   E.MTimeNSec = St.st_mtim.tv_nsec;
+   E.Hashes = Hashes;
+   return true;
+}
+									/*}}}*/
+// ChecksumsManifest::Save - Merge the entries into the manifest	/*{{{*/
+// ---------------------------------------------------------------------
+/* Entries of the manifest on disk are kept as long as they are still
+   valid, so files recorded by others don't need to be hashed again. */
+bool ChecksumsManifest::Save()
+{
+   std::string const File = flCombine(Dir, FileName);
+   FileFd Fd(File, FileFd::ReadWrite | FileFd::Create, 0644);
+   if (Fd.IsOpen() == false)
+      return false;
+   if (flock(Fd.Fd(), LOCK_EX) != 0)
+      return _error->Errno("flock", _("Couldn't lock %s"), File.c_str());
+
+   std::string Data;
+   std::map<std::string, Entry> Old;
+   if (ReadManifest(Fd, Data) == false || Parse(Data, Old) == false)
+      return false;
+   for (auto const &O : Old)
+      if (Entries.find(O.first) == Entries.end() && Current(O.first, O.second) == true)
+	 Entries.insert(O);
+
+   std::ostringstream Out;
+   for (auto const &E : Entries)
+   {
+      std::string MTime;
+      strprintf(MTime, "%lld.%09ld", E.second.MTime, E.second.MTimeNSec);
+      Out << E.first << ' ' << E.second.Size << ' ' << E.second.Inode << ' ' << MTime;
+      for (auto const &Sum : E.second.Hashes)
+	 if (Sum.HashType() != "Checksum-FileSize")
+	    Out << ' ' << Sum.toStr();
+      Out << '\n';
+   }
+   Data = Out.str();
+   if (Fd.Seek(0) == false || Fd.Truncate(0) == false ||
+       Fd.Write(Data.c_str(), Data.length()) == false)
+      return false;
+   return Fd.Close();
+}
+									/*}}}*/
+// ChecksumsManifest::Calculate - Hash files in parallel		/*{{{*/
+// ---------------------------------------------------------------------
+/* The errors of each file are collected on their own, so they can be
+   passed on in the order of the files in the calling thread. */
+bool ChecksumsManifest::Calculate(std::vector<std::string> const &Files,
+				  unsigned int const DoHashes, unsigned long const Threads,
+				  std::function<bool(size_t Index, HashStringList const &Sums)> const &Done)
+{
+   std::vector<HashStringList> Sums(Files.size());
+   std::vector<std::vector<std::pair<bool, std::string>>> Errors(Files.size());
+   std::atomic<size_t> Next(0);
+   auto const Worker = [&]() {
+      for (size_t I = Next++; I < Files.size(); I = Next++)
+      {
+	 _error->PushToStack();
+	 FileFd Fd(Files[I], FileFd::ReadOnly);
+	 if (Fd.IsOpen() == true)
+	 {
+	    Hashes Hash(DoHashes);
+	    if (Hash.AddFD(Fd) == true)
+	       Sums[I] = Hash.GetHashStringList();
+	 }
+	 std::string Msg;
+	 while (_error->empty() == false)
+	 {
+	    bool const Type = _error->PopMessage(Msg);
+	    Errors[I].emplace_back(Type, Msg);
+	 }
+	 _error->RevertToStack();
+      }
+   };
+
+   std::vector<std::thread> Helpers;
+   for (size_t T = 1; T < std::min<size_t>(std::max(1ul, Threads), Files.size()); ++T)
+      Helpers.emplace_back(Worker);
+   Worker();
+   for (auto &T : Helpers)
+      T.join();
+
+   bool Res = true;
+   for (size_t I = 0; I != Files.size(); ++I)
+   {
+      for (auto const &E : Errors[I])
+      {
+	 if (E.first == true)
+	 {
+	    _error->Error("%s", E.second.c_str());
+	    Res = false;
+	 }
+	 else
+	    _error->Warning("%s", E.second.c_str());
+      }
+      if (Done(I, Sums[I]) == false)
+	 Res = false;
+   }
+   return Res;
+}
+									/*}}}*/
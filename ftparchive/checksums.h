@@ -0,0 +1,63 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   ChecksumsManifest
+
+   generate can record the checksums of the index files it writes in a
+   manifest in their directory, together with the size, inode and mtime
+   the file had. As long as these still match, the release command takes
+   the checksums from the manifest instead of calculating them again.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef CHECKSUMS_H
+#define CHECKSUMS_H
+
+#include <apt-pkg/hashes.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+class ChecksumsManifest
+{
+   struct Entry
+   {
+      unsigned long long Size;
+      unsigned long long Inode;
+      long long MTime;
+      long MTimeNSec;
+      HashStringList Hashes;
+   };
+   std::string Dir;
+   std::map<std::string, Entry> Entries;
+
+   static bool Parse(std::string const &Data, std::map<std::string, Entry> &Entries);
+   bool Current(std::string const &Name, Entry const &E) const;
+
+   public:
+
+   // Name of the manifest in each directory
+   static char const * const FileName;
+
+   // Read the manifest of the directory, it is fine if there is none
+   bool Load(std::string const &Dir);
+   // Get the checksums of a file in the directory if they are still valid
+   bool Find(std::string const &Name, unsigned int const DoHashes, HashStringList &Hashes) const;
+   // Record the checksums of a file in the directory as it is now
+   bool Add(std::string const &Name, HashStringList const &Hashes);
+   // Merge the recorded checksums into the manifest on disk
+   bool Save();
+
+   /* Calculate the checksums of the files with up to Threads threads.
+      Done is called for each file in order with the errors of the file
+      pending and empty checksums if it couldn't be read. */
+   static bool Calculate(std::vector<std::string> const &Files, unsigned int const DoHashes,
+			 unsigned long const Threads,
+			 std::function<bool(size_t Index, HashStringList const &Sums)> const &Done);
+};
+
+#endif
@@ -29,6 +29,11 @@
    
    The ---> is the DirDown link
    
+   For a full archive the tree needs far more memory than that, so in
+   streaming mode the pathnames are instead collected with the number of
+   their package up to a memory limit, sorted and written as a run into a
+   temporary file. For printing the runs are merged and the packages of
+   each pathname grouped, which results in the same output as the tree.
    
    ##################################################################### */
 									/*}}}*/
@@ -40,9 +45,12 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 
+#include <algorithm>
+#include <queue>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "contents.h"
 
@@ -202,6 +210,9 @@ GenContents::Node *GenContents::Grab(GenContents::Node *Top,const char *Name,
    in output from tar this should result in hitting previous items. */
 void GenContents::Add(const char *Dir,const char *Package)
 {
+   if (MemoryLimit != 0)
+      return AddToRun(Dir,Package);
+
    Node *Root = &this->Root;
    
    // Drop leading slashes
@@ -262,6 +273,12 @@ void GenContents::WriteSpace(std::string &out, size_t Current, size_t Target)
    summed over all the directory parents of this node. */
 void GenContents::Print(FileFd &Out)
 {
+   if (MemoryLimit != 0)
+   {
+      PrintRuns(Out);
+      return;
+   }
+
    char Buffer[1024];
    Buffer[0] = 0;
    DoPrint(Out,&Root,Buffer);
@@ -304,6 +321,258 @@ void GenContents::DoPrint(FileFd &Out,GenContents::Node *Top, char *Buf)
    DoPrint(Out,Top->BTreeRight,Buf);  
 }
 									/*}}}*/
+// RunWriter - Write the entries of a run into a temporary file	/*{{{*/
+// ---------------------------------------------------------------------
+/* An entry is the pathname terminated by a zero followed by the number
+   of the package. Entries repeating the previous one are dropped. */
+class RunWriter
+{
+   FileFd * const Fd;
+   std::string Buffer;
+   std::string LastPath;
+   uint32_t LastPackage;
+
+   public:
+   bool Write(std::string const &Path, uint32_t const Package)
+   {
+      if (Buffer.empty() == false && Package == LastPackage && Path == LastPath)
+	 return true;
+      LastPath = Path;
+      LastPackage = Package;
+      Buffer.append(Path.c_str(), Path.length() + 1);
+      Buffer.append(reinterpret_cast<char const *>(&Package), sizeof(Package));
+      if (Buffer.size() < 64*1024)
+	 return true;
+      bool const Res = Fd->Write(Buffer.data(), Buffer.size());
+      Buffer.clear();
+      return Res;
+   }
+   bool Finish()
+   {
+      if (Buffer.empty() == false && Fd->Write(Buffer.data(), Buffer.size()) == false)
+	 return false;
+      Buffer.clear();
+      return Fd->Seek(0);
+   }
+   explicit RunWriter(FileFd * const Fd) : Fd(Fd), LastPackage(0) {}
+};
+									/*}}}*/
+// RunReader - Read the entries of a run one after the other		/*{{{*/
+class RunReader
+{
+   FileFd &Fd;
+   char Buffer[64*1024];
+   size_t Start;
+   size_t End;
+
+   public:
+   std::string Path;
+   uint32_t Package;
+
+   // Load the next entry, false at the end of the run
+   bool Next()
+   {
+      Path.clear();
+      while (true)
+      {
+	 char const * const Zero = static_cast<char const *>(memchr(Buffer + Start, 0, End - Start));
+	 if (Zero != NULL && Buffer + End - Zero > (ssize_t) sizeof(Package))
+	 {
+	    Path.append(Buffer + Start, Zero - (Buffer + Start));
+	    memcpy(&Package, Zero + 1, sizeof(Package));
+	    Start = Zero + 1 + sizeof(Package) - Buffer;
+	    return true;
+	 }
+	 // the entry continues in the next block of the file
+	 if (Zero == NULL)
+	 {
+	    Path.append(Buffer + Start, End - Start);
+	    Start = End;
+	 }
+	 memmove(Buffer, Buffer + Start, End - Start);
+	 End -= Start;
+	 Start = 0;
+	 unsigned long long Actual = 0;
+	 if (Fd.Read(Buffer + End, sizeof(Buffer) - End, &Actual) == false || Actual == 0)
+	    return false;
+	 End += Actual;
+      }
+   }
+   explicit RunReader(FileFd &Fd) : Fd(Fd), Start(0), End(0), Package(0) {}
+};
+									/*}}}*/
+// GenContents::AddToRun - Add a path in streaming mode			/*{{{*/
+// ---------------------------------------------------------------------
+/* Directories are not part of the output, so they are not collected at
+   all. The packages are numbered in the order they are added. */
+void GenContents::AddToRun(const char *Dir,const char *Package)
+{
+   while (*Dir == '/')
+      Dir++;
+   size_t const Len = strlen(Dir);
+   if (Len == 0 || Dir[Len - 1] == '/')
+      return;
+
+   if (Packages.empty() == true || Packages.back() != Package)
+      Packages.push_back(Package);
+   RunEntry const Entry = {RunPaths.length(), static_cast<uint32_t>(Packages.size() - 1)};
+   RunEntries.push_back(Entry);
+   RunPaths.append(Dir, Len + 1);
+
+   if (RunPaths.length() + RunEntries.size() * sizeof(RunEntry) >= MemoryLimit)
+      WriteRun();
+}
+									/*}}}*/
+// GenContents::WriteRun - Write the collected paths as a sorted run	/*{{{*/
+// ---------------------------------------------------------------------
+/* To limit the number of open files the runs are merged into a single
+   one if there are too many of them. */
+bool GenContents::WriteRun()
+{
+   char const * const Paths = RunPaths.c_str();
+   std::sort(RunEntries.begin(), RunEntries.end(), [&](RunEntry const &A, RunEntry const &B) {
+      int const Res = strcmp(Paths + A.Path, Paths + B.Path);
+      return Res < 0 || (Res == 0 && A.Package < B.Package);
+   });
+
+   std::unique_ptr<FileFd> Run(GetTempFile("apt-ftparchive-contents"));
+   if (Run == nullptr)
+      return false;
+   RunWriter Writer(Run.get());
+   std::string Path;
+   for (auto const &E : RunEntries)
+   {
+      Path.assign(Paths + E.Path);
+      if (Writer.Write(Path, E.Package) == false)
+	 return false;
+   }
+   if (Writer.Finish() == false)
+      return false;
+   Runs.push_back(std::move(Run));
+   RunPaths.clear();
+   RunEntries.clear();
+
+   if (Runs.size() < 64)
+      return true;
+   std::unique_ptr<FileFd> Merged(GetTempFile("apt-ftparchive-contents"));
+   if (Merged == nullptr)
+      return false;
+   RunWriter MergeWriter(Merged.get());
+   if (MergeRuns([&](std::string const &Path, uint32_t const Package) {
+	    return MergeWriter.Write(Path, Package);
+	 }) == false || MergeWriter.Finish() == false)
+      return false;
+   Runs.push_back(std::move(Merged));
+   return true;
+}
+									/*}}}*/
+// GenContents::MergeRuns - Pass the entries of all runs sorted to Sink	/*{{{*/
+// ---------------------------------------------------------------------
+/* The runs are closed afterwards. */
+bool GenContents::MergeRuns(std::function<bool(std::string const &Path,uint32_t Package)> const &Sink)
+{
+   std::vector<std::unique_ptr<RunReader>> Readers;
+   auto const Greater = [](RunReader const * const A, RunReader const * const B) {
+      int const Res = A->Path.compare(B->Path);
+      return Res > 0 || (Res == 0 && A->Package > B->Package);
+   };
+   std::priority_queue<RunReader *, std::vector<RunReader *>, decltype(Greater)> Queue(Greater);
+   for (auto const &Run : Runs)
+   {
+      Readers.emplace_back(new RunReader(*Run));
+      if (Readers.back()->Next() == true)
+	 Queue.push(Readers.back().get());
+   }
+
+   bool Res = true;
+   while (Queue.empty() == false)
+   {
+      RunReader * const Top = Queue.top();
+      Queue.pop();
+      if (Sink(Top->Path, Top->Package) == false)
+      {
+	 Res = false;
+	 break;
+      }
+      if (Top->Next() == true)
+	 Queue.push(Top);
+   }
+   Readers.clear();
+   Runs.clear();
+   return Res && _error->PendingError() == false;
+}
+									/*}}}*/
+// GenContents::PrintRuns - Print the paths of the streaming mode	/*{{{*/
+// ---------------------------------------------------------------------
+/* Without any runs written the collected paths are printed directly. */
+bool GenContents::PrintRuns(FileFd &Out)
+{
+   std::string Current;
+   std::vector<uint32_t> Pkgs;
+   auto const Sink = [&](std::string const &Path, uint32_t const Package) {
+      if (Path != Current)
+      {
+	 if (Pkgs.empty() == false)
+	    PrintPath(Out, Current, Pkgs);
+	 Current = Path;
+	 Pkgs.clear();
+      }
+      Pkgs.push_back(Package);
+      return true;
+   };
+
+   if (Runs.empty() == true)
+   {
+      char const * const Paths = RunPaths.c_str();
+      std::sort(RunEntries.begin(), RunEntries.end(), [&](RunEntry const &A, RunEntry const &B) {
+	 int const Res = strcmp(Paths + A.Path, Paths + B.Path);
+	 return Res < 0 || (Res == 0 && A.Package < B.Package);
+      });
+      std::string Path;
+      for (auto const &E : RunEntries)
+      {
+	 Path.assign(Paths + E.Path);
+	 Sink(Path, E.Package);
+      }
+      RunPaths.clear();
+      RunEntries.clear();
+   }
+   else if ((RunEntries.empty() == false && WriteRun() == false) || MergeRuns(Sink) == false)
+      return false;
+
+   if (Pkgs.empty() == false)
+      PrintPath(Out, Current, Pkgs);
+   return true;
+}
+									/*}}}*/
+// GenContents::PrintPath - Print a path with its packages		/*{{{*/
+// ---------------------------------------------------------------------
+/* Pkgs is sorted in the order the packages were added. Like the tree
+   this lists the first package followed by the others from the last to
+   the second, each package name only once. */
+void GenContents::PrintPath(FileFd &Out,std::string const &Path,std::vector<uint32_t> const &Pkgs)
+{
+   std::vector<const char *> Names;
+   for (auto const P : Pkgs)
+   {
+      const char * const Name = Packages[P];
+      if (std::find_if(Names.begin(), Names.end(), [&](const char * const N) {
+	       return N == Name || strcasecmp(N, Name) == 0; }) == Names.end())
+	 Names.push_back(Name);
+   }
+
+   std::string out = Path;
+   WriteSpace(out, out.length(), 60);
+   out.append(Names.front());
+   for (auto N = Names.rbegin(); N + 1 != Names.rend(); ++N)
+   {
+      out.append(",");
+      out.append(*N);
+   }
+   out.append("\n");
+   Out.Write(out.c_str(), out.length());
+}
+									/*}}}*/
 // ContentsExtract Constructor						/*{{{*/
 ContentsExtract::ContentsExtract()
    : Data(0), MaxSize(0), CurSize(0)
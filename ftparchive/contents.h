@@ -12,9 +12,13 @@
 
 #include <apt-pkg/dirstream.h>
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <string>
 
 class debDebFile;
 class FileFd;
@@ -57,15 +61,37 @@ class GenContents
    Node *Grab(Node *Top,const char *Name,const char *Package);
    void WriteSpace(std::string &out, size_t Current, size_t Target);
    void DoPrint(FileFd &Out,Node *Top, char *Buf);
+
+   /* Instead of the tree the streaming mode collects the paths with the
+      number of their package and writes them sorted into temporary files
+      once MemoryLimit is reached, which are merged for printing */
+   unsigned long long MemoryLimit;
+   std::vector<const char *> Packages;
+   std::string RunPaths;
+   struct RunEntry
+   {
+      size_t Path;
+      uint32_t Package;
+   };
+   std::vector<RunEntry> RunEntries;
+   std::vector<std::unique_ptr<FileFd>> Runs;
+
+   void AddToRun(const char *Dir,const char *Package);
+   bool WriteRun();
+   bool MergeRuns(std::function<bool(std::string const &Path,uint32_t Package)> const &Sink);
+   bool PrintRuns(FileFd &Out);
+   void PrintPath(FileFd &Out,std::string const &Path,std::vector<uint32_t> const &Pkgs);
    
    public:
    
    char *Mystrdup(const char *From);
    void Add(const char *Dir,const char *Package);   
    void Print(FileFd &Out);
+   // Use the streaming mode with the given limit in bytes, 0 disables it
+   void SetMemoryLimit(unsigned long long const Limit) {MemoryLimit = Limit;};
 
    GenContents() : BlockList(0), StrPool(0), StrLeft(0), 
-                   NodePool(0), NodeLeft(0) {};
+                   NodePool(0), NodeLeft(0), MemoryLimit(0) {};
    ~GenContents();
 };
 
@@ -0,0 +1,565 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   LogDB
+
+   The log starts with a header followed by the records, each record is
+   the length of the key and of the value in network byte order followed
+   by the key and the value. The index is a hash table using linear
+   probing with the offsets of the current records in the log. It is
+   only valid for the log it was created for, up to the size it stores.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logdb.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+static char const LogMagic[8] = {'A','P','T','L','O','G','D','B'};
+static char const IndexMagic[8] = {'A','P','T','L','O','G','I','X'};
+enum {
+   FormatVersion = 1,
+   LogHeaderSize = 16,
+   RecordHeaderSize = 8,
+   MinBuckets = 1024,
+   // Size of the records collected before they are appended
+   BatchLimit = 4 * 1024 * 1024
+};
+
+struct LogDB::IndexHeader
+{
+   char Magic[8];
+   uint32_t Version;
+   uint32_t Buckets;
+   uint64_t LogInode;
+   uint64_t LogSize;
+   uint64_t Entries;
+};
+// An empty slot has an Offset of 0 as no record can start there
+struct LogDB::Slot
+{
+   uint32_t Hash;
+   uint32_t Unused;
+   uint64_t Offset;
+};
+
+static uint32_t HashKey(const char *Key, size_t Length)			/*{{{*/
+{
+   // FNV-1a
+   uint32_t Hash = 2166136261u;
+   for (; Length != 0; --Length, ++Key)
+   {
+      Hash ^= static_cast<unsigned char>(*Key);
+      Hash *= 16777619u;
+   }
+   return Hash;
+}
+									/*}}}*/
+// ReadRecord - Get key and value of the record at Offset		/*{{{*/
+// ---------------------------------------------------------------------
+/* Returns false if the record doesn't end before End */
+static bool ReadRecord(const char *Base, uint64_t const Offset, uint64_t const End,
+		       const char *&Key, uint32_t &KeyLength,
+		       const char *&Data, uint32_t &Length)
+{
+   if (Offset + RecordHeaderSize > End)
+      return false;
+   memcpy(&KeyLength, Base + Offset, sizeof(KeyLength));
+   memcpy(&Length, Base + Offset + sizeof(KeyLength), sizeof(Length));
+   KeyLength = ntohl(KeyLength);
+   Length = ntohl(Length);
+   if (Offset + RecordHeaderSize + KeyLength + Length > End)
+      return false;
+   Key = Base + Offset + RecordHeaderSize;
+   Data = Key + KeyLength;
+   return true;
+}
+									/*}}}*/
+
+LogDB::LogDB() : ReadOnly(true), LogMap(nullptr), LogMapSize(0), LogEnd(0),
+		 Index(nullptr), IndexSize(0)
+{
+   pthread_rwlock_init(&Lock, nullptr);
+}
+LogDB::~LogDB()
+{
+   Close();
+   pthread_rwlock_destroy(&Lock);
+}
+// LogDB::IsLogDB - Check for the magic of a log			/*{{{*/
+bool LogDB::IsLogDB(std::string const &File)
+{
+   int const Fd = open(File.c_str(), O_RDONLY | O_CLOEXEC);
+   if (Fd == -1)
+      return false;
+   char Magic[sizeof(LogMagic)];
+   bool const Res = read(Fd, Magic, sizeof(Magic)) == sizeof(Magic) &&
+      memcmp(Magic, LogMagic, sizeof(Magic)) == 0;
+   close(Fd);
+   return Res;
+}
+									/*}}}*/
+// LogDB::Open - Open or create the log and its index			/*{{{*/
+bool LogDB::Open(std::string const &File, bool const ReadOnly)
+{
+   Close();
+   this->File = File;
+   this->ReadOnly = ReadOnly;
+
+   if (Log.Open(File, ReadOnly ? FileFd::ReadOnly : (FileFd::ReadWrite | FileFd::Create), 0644) == false)
+      return false;
+
+   /* Readers only see the records appended before they opened the log,
+      but only one process at a time can append to it */
+   if (ReadOnly == false && flock(Log.Fd(), LOCK_EX | LOCK_NB) != 0)
+   {
+      _error->Errno("flock", _("Unable to lock the DB file %s"), File.c_str());
+      Log.Close();
+      return false;
+   }
+
+   char Header[LogHeaderSize];
+   memset(Header, 0, sizeof(Header));
+   if (Log.Size() == 0 && ReadOnly == false)
+   {
+      uint32_t const Version = htonl(FormatVersion);
+      memcpy(Header, LogMagic, sizeof(LogMagic));
+      memcpy(Header + sizeof(LogMagic), &Version, sizeof(Version));
+      if (Log.Write(Header, sizeof(Header)) == false)
+      {
+	 Log.Close();
+	 return false;
+      }
+   }
+   else
+   {
+      uint32_t Version = 0;
+      if (Log.Read(Header, sizeof(Header)) == true)
+	 memcpy(&Version, Header + sizeof(LogMagic), sizeof(Version));
+      if (memcmp(Header, LogMagic, sizeof(LogMagic)) != 0 || ntohl(Version) != FormatVersion)
+      {
+	 Log.Close();
+	 return _error->Error(_("DB format is invalid. If you upgraded from an older version of apt, please remove and re-create the database."));
+      }
+   }
+
+   LogEnd = LogHeaderSize;
+   if (MapLog() == false || MapIndex(MinBuckets, true) == false || Scan() == false)
+   {
+      Close();
+      return false;
+   }
+   return true;
+}
+									/*}}}*/
+// LogDB::Close - Append the batch and unmap everything			/*{{{*/
+bool LogDB::Close()
+{
+   if (Log.IsOpen() == false)
+      return true;
+
+   pthread_rwlock_wrlock(&Lock);
+   bool Res = true;
+   if (ReadOnly == false)
+      Res = FlushLocked();
+   UnmapIndex();
+   if (LogMap != nullptr)
+      munmap(LogMap, LogMapSize);
+   LogMap = nullptr;
+   LogMapSize = 0;
+   LogEnd = 0;
+   Batch.clear();
+   BatchIndex.clear();
+   Res &= Log.Close();
+   pthread_rwlock_unlock(&Lock);
+   return Res;
+}
+									/*}}}*/
+// LogDB::MapLog - (Re)map the log with its current size		/*{{{*/
+bool LogDB::MapLog()
+{
+   struct stat St;
+   if (fstat(Log.Fd(), &St) != 0)
+      return _error->Errno("fstat", _("Failed to stat %s"), File.c_str());
+   if (LogMap != nullptr)
+      munmap(LogMap, LogMapSize);
+   LogMapSize = St.st_size;
+   void * const Map = mmap(nullptr, LogMapSize, PROT_READ, MAP_SHARED, Log.Fd(), 0);
+   if (Map == MAP_FAILED)
+   {
+      LogMap = nullptr;
+      LogMapSize = 0;
+      return _error->Errno("mmap", _("Couldn't make mmap of %llu bytes"), (unsigned long long) St.st_size);
+   }
+   LogMap = static_cast<char *>(Map);
+   return true;
+}
+									/*}}}*/
+// LogDB::MapIndex - Map the existing index or create a new one		/*{{{*/
+// ---------------------------------------------------------------------
+/* The index file is only changed if the log can be changed, readers
+   either work on a private copy of it or build one in memory. */
+bool LogDB::MapIndex(uint32_t const Buckets, bool const Reuse)
+{
+   std::string const IndexFile = File + ".idx";
+   struct stat LogSt;
+   if (fstat(Log.Fd(), &LogSt) != 0)
+      return _error->Errno("fstat", _("Failed to stat %s"), File.c_str());
+
+   if (Reuse == true)
+   {
+      int const Fd = open(IndexFile.c_str(), (ReadOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+      struct stat St;
+      if (Fd != -1 && fstat(Fd, &St) == 0 && St.st_size >= (off_t) sizeof(IndexHeader))
+      {
+	 void * const Map = mmap(nullptr, St.st_size, PROT_READ | PROT_WRITE,
+				 ReadOnly ? MAP_PRIVATE : MAP_SHARED, Fd, 0);
+	 if (Map != MAP_FAILED)
+	 {
+	    IndexHeader const * const H = static_cast<IndexHeader *>(Map);
+	    if (memcmp(H->Magic, IndexMagic, sizeof(IndexMagic)) == 0 &&
+		H->Version == FormatVersion && H->LogInode == (uint64_t) LogSt.st_ino &&
+		H->Buckets >= MinBuckets && (H->Buckets & (H->Buckets - 1)) == 0 &&
+		(uint64_t) St.st_size == sizeof(IndexHeader) + H->Buckets * sizeof(Slot) &&
+		H->LogSize >= LogHeaderSize && H->LogSize <= (uint64_t) LogSt.st_size)
+	    {
+	       close(Fd);
+	       UnmapIndex();
+	       Index = static_cast<IndexHeader *>(Map);
+	       IndexSize = St.st_size;
+	       LogEnd = Index->LogSize;
+	       return true;
+	    }
+	    munmap(Map, St.st_size);
+	 }
+      }
+      if (Fd != -1)
+	 close(Fd);
+   }
+
+   size_t const Size = sizeof(IndexHeader) + Buckets * sizeof(Slot);
+   void *Map;
+   if (ReadOnly == true)
+      Map = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   else
+   {
+      // the old index stays mapped until all its entries are moved
+      unlink(IndexFile.c_str());
+      int const Fd = open(IndexFile.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if (Fd == -1)
+	 return _error->Errno("open", _("Could not open file %s"), IndexFile.c_str());
+      if (ftruncate(Fd, Size) != 0)
+      {
+	 close(Fd);
+	 return _error->Errno("ftruncate", _("Unable to truncate %s"), IndexFile.c_str());
+      }
+      Map = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+      close(Fd);
+   }
+   if (Map == MAP_FAILED)
+      return _error->Errno("mmap", _("Couldn't make mmap of %llu bytes"), (unsigned long long) Size);
+
+   IndexHeader * const New = static_cast<IndexHeader *>(Map);
+   New->Version = FormatVersion;
+   New->Buckets = Buckets;
+   New->LogInode = LogSt.st_ino;
+   New->LogSize = LogEnd;
+   New->Entries = 0;
+
+   // A grown index gets the entries of the old one, otherwise the log is scanned
+   IndexHeader * const Old = Index;
+   if (Reuse == false && Old != nullptr)
+   {
+      Slot const * const OldSlots = reinterpret_cast<Slot *>(Old + 1);
+      Slot * const NewSlots = reinterpret_cast<Slot *>(New + 1);
+      for (uint32_t I = 0; I != Old->Buckets; ++I)
+      {
+	 if (OldSlots[I].Offset == 0)
+	    continue;
+	 uint32_t B = OldSlots[I].Hash & (Buckets - 1);
+	 while (NewSlots[B].Offset != 0)
+	    B = (B + 1) & (Buckets - 1);
+	 NewSlots[B] = OldSlots[I];
+      }
+      New->Entries = Old->Entries;
+      New->LogSize = Old->LogSize;
+   }
+   else
+      New->LogSize = LogHeaderSize;
+   UnmapIndex();
+   Index = New;
+   IndexSize = Size;
+   // a crash before this point leaves an index which isn't used again
+   memcpy(New->Magic, IndexMagic, sizeof(IndexMagic));
+   return true;
+}
+									/*}}}*/
+void LogDB::UnmapIndex()						/*{{{*/
+{
+   if (Index == nullptr)
+      return;
+   if (ReadOnly == false)
+      msync(Index, IndexSize, MS_ASYNC);
+   munmap(Index, IndexSize);
+   Index = nullptr;
+   IndexSize = 0;
+}
+									/*}}}*/
+// LogDB::Insert - Point the index entry of a key to a new record	/*{{{*/
+bool LogDB::Insert(uint32_t const Hash, uint64_t const Offset)
+{
+   if ((Index->Entries + 1) * 2 > Index->Buckets &&
+       MapIndex(Index->Buckets * 2, false) == false)
+      return false;
+
+   const char *Key, *Data;
+   uint32_t KeyLength, Length;
+   if (ReadRecord(LogMap, Offset, LogMapSize, Key, KeyLength, Data, Length) == false)
+      return _error->Error(_("DB file %s is corrupted"), File.c_str());
+
+   uint32_t const Mask = Index->Buckets - 1;
+   Slot * const Slots = reinterpret_cast<Slot *>(Index + 1);
+   for (uint32_t B = Hash & Mask;; B = (B + 1) & Mask)
+   {
+      Slot &S = Slots[B];
+      if (S.Offset == 0)
+      {
+	 S.Hash = Hash;
+	 S.Offset = Offset;
+	 ++Index->Entries;
+	 return true;
+      }
+      const char *OldKey, *OldData;
+      uint32_t OldKeyLength, OldLength;
+      if (S.Hash == Hash &&
+	  ReadRecord(LogMap, S.Offset, LogMapSize, OldKey, OldKeyLength, OldData, OldLength) == true &&
+	  OldKeyLength == KeyLength && memcmp(OldKey, Key, KeyLength) == 0)
+      {
+	 S.Offset = Offset;
+	 return true;
+      }
+   }
+}
+									/*}}}*/
+// LogDB::Scan - Add the records missing in the index			/*{{{*/
+// ---------------------------------------------------------------------
+/* A record which was only partly written is dropped */
+bool LogDB::Scan()
+{
+   uint64_t Offset = LogEnd;
+   const char *Key, *Data;
+   uint32_t KeyLength, Length;
+   while (ReadRecord(LogMap, Offset, LogMapSize, Key, KeyLength, Data, Length) == true)
+   {
+      if (Insert(HashKey(Key, KeyLength), Offset) == false)
+	 return false;
+      Offset += RecordHeaderSize + KeyLength + Length;
+   }
+   if (Offset != LogMapSize && ReadOnly == false)
+   {
+      _error->Warning(_("DB file %s is corrupted, dropping %llu bytes at its end"), File.c_str(),
+		      (unsigned long long) (LogMapSize - Offset));
+      if (Log.Truncate(Offset) == false)
+	 return false;
+   }
+   LogEnd = Offset;
+   if (ReadOnly == false)
+      Index->LogSize = LogEnd;
+   return true;
+}
+									/*}}}*/
+// LogDB::Find - Find the current value of a key in the log		/*{{{*/
+const char *LogDB::Find(const char *Key, size_t const KeyLength, uint32_t &Length)
+{
+   uint32_t const Hash = HashKey(Key, KeyLength);
+   uint32_t const Mask = Index->Buckets - 1;
+   Slot const * const Slots = reinterpret_cast<Slot *>(Index + 1);
+   for (uint32_t B = Hash & Mask; Slots[B].Offset != 0; B = (B + 1) & Mask)
+   {
+      if (Slots[B].Hash != Hash)
+	 continue;
+      const char *RecKey, *Data;
+      uint32_t RecKeyLength;
+      if (ReadRecord(LogMap, Slots[B].Offset, LogEnd, RecKey, RecKeyLength, Data, Length) == true &&
+	  RecKeyLength == KeyLength && memcmp(RecKey, Key, KeyLength) == 0)
+	 return Data;
+   }
+   return nullptr;
+}
+									/*}}}*/
+// LogDB::Get - Copy the current value of a key				/*{{{*/
+bool LogDB::Get(const void *Key, size_t const KeyLength, std::string &Data)
+{
+   pthread_rwlock_rdlock(&Lock);
+   bool Found = false;
+   if (LogMap != nullptr)
+   {
+      auto const B = BatchIndex.find(std::string(static_cast<const char *>(Key), KeyLength));
+      const char *Value = nullptr;
+      uint32_t Length;
+      if (B != BatchIndex.end())
+      {
+	 const char *RecKey;
+	 uint32_t RecKeyLength;
+	 ReadRecord(Batch.data(), B->second, Batch.size(), RecKey, RecKeyLength, Value, Length);
+      }
+      else
+	 Value = Find(static_cast<const char *>(Key), KeyLength, Length);
+      if (Value != nullptr)
+      {
+	 Data.assign(Value, Length);
+	 Found = true;
+      }
+   }
+   pthread_rwlock_unlock(&Lock);
+   return Found;
+}
+									/*}}}*/
+// LogDB::Put - Collect a new value for a key				/*{{{*/
+bool LogDB::Put(const void *Key, size_t const KeyLength, const void *Data, size_t const Length)
+{
+   if (ReadOnly == true || LogMap == nullptr)
+      return _error->Error(_("DB file %s can't be changed"), File.c_str());
+
+   pthread_rwlock_wrlock(&Lock);
+   uint32_t const Header[2] = { htonl(KeyLength), htonl(Length) };
+   uint64_t const Offset = Batch.size();
+   Batch.append(reinterpret_cast<const char *>(Header), sizeof(Header));
+   Batch.append(static_cast<const char *>(Key), KeyLength);
+   Batch.append(static_cast<const char *>(Data), Length);
+   BatchIndex[std::string(static_cast<const char *>(Key), KeyLength)] = Offset;
+   bool Res = true;
+   if (Batch.size() >= BatchLimit)
+      Res = FlushLocked();
+   pthread_rwlock_unlock(&Lock);
+   return Res;
+}
+									/*}}}*/
+// LogDB::Flush - Append the collected records to the log		/*{{{*/
+bool LogDB::Flush()
+{
+   pthread_rwlock_wrlock(&Lock);
+   bool const Res = FlushLocked();
+   pthread_rwlock_unlock(&Lock);
+   return Res;
+}
+bool LogDB::FlushLocked()
+{
+   if (Batch.empty() == true)
+      return true;
+
+   if (Log.Seek(LogEnd) == false || Log.Write(Batch.data(), Batch.size()) == false)
+   {
+      // don't leave a partial record around for the next append
+      Log.Truncate(LogEnd);
+      return false;
+   }
+   uint64_t const Start = LogEnd;
+   if (MapLog() == false)
+      return false;
+
+   const char *Key, *Data;
+   uint32_t KeyLength, Length;
+   for (uint64_t Offset = 0;
+	ReadRecord(Batch.data(), Offset, Batch.size(), Key, KeyLength, Data, Length) == true;
+	Offset += RecordHeaderSize + KeyLength + Length)
+      if (Insert(HashKey(Key, KeyLength), Start + Offset) == false)
+	 return false;
+
+   LogEnd += Batch.size();
+   Index->LogSize = LogEnd;
+   Batch.clear();
+   BatchIndex.clear();
+   return true;
+}
+									/*}}}*/
+// LogDB::ForEach - Visit the current value of each key			/*{{{*/
+bool LogDB::ForEach(std::function<bool(const char *Key, size_t KeyLength,
+	 const char *Data, size_t Length)> const &Visit)
+{
+   pthread_rwlock_wrlock(&Lock);
+   if (LogMap == nullptr || (ReadOnly == false && FlushLocked() == false))
+   {
+      pthread_rwlock_unlock(&Lock);
+      return false;
+   }
+
+   std::vector<uint64_t> Offsets;
+   Offsets.reserve(Index->Entries);
+   Slot const * const Slots = reinterpret_cast<Slot *>(Index + 1);
+   for (uint32_t B = 0; B != Index->Buckets; ++B)
+      if (Slots[B].Offset != 0)
+	 Offsets.push_back(Slots[B].Offset);
+   std::sort(Offsets.begin(), Offsets.end());
+
+   bool Res = true;
+   for (auto const Offset : Offsets)
+   {
+      const char *Key, *Data;
+      uint32_t KeyLength, Length;
+      if (ReadRecord(LogMap, Offset, LogEnd, Key, KeyLength, Data, Length) == false)
+	 continue;
+      if (Visit(Key, KeyLength, Data, Length) == false)
+      {
+	 Res = false;
+	 break;
+      }
+   }
+   pthread_rwlock_unlock(&Lock);
+   return Res;
+}
+									/*}}}*/
+// LogDB::Compact - Replace the log by one with only the kept records	/*{{{*/
+bool LogDB::Compact(std::function<bool(const char *Key, size_t KeyLength)> const &Keep)
+{
+   if (ReadOnly == true || LogMap == nullptr)
+      return _error->Error(_("DB file %s can't be changed"), File.c_str());
+
+   std::string const Name = File;
+   std::string const Tmp = File + ".new";
+   RemoveFile("LogDB::Compact", Tmp);
+   RemoveFile("LogDB::Compact", Tmp + ".idx");
+   {
+      LogDB New;
+      if (New.Open(Tmp, false) == false)
+	 return false;
+      bool const Res = ForEach([&](const char *Key, size_t KeyLength, const char *Data, size_t Length) {
+	 return Keep(Key, KeyLength) == false || New.Put(Key, KeyLength, Data, Length) == true;
+      });
+      if (New.Close() == false || Res == false)
+      {
+	 RemoveFile("LogDB::Compact", Tmp);
+	 RemoveFile("LogDB::Compact", Tmp + ".idx");
+	 return false;
+      }
+   }
+
+   Close();
+   if (rename(Tmp.c_str(), Name.c_str()) != 0)
+      _error->Errno("rename", _("Failed to rename %s to %s"), Tmp.c_str(), Name.c_str());
+   else if (rename((Tmp + ".idx").c_str(), (Name + ".idx").c_str()) != 0)
+      RemoveFile("LogDB::Compact", Name + ".idx");
+   return Open(Name, false);
+}
+									/*}}}*/
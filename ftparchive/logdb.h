@@ -0,0 +1,86 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   LogDB
+
+   An append-only key/value store used as an alternative to Berkeley DB
+   for the CacheDB. New values are collected in memory and appended in
+   batches to a log file; the current value of each key is found via a
+   hash index in the <file>.idx which is mapped into memory. The index
+   can always be recreated from the log, so it is rebuilt if it is
+   missing or doesn't belong to the log. Values replaced by later ones
+   stay in the log until it is compacted.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef LOGDB_H
+#define LOGDB_H
+
+#include <apt-pkg/fileutl.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+class LogDB
+{
+   struct IndexHeader;
+   struct Slot;
+
+   std::string File;
+   bool ReadOnly;
+   FileFd Log;
+
+   // The mapped log, records start after the header up to LogEnd
+   char *LogMap;
+   uint64_t LogMapSize;
+   uint64_t LogEnd;
+
+   // The index is mapped from the .idx file or from anonymous memory
+   IndexHeader *Index;
+   size_t IndexSize;
+
+   // Records which are not appended yet, offsets point into Batch
+   std::string Batch;
+   std::unordered_map<std::string, uint64_t> BatchIndex;
+
+   // Readers only need a shared lock, writers an exclusive one
+   pthread_rwlock_t Lock;
+
+   bool MapLog();
+   bool MapIndex(uint32_t const Buckets, bool const Reuse);
+   void UnmapIndex();
+   bool Insert(uint32_t const Hash, uint64_t const Offset);
+   bool Scan();
+   const char *Find(const char *Key, size_t const KeyLength, uint32_t &Length);
+   bool FlushLocked();
+
+   public:
+
+   // Check if the given file is a LogDB
+   static bool IsLogDB(std::string const &File);
+
+   bool Open(std::string const &File, bool const ReadOnly);
+   bool Close();
+   inline bool IsOpen() const { return LogMap != nullptr; };
+
+   bool Get(const void *Key, size_t const KeyLength, std::string &Data);
+   bool Put(const void *Key, size_t const KeyLength, const void *Data, size_t const Length);
+   // Append the collected records to the log
+   bool Flush();
+
+   // Call Visit with the current value of each key in the order of the log
+   bool ForEach(std::function<bool(const char *Key, size_t KeyLength,
+	    const char *Data, size_t Length)> const &Visit);
+   // Rewrite the log with only the current values of the keys Keep agrees on
+   bool Compact(std::function<bool(const char *Key, size_t KeyLength)> const &Keep);
+
+   LogDB();
+   ~LogDB();
+};
+
+#endif
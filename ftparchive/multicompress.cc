@@ -7,7 +7,7 @@
 
    This class is very complicated in order to optimize for the common
    case of its use, writing a large set of compressed files that are 
-   different from the old set. It spawns off compressors in parallel
+   different from the old set. It runs the compressors in parallel
    to maximize compression throughput and has a separate task managing
    the data going into the compressors.
    
@@ -16,20 +16,32 @@
 // Include Files							/*{{{*/
 #include <config.h>
 
+#include <apt-pkg/configuration.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/md5.h>
 #include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/hashsum_template.h>
+#include <apt-pkg/hashes.h>
 
+#include <condition_variable>
 #include <ctype.h>
+#include <dirent.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdlib.h>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "checksums.h"
 #include "multicompress.h"
 #include <apti18n.h>
 									/*}}}*/
@@ -82,18 +94,26 @@ MultiCompress::MultiCompress(string const &Output,string const &Compress,
       
       struct stat St;
       if (stat(NewOut->Output.c_str(),&St) == 0)
+      {
 	 NewOut->OldMTime = St.st_mtime;
+	 NewOut->OldIno = St.st_ino;
+      }
       else
+      {
 	 NewOut->OldMTime = 0;
+	 NewOut->OldIno = 0;
+      }
    }
    
    if (Write == false)
        return;
        
    /* Open all the temp files now so we can report any errors. File is 
-      made unreable to prevent people from touching it during creating. */
+      made unreable to prevent people from touching it during creating.
+      Only the child compresses into them, closing a compressor here
+      would append an empty stream to what the child wrote. */
    for (Files *I = Outputs; I != 0; I = I->Next)
-      I->TmpFile.Open(I->Output + ".new", FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Extension, 0600);
+      I->TmpFile.Open(I->Output + ".new", FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::None, 0600);
    if (_error->PendingError() == true)
       return;
 
@@ -159,6 +179,38 @@ bool MultiCompress::GetStat(string const &Output,string const &Compress,struct s
    return DidStat;
 }
 									/*}}}*/
+// CloseOtherFds - Close all descriptors the writer child doesn't use	/*{{{*/
+// ---------------------------------------------------------------------
+/* The child inherits every descriptor of the parent, including the input
+   pipes of the writer children of other MultiCompress instances, which
+   might be created concurrently by other threads. Holding on to them would
+   keep these children from ever seeing the end of their input. */
+static void CloseOtherFds(std::set<int> const &KeepFDs)
+{
+   std::vector<int> Close;
+   DIR *dir = opendir("/proc/self/fd");
+   if (dir != NULL)
+   {
+      struct dirent *ent;
+      while ((ent = readdir(dir)))
+      {
+	 int const fd = atoi(ent->d_name);
+	 if (fd >= 3 && fd != dirfd(dir) && KeepFDs.find(fd) == KeepFDs.end())
+	    Close.push_back(fd);
+      }
+      closedir(dir);
+   }
+   else
+   {
+      long const ScOpenMax = sysconf(_SC_OPEN_MAX);
+      for (int K = 3; K < ScOpenMax; ++K)
+	 if (KeepFDs.find(K) == KeepFDs.end())
+	    Close.push_back(K);
+   }
+   for (auto const fd : Close)
+      close(fd);
+}
+									/*}}}*/
 // MultiCompress::Start - Start up the writer child			/*{{{*/
 // ---------------------------------------------------------------------
 /* Fork a child and setup the communication pipe. */
@@ -176,6 +228,11 @@ bool MultiCompress::Start()
    if (Outputter == 0)
    {
       close(Pipe[1]);
+      std::set<int> KeepFDs;
+      KeepFDs.insert(Pipe[0]);
+      for (Files *I = Outputs; I != 0; I = I->Next)
+	 KeepFDs.insert(I->TmpFile.Fd());
+      CloseOtherFds(KeepFDs);
       Child(Pipe[0]);
       if (_error->PendingError() == true)
       {
@@ -220,7 +277,8 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
    time_t Now;
    time(&Now);
    
-   // Check the mtimes to see if the files were replaced.
+   /* Check the mtimes to see if the files were replaced. A file replaced
+      within the same second keeps its mtime, but not its inode. */
    bool Changed = false;
    for (Files *I = Outputs; I != 0; I = I->Next)
    {
@@ -229,7 +287,7 @@ bool MultiCompress::Finalize(unsigned long long &OutSize)
 	 return  _error->Error(_("Internal error, failed to create %s"),
 			       I->Output.c_str());
       
-      if (I->OldMTime != St.st_mtime)
+      if (I->OldMTime != St.st_mtime || I->OldIno != St.st_ino)
 	 Changed = true;
       else
       {
@@ -269,43 +327,147 @@ bool MultiCompress::OpenOld(FileFd &Fd)
    return Fd.Open(Best->Output, FileFd::ReadOnly, FileFd::Extension);
 }
 									/*}}}*/
-// MultiCompress::Child - The writer child				/*{{{*/
+// MultiCompress::Feed - Pass the input to all outputs			/*{{{*/
 // ---------------------------------------------------------------------
-/* The child process forks a bunch of compression children and takes 
-   input on FD and passes it to all the compressor child. On the way it
-   computes the MD5 of the raw data. After this the raw data in the 
-   original files is compared to see if this data is new. If the data
-   is new then the temp files are renamed, otherwise they are erased. */
-bool MultiCompress::Child(int const &FD)
+/* Each output is written by its own thread, so the compressors run in
+   parallel and the slowest one determines how long it takes instead of
+   the sum of all of them. The threads take the data from a ring of
+   blocks, a block is only refilled from FD after all of them wrote it. */
+bool MultiCompress::Feed(int const &FD, MD5Summation &MD5, unsigned long long &FileSize)
 {
-   /* Okay, now we just feed data from FD to all the other FDs. Also
-      stash a hash of the data to use later. */
-   SetNonBlock(FD,false);
-   unsigned char Buffer[32*1024];
-   unsigned long long FileSize = 0;
-   MD5Summation MD5;
+   enum { BlockSize = 64*1024, RingSize = 32 };
+   struct Block
+   {
+      unsigned char Data[BlockSize];
+      size_t Size;
+   };
+   std::unique_ptr<Block[]> Ring(new Block[RingSize]);
+
+   struct Writer
+   {
+      Files *Output;
+      unsigned long long Done;
+      std::vector<std::pair<bool, std::string>> Errors;
+   };
+   std::vector<Writer> Writers;
+   for (Files *I = Outputs; I != 0; I = I->Next)
+   {
+      if (I->Writer.OpenDescriptor(dup(I->TmpFile.Fd()), FileFd::WriteOnly, I->CompressProg, true) == false)
+	 return false;
+      Writers.push_back({I, 0, {}});
+   }
+
+   std::mutex Lock;
+   std::condition_variable Filled;
+   std::condition_variable Emptied;
+   unsigned long long Produced = 0;
+   bool Eof = false;
+
+   auto const Write = [&](Writer &W) {
+      bool Failed = false;
+      std::unique_lock<std::mutex> Guard(Lock);
+      while (true)
+      {
+	 Filled.wait(Guard, [&]() { return W.Done != Produced || Eof == true; });
+	 if (W.Done == Produced)
+	    break;
+	 Block const &B = Ring[W.Done % RingSize];
+	 Guard.unlock();
+	 // after a failure the data is dropped to not block the others
+	 if (Failed == false && W.Output->Writer.Write(B.Data, B.Size) == false)
+	 {
+	    _error->Errno("write",_("IO to subprocess/file failed"));
+	    Failed = true;
+	 }
+	 Guard.lock();
+	 ++W.Done;
+	 Emptied.notify_one();
+      }
+      Guard.unlock();
+      if (Failed == false && W.Output->Writer.Close() == false)
+	 _error->Errno("write",_("IO to subprocess/file failed"));
+
+      std::string Msg;
+      while (_error->empty() == false)
+      {
+	 bool const Type = _error->PopMessage(Msg);
+	 W.Errors.emplace_back(Type, Msg);
+      }
+   };
+   std::vector<std::thread> Threads;
+   for (auto &W : Writers)
+      Threads.emplace_back(Write, std::ref(W));
+
    while (1)
    {
+      {
+	 std::unique_lock<std::mutex> Guard(Lock);
+	 Emptied.wait(Guard, [&]() {
+	    for (auto const &W : Writers)
+	       if (Produced - W.Done >= RingSize)
+		  return false;
+	    return true;
+	 });
+      }
+
+      // Nobody uses this block until it is announced
+      Block &B = Ring[Produced % RingSize];
       WaitFd(FD,false);
-      int Res = read(FD,Buffer,sizeof(Buffer));
+      ssize_t Res = read(FD,B.Data,sizeof(B.Data));
       if (Res == 0)
 	 break;
       if (Res < 0)
 	 continue;
 
-      MD5.Add(Buffer,Res);
+      MD5.Add(B.Data,Res);
       FileSize += Res;
-      for (Files *I = Outputs; I != 0; I = I->Next)
+      B.Size = Res;
+      {
+	 std::lock_guard<std::mutex> Guard(Lock);
+	 ++Produced;
+      }
+      Filled.notify_all();
+   }
+
+   {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Eof = true;
+   }
+   Filled.notify_all();
+   for (auto &T : Threads)
+      T.join();
+
+   bool Res = true;
+   for (auto const &W : Writers)
+      for (auto const &E : W.Errors)
       {
-	 if (I->TmpFile.Write(Buffer, Res) == false)
+	 if (E.first == true)
 	 {
-	    _error->Errno("write",_("IO to subprocess/file failed"));
-	    break;
+	    _error->Error("%s", E.second.c_str());
+	    Res = false;
 	 }
-      }      
-   }   
-
-   if (_error->PendingError() == true)
+	 else
+	    _error->Warning("%s", E.second.c_str());
+      }
+   return Res;
+}
+									/*}}}*/
+// MultiCompress::Child - The writer child				/*{{{*/
+// ---------------------------------------------------------------------
+/* The child process takes input on FD and passes it to all the 
+   compressors. On the way it computes the MD5 of the raw data. After
+   this the raw data in the original files is compared to see if this
+   data is new. If the data is new then the temp files are renamed,
+   otherwise they are erased. */
+bool MultiCompress::Child(int const &FD)
+{
+   /* Okay, now we just feed data from FD to all the other FDs. Also
+      stash a hash of the data to use later. */
+   SetNonBlock(FD,false);
+   unsigned char Buffer[32*1024];
+   unsigned long long FileSize = 0;
+   MD5Summation MD5;
+   if (Feed(FD, MD5, FileSize) == false || _error->PendingError() == true)
       return false;
    
    /* Now we have to copy the files over, or erase them if they
@@ -354,7 +516,9 @@ bool MultiCompress::Child(int const &FD)
 	    I->TmpFile.Close();
 	    RemoveFile("MultiCompress::Child", I->TmpFile.Name());
 	 }
-	 return !_error->PendingError();
+	 if (_error->PendingError() == true)
+	    return false;
+	 return RecordChecksums();
       }      
       break;
    }
@@ -371,7 +535,46 @@ bool MultiCompress::Child(int const &FD)
       I->TmpFile.Close();
    }
    
-   return !_error->PendingError();
+   if (_error->PendingError() == true)
+      return false;
+   return RecordChecksums();
+}
+									/*}}}*/
+// MultiCompress::RecordChecksums - Note the checksums of the outputs	/*{{{*/
+// ---------------------------------------------------------------------
+/* If asked for, the checksums of the outputs are recorded in the manifest
+   of their directory for the release command. Outputs which weren't
+   replaced are usually in there already, the others are hashed in
+   parallel while they are still in the page cache. */
+bool MultiCompress::RecordChecksums()
+{
+   if (_config->FindB("APT::FTPArchive::RecordChecksums", false) == false)
+      return true;
+
+   ChecksumsManifest Manifest;
+   if (Manifest.Load(flNotFile(Outputs->Output)) == false)
+      return false;
+
+   std::vector<string> Names;
+   std::vector<string> Paths;
+   for (Files *I = Outputs; I != 0; I = I->Next)
+   {
+      HashStringList Sums;
+      string const Name = flNotDir(I->Output);
+      if (Manifest.Find(Name, ~0, Sums) == true)
+	 continue;
+      Names.push_back(Name);
+      Paths.push_back(I->Output);
+   }
+   if (Paths.empty() == true)
+      return true;
+
+   if (ChecksumsManifest::Calculate(Paths, ~0, Paths.size(),
+	    [&](size_t const I, HashStringList const &Sums) {
+	       return Sums.empty() == false && Manifest.Add(Names[I], Sums) == true;
+	    }) == false)
+      return false;
+   return Manifest.Save();
 }
 									/*}}}*/
 
@@ -24,6 +24,8 @@
 #include <sys/types.h>
 #include <time.h>
 
+class MD5Summation;
+
 class MultiCompress
 {
    // An output file
@@ -33,8 +35,11 @@ class MultiCompress
       APT::Configuration::Compressor CompressProg;
       Files *Next;
       FileFd TmpFile;
+      // The child compresses into the TmpFile with this
+      FileFd Writer;
       pid_t CompressProc;
       time_t OldMTime;
+      ino_t OldIno;
    };
    
    Files *Outputs;
@@ -42,6 +47,8 @@ class MultiCompress
    mode_t Permissions;
 
    bool Child(int const &Fd);
+   bool Feed(int const &Fd, MD5Summation &MD5, unsigned long long &FileSize);
+   bool RecordChecksums();
    bool Start();
    bool Die();
    
@@ -0,0 +1,454 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff Writer - Creates the patches used by pkgAcqDiffIndex
+
+   The diff works in two passes: Between two versions of an index most
+   stanzas are unchanged, so the versions are compared stanza by stanza
+   first and only the changed stanzas are then compared line by line.
+   Both passes use the O(ND) algorithm of Myers which is fast as long as
+   there are only a few differences – with lots of differences clients
+   are better off downloading the complete index anyhow, so in that case
+   no patch is created and the patch history is restarted.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <config.h>
+
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/sha2.h>
+#include <apt-pkg/strutl.h>
+#include <apt-pkg/tagfile.h>
+
+#include <algorithm>
+#include <locale>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "multicompress.h"
+#include "pdiff.h"
+
+#include <apti18n.h>
+									/*}}}*/
+
+using std::string;
+
+namespace {
+// Text - An index split into lines and stanzas				/*{{{*/
+struct Text
+{
+   string Data;
+   // offsets of the start of each line and of the end of the data
+   std::vector<size_t> Lines;
+   // the first line of each stanza and the number of lines at the end
+   std::vector<size_t> Stanzas;
+   std::vector<uint64_t> StanzaHashes;
+
+   size_t LineCount() const { return Lines.size() - 1; }
+   size_t StanzaCount() const { return Stanzas.size() - 1; }
+   char const *Line(size_t const I) const { return Data.c_str() + Lines[I]; }
+   size_t LineLength(size_t const I) const { return Lines[I + 1] - Lines[I]; }
+
+   bool Read(FileFd &Fd)
+   {
+      char Buffer[64 * 1024];
+      unsigned long long Actual = 0;
+      while (Fd.Read(Buffer, sizeof(Buffer), &Actual) == true && Actual != 0)
+	 Data.append(Buffer, Actual);
+      if (Fd.Failed() == true)
+	 return false;
+
+      bool Blank = true;
+      for (size_t Pos = 0; Pos < Data.size();)
+      {
+	 char const * const End = static_cast<char const *>(memchr(Data.c_str() + Pos, '\n', Data.size() - Pos));
+	 size_t const Next = (End == nullptr) ? Data.size() : (End - Data.c_str() + 1);
+	 // a stanza includes the blank lines following it
+	 bool const ThisBlank = (Next - Pos == 1);
+	 if (Blank == true && ThisBlank == false)
+	    Stanzas.push_back(Lines.size());
+	 else if (Stanzas.empty() == true)
+	    Stanzas.push_back(0);
+	 Blank = ThisBlank;
+	 Lines.push_back(Pos);
+	 Pos = Next;
+      }
+      Lines.push_back(Data.size());
+      Stanzas.push_back(LineCount());
+
+      // FNV-1a, just to avoid comparing most stanzas byte by byte
+      StanzaHashes.reserve(StanzaCount());
+      for (size_t S = 0; S < StanzaCount(); ++S)
+      {
+	 uint64_t Hash = 14695981039346656037ull;
+	 for (size_t I = Lines[Stanzas[S]]; I < Lines[Stanzas[S + 1]]; ++I)
+	    Hash = (Hash ^ static_cast<unsigned char>(Data[I])) * 1099511628211ull;
+	 StanzaHashes.push_back(Hash);
+      }
+      return true;
+   }
+
+   bool StanzaEqual(size_t const S, Text const &Other, size_t const O) const
+   {
+      size_t const Start = Lines[Stanzas[S]], Length = Lines[Stanzas[S + 1]] - Start;
+      size_t const OStart = Other.Lines[Other.Stanzas[O]];
+      return StanzaHashes[S] == Other.StanzaHashes[O] &&
+	 Length == Other.Lines[Other.Stanzas[O + 1]] - OStart &&
+	 memcmp(Data.c_str() + Start, Other.Data.c_str() + OStart, Length) == 0;
+   }
+
+   bool LineEqual(size_t const I, Text const &Other, size_t const O) const
+   {
+      return LineLength(I) == Other.LineLength(O) &&
+	 memcmp(Line(I), Other.Line(O), LineLength(I)) == 0;
+   }
+
+   string Hash() const
+   {
+      SHA256Summation Sum;
+      Sum.Add(reinterpret_cast<unsigned char const *>(Data.c_str()), Data.size());
+      return Sum.Result().Value();
+   }
+};
+									/*}}}*/
+// Myers - The difference between two sequences				/*{{{*/
+struct Hunk
+{
+   size_t OldStart, OldEnd;
+   size_t NewStart, NewEnd;
+};
+/* Appends the hunks turning the elements [0,N) into [0,M) in ascending
+   order to Hunks. Fails if more than MaxD insertions and deletions are
+   needed for this as the memory usage grows quadratically with them. */
+template<typename Equal>
+bool Myers(size_t const N, size_t const M, Equal const &Eq, long const MaxD, std::vector<Hunk> &Hunks)
+{
+   size_t Pre = 0;
+   while (Pre < N && Pre < M && Eq(Pre, Pre) == true)
+      ++Pre;
+   size_t Suf = 0;
+   while (Suf < N - Pre && Suf < M - Pre && Eq(N - 1 - Suf, M - 1 - Suf) == true)
+      ++Suf;
+   long const n = N - Pre - Suf, m = M - Pre - Suf;
+   if (n == 0 && m == 0)
+      return true;
+   else if (n == 0 || m == 0)
+   {
+      Hunks.push_back({Pre, N - Suf, Pre, M - Suf});
+      return true;
+   }
+
+   // Trace[D][(k+D)/2] is the furthest x reached on diagonal k = x - y with D edits
+   std::vector<std::vector<long>> Trace;
+   auto const Reach = [&](long const D, long const k) -> long {
+      if (k < -D || k > D)
+	 return -1;
+      return Trace[D][(k + D) / 2];
+   };
+   // diagonal k is entered with an insertion from k+1 or a deletion from k-1
+   auto const Enter = [&](long const D, long const k, bool &Insert) -> long {
+      long x = -1;
+      long const Down = Reach(D - 1, k + 1);
+      if (Down != -1 && Down - k <= m)
+      {
+	 x = Down;
+	 Insert = true;
+      }
+      long const Right = Reach(D - 1, k - 1);
+      if (Right != -1 && Right + 1 <= n && Right + 1 > x)
+      {
+	 x = Right + 1;
+	 Insert = false;
+      }
+      return x;
+   };
+
+   for (long D = 0; D <= MaxD; ++D)
+   {
+      Trace.emplace_back(D + 1, -1);
+      for (long k = -D; k <= D; k += 2)
+      {
+	 long x = 0;
+	 bool Insert;
+	 if (D != 0 && (x = Enter(D, k, Insert)) == -1)
+	    continue;
+	 long y = x - k;
+	 while (x < n && y < m && Eq(Pre + x, Pre + y) == true)
+	 {
+	    ++x;
+	    ++y;
+	 }
+	 Trace[D][(k + D) / 2] = x;
+	 if (x != n || y != m)
+	    continue;
+
+	 // walk the path back collecting the point before each edit
+	 struct Edit { long x, y; bool Insert; };
+	 std::vector<Edit> Edits(D);
+	 for (long E = D; E > 0; --E)
+	 {
+	    long const Start = Enter(E, k, Insert);
+	    if (Insert == true)
+	       Edits[E - 1] = {Start, Start - k - 1, true};
+	    else
+	       Edits[E - 1] = {Start - 1, Start - k, false};
+	    k += Insert ? 1 : -1;
+	 }
+	 for (auto const &E : Edits)
+	 {
+	    size_t const OldPos = Pre + E.x, NewPos = Pre + E.y;
+	    if (Hunks.empty() == true || Hunks.back().OldEnd != OldPos || Hunks.back().NewEnd != NewPos)
+	       Hunks.push_back({OldPos, OldPos, NewPos, NewPos});
+	    if (E.Insert == true)
+	       ++Hunks.back().NewEnd;
+	    else
+	       ++Hunks.back().OldEnd;
+	 }
+	 return true;
+      }
+   }
+   return false;
+}
+									/*}}}*/
+// Diff - Create an ed script turning Old into New			/*{{{*/
+/* Returns false if no usable script can be created */
+bool Diff(Text const &Old, Text const &New, string &Script)
+{
+   // ed can't add lines consisting of a single dot and both texts need to end
+   // with a newline as the last line would be joined with the next otherwise
+   if ((Old.Data.empty() == false && Old.Data.back() != '\n') ||
+	 (New.Data.empty() == false && New.Data.back() != '\n'))
+      return false;
+
+   std::vector<Hunk> Stanzas;
+   if (Myers(Old.StanzaCount(), New.StanzaCount(), [&](size_t const I, size_t const J) {
+	    return Old.StanzaEqual(I, New, J);
+	 }, 2000, Stanzas) == false)
+      return false;
+
+   std::vector<Hunk> Hunks;
+   for (auto const &S : Stanzas)
+   {
+      Hunk const Lines = {Old.Stanzas[S.OldStart], Old.Stanzas[S.OldEnd],
+	 New.Stanzas[S.NewStart], New.Stanzas[S.NewEnd]};
+      std::vector<Hunk> Refined;
+      if (Lines.OldStart != Lines.OldEnd && Lines.NewStart != Lines.NewEnd &&
+	    Myers(Lines.OldEnd - Lines.OldStart, Lines.NewEnd - Lines.NewStart, [&](size_t const I, size_t const J) {
+	       return Old.LineEqual(Lines.OldStart + I, New, Lines.NewStart + J);
+	    }, 500, Refined) == true)
+      {
+	 for (auto const &R : Refined)
+	    Hunks.push_back({Lines.OldStart + R.OldStart, Lines.OldStart + R.OldEnd,
+		  Lines.NewStart + R.NewStart, Lines.NewStart + R.NewEnd});
+      }
+      else
+	 Hunks.push_back(Lines);
+   }
+
+   // the script works from the end of the file to keep the line numbers valid
+   for (auto H = Hunks.crbegin(); H != Hunks.crend(); ++H)
+   {
+      string Cmd;
+      if (H->OldStart == H->OldEnd)
+	 strprintf(Cmd, "%zua\n", H->OldStart);
+      else if (H->OldStart + 1 == H->OldEnd)
+	 strprintf(Cmd, "%zu%c\n", H->OldEnd, H->NewStart == H->NewEnd ? 'd' : 'c');
+      else
+	 strprintf(Cmd, "%zu,%zu%c\n", H->OldStart + 1, H->OldEnd, H->NewStart == H->NewEnd ? 'd' : 'c');
+      Script.append(Cmd);
+      if (H->NewStart == H->NewEnd)
+	 continue;
+      for (size_t L = H->NewStart; L < H->NewEnd; ++L)
+	 if (New.LineLength(L) == 2 && New.Line(L)[0] == '.')
+	    return false;
+      Script.append(New.Line(H->NewStart), New.Lines[H->NewEnd] - New.Lines[H->NewStart]);
+      Script.append(".\n");
+   }
+   return true;
+}
+									/*}}}*/
+// PatchInfo - An entry of the Index					/*{{{*/
+struct PatchInfo
+{
+   string Name;
+   string History, Patch, Download;
+   unsigned long long HistorySize, PatchSize, DownloadSize;
+};
+static bool ReadIndexField(pkgTagSection const &Tags, char const * const Field,
+      std::vector<PatchInfo> &Patches, string PatchInfo::*Hash, unsigned long long PatchInfo::*Size)
+{
+   std::istringstream ss(Tags.FindS(Field));
+   ss.imbue(std::locale::classic());
+   string hash, name;
+   unsigned long long size;
+   while (ss >> hash >> size >> name)
+   {
+      if (Hash == &PatchInfo::Download)
+      {
+	 if (APT::String::Endswith(name, ".gz") == false)
+	    return false;
+	 name.erase(name.length() - 3);
+      }
+      auto P = std::find_if(Patches.begin(), Patches.end(), [&](PatchInfo const &I) { return I.Name == name; });
+      if (P == Patches.end())
+      {
+	 if (Hash != &PatchInfo::History)
+	    return false;
+	 Patches.push_back({name, "", "", "", 0, 0, 0});
+	 P = Patches.end() - 1;
+      }
+      (*P).*Hash = hash;
+      (*P).*Size = size;
+   }
+   return true;
+}
+/* Reads the patches from an Index if it describes the file with this hash */
+static void ReadIndex(string const &Index, string const &Hash, unsigned long long const Size,
+      std::vector<PatchInfo> &Patches)
+{
+   if (FileExists(Index) == false)
+      return;
+   FileFd Fd(Index, FileFd::ReadOnly);
+   pkgTagFile TF(&Fd);
+   pkgTagSection Tags;
+   string CurrentHash;
+   unsigned long long CurrentSize = 0;
+   bool Okay = Fd.IsOpen() == true && TF.Step(Tags) == true;
+   if (Okay == true)
+   {
+      std::istringstream ss(Tags.FindS("SHA256-Current"));
+      ss.imbue(std::locale::classic());
+      ss >> CurrentHash >> CurrentSize;
+      Okay = ReadIndexField(Tags, "SHA256-History", Patches, &PatchInfo::History, &PatchInfo::HistorySize) &&
+	 ReadIndexField(Tags, "SHA256-Patches", Patches, &PatchInfo::Patch, &PatchInfo::PatchSize) &&
+	 ReadIndexField(Tags, "SHA256-Download", Patches, &PatchInfo::Download, &PatchInfo::DownloadSize) &&
+	 std::none_of(Patches.begin(), Patches.end(), [](PatchInfo const &P) { return P.Patch.empty() || P.Download.empty(); });
+   }
+   if (Okay == false || CurrentHash != Hash || CurrentSize != Size)
+   {
+      // patches which don't lead up to the Current file are useless
+      for (auto const &P : Patches)
+	 RemoveFile("ReadIndex", flCombine(flNotFile(Index), P.Name + ".gz"));
+      Patches.clear();
+   }
+}
+									/*}}}*/
+}
+
+// PDiffWriter::PDiffWriter - Constructor				/*{{{*/
+// ---------------------------------------------------------------------
+/* The previous index is opened now, so that we can still read it after
+   MultiCompress replaced it with the new version */
+PDiffWriter::PDiffWriter(string const &Output, string const &Compress,
+			 mode_t const Permissions, unsigned long const MaxPatches) :
+   Output(Output), Compress(Compress), Permissions(Permissions), MaxPatches(MaxPatches)
+{
+   struct stat St;
+   if (MultiCompress::GetStat(Output, Compress, St) == false)
+      return;
+   MultiCompress OldIndex(Output, Compress, Permissions, false);
+   OldIndex.OpenOld(Old);
+}
+									/*}}}*/
+// PDiffWriter::Write - Write the patch and update the Index		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool PDiffWriter::Write(string &PatchName)
+{
+   PatchName.clear();
+   if (Old.IsOpen() == false)
+      return true;
+
+   Text Before, After;
+   FileFd NewFd;
+   MultiCompress NewIndex(Output, Compress, Permissions, false);
+   if (Before.Read(Old) == false || NewIndex.OpenOld(NewFd) == false || After.Read(NewFd) == false)
+      return _error->Error(_("Error reading %s for creating a patch"), Output.c_str());
+   Old.Close();
+   NewFd.Close();
+   if (Before.Data == After.Data)
+      return true;
+
+   string const Dir = Output + ".diff";
+   if (mkdir(Dir.c_str(), 0755) != 0 && errno != EEXIST)
+      return _error->Errno("mkdir", _("Unable to create directory %s"), Dir.c_str());
+   string const Index = flCombine(Dir, "Index");
+   string const BeforeHash = Before.Hash();
+   std::vector<PatchInfo> Patches;
+   ReadIndex(Index, BeforeHash, Before.Data.size(), Patches);
+
+   string Script;
+   if (Diff(Before, After, Script) == true)
+   {
+      // patches are named after the time of their creation like dak does
+      char Stamp[100];
+      time_t const Now = time(nullptr);
+      strftime(Stamp, sizeof(Stamp), "%Y-%m-%d-%H%M.%S", gmtime(&Now));
+      PatchName = Stamp;
+      for (unsigned int I = 1; FileExists(flCombine(Dir, PatchName + ".gz")) == true; ++I)
+	 strprintf(PatchName, "%s-%u", Stamp, I);
+      string const PatchFile = flCombine(Dir, PatchName + ".gz");
+
+      FileFd Patch;
+      if (Patch.Open(PatchFile, FileFd::WriteOnly | FileFd::Create | FileFd::Exclusive, FileFd::Gzip, Permissions) == false ||
+	    Patch.Write(Script.c_str(), Script.size()) == false || Patch.Close() == false)
+	 return _error->Error(_("Error writing patch %s"), PatchFile.c_str());
+      chmod(PatchFile.c_str(), Permissions);
+
+      SHA256Summation ScriptSum;
+      ScriptSum.Add(reinterpret_cast<unsigned char const *>(Script.c_str()), Script.size());
+      SHA256Summation DownloadSum;
+      if (Patch.Open(PatchFile, FileFd::ReadOnly) == false || DownloadSum.AddFD(Patch) == false)
+	 return false;
+      Patches.push_back({PatchName, BeforeHash, ScriptSum.Result().Value(), DownloadSum.Result().Value(),
+	    Before.Data.size(), Script.size(), Patch.FileSize()});
+   }
+   else
+   {
+      // without a patch the older ones don't lead to the new index
+      for (auto const &P : Patches)
+	 RemoveFile("PDiffWriter::Write", flCombine(Dir, P.Name + ".gz"));
+      Patches.clear();
+   }
+   while (Patches.size() > MaxPatches)
+   {
+      RemoveFile("PDiffWriter::Write", flCombine(Dir, Patches.front().Name + ".gz"));
+      Patches.erase(Patches.begin());
+   }
+
+   std::ostringstream Content;
+   Content.imbue(std::locale::classic());
+   Content << "SHA256-Current: " << After.Hash() << " " << After.Data.size() << "\n";
+   Content << "SHA256-History:\n";
+   for (auto const &P : Patches)
+      Content << " " << P.History << " " << P.HistorySize << " " << P.Name << "\n";
+   Content << "SHA256-Patches:\n";
+   for (auto const &P : Patches)
+      Content << " " << P.Patch << " " << P.PatchSize << " " << P.Name << "\n";
+   Content << "SHA256-Download:\n";
+   for (auto const &P : Patches)
+      Content << " " << P.Download << " " << P.DownloadSize << " " << P.Name << ".gz\n";
+
+   string const NewIndexFile = Index + ".new";
+   string const Data = Content.str();
+   FileFd IndexFd;
+   if (IndexFd.Open(NewIndexFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, Permissions) == false ||
+	 IndexFd.Write(Data.c_str(), Data.size()) == false || IndexFd.Close() == false)
+      return _error->Error(_("Error writing %s"), Index.c_str());
+   chmod(NewIndexFile.c_str(), Permissions);
+   if (rename(NewIndexFile.c_str(), Index.c_str()) != 0)
+      return _error->Errno("rename", _("Failed to rename %s to %s"), NewIndexFile.c_str(), Index.c_str());
+   return true;
+}
+									/*}}}*/
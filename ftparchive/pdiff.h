@@ -0,0 +1,41 @@
+// -*- mode: cpp; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   PDiff Writer
+
+   Keeps the previous version of an index open while the new one is
+   generated and afterwards writes an ed-style patch between the two
+   into the <index>.diff directory and updates the Index file listing
+   the patches for pkgAcqDiffIndex.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PDIFF_H
+#define PDIFF_H
+
+#include <apt-pkg/fileutl.h>
+
+#include <string>
+#include <sys/types.h>
+
+class PDiffWriter
+{
+   std::string const Output;
+   std::string const Compress;
+   mode_t const Permissions;
+   unsigned long const MaxPatches;
+   FileFd Old;
+
+   public:
+
+   // Is there a previous version to create a patch against?
+   bool HasOld() { return Old.IsOpen(); }
+   // Diff the previous against the new version, PatchName is empty if they are equal
+   bool Write(std::string &PatchName);
+
+   PDiffWriter(std::string const &Output, std::string const &Compress,
+	       mode_t const Permissions, unsigned long const MaxPatches);
+};
+
+#endif
@@ -52,7 +52,7 @@
 #include <apti18n.h>
 									/*}}}*/
 using namespace std;
-FTWScanner *FTWScanner::Owner;
+thread_local FTWScanner *FTWScanner::Owner;
 
 // ConfigToDoHashes - which hashes to generate				/*{{{*/
 static void SingleConfigToDoHashes(unsigned int &DoHashes, std::string const &Conf, unsigned int const Flag)
@@ -73,7 +73,8 @@ static void ConfigToDoHashes(unsigned int &DoHashes, std::string const &Conf)
 
 // FTWScanner::FTWScanner - Constructor					/*{{{*/
 FTWScanner::FTWScanner(FileFd * const GivenOutput, string const &Arch, bool const IncludeArchAll)
-   : Arch(Arch), IncludeArchAll(IncludeArchAll), DoHashes(~0)
+   : Arch(Arch), IncludeArchAll(IncludeArchAll), DoHashes(~0), Notices(&c1out),
+     Errors(&cerr)
 {
    if (GivenOutput == NULL)
    {
@@ -105,12 +106,12 @@ int FTWScanner::ScannerFTW(const char *File,const struct stat * /*sb*/,int Flag)
    if (Flag == FTW_DNR)
    {
       Owner->NewLine(1);
-      ioprintf(c1out, _("W: Unable to read directory %s\n"), File);
+      ioprintf(*Owner->Notices, _("W: Unable to read directory %s\n"), File);
    }   
    if (Flag == FTW_NS)
    {
       Owner->NewLine(1);
-      ioprintf(c1out, _("W: Unable to stat %s\n"), File);
+      ioprintf(*Owner->Notices, _("W: Unable to stat %s\n"), File);
    }   
    if (Flag != FTW_F)
       return 0;
@@ -155,6 +156,15 @@ int FTWScanner::ScannerFile(const char *File, bool const &ReadLink)
    else
       Owner->DoPackage(File);
    
+   Owner->ReportErrors(File);
+   return 0;
+}
+									/*}}}*/
+// FTWScanner::ReportErrors - Print the errors found for a file		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+void FTWScanner::ReportErrors(const char *File)
+{
    if (_error->empty() == false)
    {
       // Print any errors or warnings found
@@ -162,24 +172,21 @@ int FTWScanner::ScannerFile(const char *File, bool const &ReadLink)
       bool SeenPath = false;
       while (_error->empty() == false)
       {
-	 Owner->NewLine(1);
+	 NewLine(1);
 	 
 	 bool const Type = _error->PopMessage(Err);
 	 if (Type == true)
-	    cerr << _("E: ") << Err << endl;
+	    *Errors << _("E: ") << Err << endl;
 	 else
-	    cerr << _("W: ") << Err << endl;
+	    *Errors << _("W: ") << Err << endl;
 	 
 	 if (Err.find(File) != string::npos)
 	    SeenPath = true;
       }      
       
       if (SeenPath == false)
-	 cerr << _("E: Errors apply to file ") << "'" << File << "'" << endl;
-      return 0;
+	 *Errors << _("E: Errors apply to file ") << "'" << File << "'" << endl;
    }
-   
-   return 0;
 }
 									/*}}}*/
 // FTWScanner::RecursiveScan - Just scan a directory tree		/*{{{*/
@@ -201,6 +208,7 @@ bool FTWScanner::RecursiveScan(string const &Dir)
    // Do recursive directory searching
    Owner = this;
    int const Res = ftw(Dir.c_str(),ScannerFTW,30);
+   Flush();
    
    // Error treewalking?
    if (Res != 0)
@@ -267,6 +275,7 @@ bool FTWScanner::LoadFileList(string const &Dir, string const &File)
       if (ScannerFile(FileName, false) != 0)
 	 break;
    }
+   Flush();
   
    fclose(List);
    return true;
@@ -289,12 +298,12 @@ bool FTWScanner::Delink(string &FileName,const char *OriginalPath,
       {
 	 // Tidy up the display
 	 if (DeLinkBytes == 0)
-	    cout << endl;
+	    *Notices << endl;
 	 
 	 NewLine(1);
-	 ioprintf(c1out, _(" DeLink %s [%s]\n"), (OriginalPath + InternalPrefix.length()),
+	 ioprintf(*Notices, _(" DeLink %s [%s]\n"), (OriginalPath + InternalPrefix.length()),
 		    SizeToStr(FileSize).c_str());
-	 c1out << flush;
+	 *Notices << flush;
 	 
 	 if (NoLinkAct == false)
 	 {
@@ -320,7 +329,7 @@ bool FTWScanner::Delink(string &FileName,const char *OriginalPath,
 	 
 	 DeLinkBytes += FileSize;
 	 if (DeLinkBytes/1024 >= DeLinkLimit)
-	    ioprintf(c1out, _(" DeLink limit of %sB hit.\n"), SizeToStr(DeLinkBytes).c_str());      
+	    ioprintf(*Notices, _(" DeLink limit of %sB hit.\n"), SizeToStr(DeLinkBytes).c_str());      
       }
       
       FileName = OriginalPath;
@@ -362,7 +371,8 @@ bool FTWScanner::SetExts(string const &Vals)
 PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * const transWriter,
       string const &DB,string const &Overrides,string const &ExtOverrides,
       string const &Arch, bool const IncludeArchAll) :
-   FTWScanner(GivenOutput, Arch, IncludeArchAll), Db(DB), Stats(Db.Stats), TransWriter(transWriter)
+   FTWScanner(GivenOutput, Arch, IncludeArchAll), Db(DB), Stopping(false),
+   Stats(Db.Stats), TransWriter(transWriter)
 {
    SetExts(".deb .ddeb .udeb");
    DeLinkLimit = 0;
@@ -373,22 +383,36 @@ PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * c
    DoContents = _config->FindB("APT::FTPArchive::Contents",true);
    NoOverride = _config->FindB("APT::FTPArchive::NoOverrideMsg",false);
    LongDescription = _config->FindB("APT::FTPArchive::LongDescription",true);
+   InspectThreads = _config->FindI("APT::FTPArchive::Packages::Threads", 1);
 
    if (Db.Loaded() == false)
       DoContents = false;
 
    // Read the override file
-   if (Overrides.empty() == false && Over.ReadOverride(Overrides) == false)
+   if (Overrides.empty() == false && ReadOverride(Overrides) == false)
       return;
    else
       NoOverride = true;
 
    if (ExtOverrides.empty() == false)
-      Over.ReadExtraOverride(ExtOverrides);
+      ReadExtraOverride(ExtOverrides);
 
    _error->DumpErrors();
 }
                                                                         /*}}}*/
+// PackagesWriter::Job - A package inspected by a thread of the pool	/*{{{*/
+struct PackagesWriter::Job
+{
+   Record R;
+   debDebFile::MemControlExtract Control;
+   struct CacheDB::Stats Stats;
+   std::vector<std::pair<bool, string>> Errors;
+   bool Okay;
+   bool Done;
+
+   Job() : Okay(false), Done(false) {};
+};
+									/*}}}*/
 // PackagesWriter::DoPackage - Process a single package			/*{{{*/
 // ---------------------------------------------------------------------
 /* This method takes a package and gets its control information and 
@@ -396,8 +420,47 @@ PackagesWriter::PackagesWriter(FileFd * const GivenOutput, TranslationWriter * c
    rewritten and the path/size/hash appended. */
 bool PackagesWriter::DoPackage(string FileName)
 {      
+   Record R;
+   R.FileName = FileName;
+   R.OriginalPath = OriginalPath;
+
+   /* Delinking depends on the packages before, so it is only supported
+      if the packages are inspected one after the other */
+   if (InspectThreads > 1 && (DeLinkLimit == 0 || InternalPrefix.empty() == true))
+   {
+      std::unique_lock<std::mutex> Lock(JobsLock);
+      if (Inspectors.empty() == true)
+	 for (unsigned long I = 0; I != InspectThreads; ++I)
+	 {
+	    std::unique_ptr<CacheDB> JobDb(new CacheDB(""));
+	    JobDb->ShareDB(Db);
+	    Inspectors.emplace_back(&PackagesWriter::InspectJobs, this, std::move(JobDb));
+	 }
+
+      std::unique_ptr<Job> J(new Job);
+      J->R = std::move(R);
+      Queue.push_back(J.get());
+      Pending.push_back(std::move(J));
+      JobQueued.notify_one();
+
+      // Limit the memory used by packages waiting for an earlier one
+      WriteJobs(Lock, 16 * InspectThreads);
+      return true;
+   }
+
+   if (Inspect(Db, R) == false || WriteRecord(Db.Control.Section, R) == false)
+      return false;
+   return Db.Finish();
+}
+									/*}}}*/
+// PackagesWriter::Inspect - Gather all the data of a package		/*{{{*/
+// ---------------------------------------------------------------------
+/* This pulls everything from the given DB or from the package itself,
+   but doesn't write anything, so it can run in parallel to the writer. */
+bool PackagesWriter::Inspect(CacheDB &Db, Record &R)
+{
    // Pull all the data we need form the DB
-   if (Db.GetFileInfo(FileName,
+   if (Db.GetFileInfo(R.FileName,
 	    true, /* DoControl */
 	    DoContents,
 	    true, /* GenContentsOnly */
@@ -408,12 +471,12 @@ bool PackagesWriter::DoPackage(string FileName)
    }
 
    unsigned long long FileSize = Db.GetFileSize();
-   if (Delink(FileName,OriginalPath,Stats.DeLinkBytes,FileSize) == false)
+   if (Delink(R.FileName,R.OriginalPath.c_str(),Db.Stats.DeLinkBytes,FileSize) == false)
       return false;
    
    // Lookup the override information
    pkgTagSection &Tags = Db.Control.Section;
-   string Package = Tags.FindS("Package");
+   R.Package = Tags.FindS("Package");
    string Architecture;
    // if we generate a Packages file for a given arch, we use it to
    // look for overrides. if we run in "simple" mode without the 
@@ -423,9 +486,9 @@ bool PackagesWriter::DoPackage(string FileName)
       Architecture = Arch;
    else
       Architecture = Tags.FindS("Architecture");
-   unique_ptr<Override::Item> OverItem(Over.GetItem(Package,Architecture));
+   unique_ptr<Override::Item> OverItem(Over.GetItem(R.Package,Architecture));
    
-   if (Package.empty() == true)
+   if (R.Package.empty() == true)
       return _error->Error(_("Archive had no package field"));
 
    // If we need to do any rewriting of the header do it now..
@@ -433,8 +496,9 @@ bool PackagesWriter::DoPackage(string FileName)
    {
       if (NoOverride == false)
       {
-	 NewLine(1);
-	 ioprintf(c1out, _("  %s has no override entry\n"), Package.c_str());
+	 std::string Note;
+	 strprintf(Note, _("  %s has no override entry\n"), R.Package.c_str());
+	 R.Notes.push_back(Note);
       }
       
       OverItem = unique_ptr<Override::Item>(new Override::Item);
@@ -442,28 +506,17 @@ bool PackagesWriter::DoPackage(string FileName)
       OverItem->Priority = Tags.FindS("Priority");
    }
 
-   // Strip the DirStrip prefix from the FileName and add the PathPrefix
-   string NewFileName;
-   if (DirStrip.empty() == false &&
-       FileName.length() > DirStrip.length() &&
-       stringcmp(FileName.begin(),FileName.begin() + DirStrip.length(),
-		 DirStrip.begin(),DirStrip.end()) == 0)
-      NewFileName = string(FileName.begin() + DirStrip.length(),FileName.end());
-   else 
-      NewFileName = FileName;
-   if (PathPrefix.empty() == false)
-      NewFileName = flCombine(PathPrefix,NewFileName);
+   string const NewFileName = IndexFileName(R.FileName);
 
    /* Configuration says we don't want to include the long Description
       in the package file - instead we want to ship a separated file */
-   string desc;
    if (LongDescription == false) {
-      desc = Tags.FindS("Description").append("\n");
-      OverItem->FieldOverride["Description"] = desc.substr(0, desc.find('\n')).c_str();
+      R.Description = Tags.FindS("Description").append("\n");
+      OverItem->FieldOverride["Description"] = R.Description.substr(0, R.Description.find('\n')).c_str();
    }
 
    // This lists all the changes to the fields we are going to make.
-   std::vector<pkgTagSection::Tag> Changes;
+   std::vector<pkgTagSection::Tag> &Changes = R.Changes;
 
    std::string Size;
    strprintf(Size, "%llu", (unsigned long long) FileSize);
@@ -483,14 +536,11 @@ bool PackagesWriter::DoPackage(string FileName)
    Changes.push_back(pkgTagSection::Tag::Remove("Status"));
    Changes.push_back(pkgTagSection::Tag::Remove("Optional"));
 
-   string DescriptionMd5;
    if (LongDescription == false) {
       MD5Summation descmd5;
-      descmd5.Add(desc.c_str());
-      DescriptionMd5 = descmd5.Result().Value();
-      Changes.push_back(pkgTagSection::Tag::Rewrite("Description-md5", DescriptionMd5));
-      if (TransWriter != NULL)
-	 TransWriter->DoPackage(Package, desc, DescriptionMd5);
+      descmd5.Add(R.Description.c_str());
+      R.DescriptionMd5 = descmd5.Result().Value();
+      Changes.push_back(pkgTagSection::Tag::Rewrite("Description-md5", R.DescriptionMd5));
    }
 
    // Rewrite the maintainer field if necessary
@@ -500,9 +550,10 @@ bool PackagesWriter::DoPackage(string FileName)
    {
       if (NoOverride == false)
       {
-	 NewLine(1);
-	 ioprintf(c1out, _("  %s maintainer is %s not %s\n"),
-	       Package.c_str(), Tags.FindS("Maintainer").c_str(), OverItem->OldMaint.c_str());
+	 std::string Note;
+	 strprintf(Note, _("  %s maintainer is %s not %s\n"),
+	       R.Package.c_str(), Tags.FindS("Maintainer").c_str(), OverItem->OldMaint.c_str());
+	 R.Notes.push_back(Note);
       }
    }
 
@@ -526,16 +577,246 @@ bool PackagesWriter::DoPackage(string FileName)
         I != OverItem->FieldOverride.end(); ++I)
       Changes.push_back(pkgTagSection::Tag::Rewrite(I->first, I->second));
 
+   return true;
+}
+									/*}}}*/
+// PackagesWriter::IndexFileName - The Filename field of a package	/*{{{*/
+// ---------------------------------------------------------------------
+/* Strip the DirStrip prefix from the FileName and add the PathPrefix */
+string PackagesWriter::IndexFileName(string const &FileName) const
+{
+   string NewFileName;
+   if (DirStrip.empty() == false &&
+       FileName.length() > DirStrip.length() &&
+       stringcmp(FileName.begin(),FileName.begin() + DirStrip.length(),
+		 DirStrip.begin(),DirStrip.end()) == 0)
+      NewFileName = string(FileName.begin() + DirStrip.length(),FileName.end());
+   else 
+      NewFileName = FileName;
+   if (PathPrefix.empty() == false)
+      NewFileName = flCombine(PathPrefix,NewFileName);
+   return NewFileName;
+}
+									/*}}}*/
+// PackagesWriter::WriteRecord - Write an inspected package		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool PackagesWriter::WriteRecord(pkgTagSection const &Tags, Record const &R)
+{
+   for (auto const &Note : R.Notes)
+   {
+      NewLine(1);
+      *Notices << Note;
+   }
+
+   if (LongDescription == false && TransWriter != NULL)
+      TransWriter->DoPackage(R.Package, R.Description, R.DescriptionMd5);
+
    // Rewrite and store the fields.
-   if (Tags.Write(*Output, TFRewritePackageOrder, Changes) == false ||
+   if (Tags.Write(*Output, TFRewritePackageOrder, R.Changes) == false ||
 	 Output->Write("\n", 1) == false)
       return false;
+   return true;
+}
+									/*}}}*/
+// PackagesWriter::InspectJobs - Thread of the pool inspecting packages	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+void PackagesWriter::InspectJobs(std::unique_ptr<CacheDB> JobDb)
+{
+   std::unique_lock<std::mutex> Lock(JobsLock);
+   while (true)
+   {
+      JobQueued.wait(Lock, [this]() { return Stopping == true || Queue.empty() == false; });
+      if (Stopping == true)
+	 return;
+      Job * const J = Queue.front();
+      Queue.pop_front();
+      Lock.unlock();
+
+      struct CacheDB::Stats const NoStats;
+      JobDb->Stats = NoStats;
+      J->Okay = Inspect(*JobDb, J->R) == true &&
+	 J->Control.TakeControl(JobDb->Control.Control, JobDb->Control.Length) == true &&
+	 JobDb->Finish() == true;
+      J->Stats = JobDb->Stats;
+      string Err;
+      while (_error->empty() == false)
+      {
+	 bool const Type = _error->PopMessage(Err);
+	 J->Errors.emplace_back(Type, Err);
+      }
 
-   return Db.Finish();
+      Lock.lock();
+      J->Done = true;
+      JobDone.notify_all();
+   }
+}
+									/*}}}*/
+// PackagesWriter::WriteJobs - Write the inspected packages in order	/*{{{*/
+// ---------------------------------------------------------------------
+/* Writes packages until the first one still in inspection. If more than
+   Keep packages are pending, it waits for them to be inspected. */
+void PackagesWriter::WriteJobs(std::unique_lock<std::mutex> &Lock, size_t const Keep)
+{
+   while (Pending.empty() == false)
+   {
+      if (Pending.front()->Done == false)
+      {
+	 if (Pending.size() <= Keep)
+	    break;
+	 JobDone.wait(Lock);
+	 continue;
+      }
+      std::unique_ptr<Job> J = std::move(Pending.front());
+      Pending.pop_front();
+      Lock.unlock();
+
+      Stats.Add(J->Stats);
+      for (auto const &E : J->Errors)
+	 if (E.first == true)
+	    _error->Error("%s", E.second.c_str());
+	 else
+	    _error->Warning("%s", E.second.c_str());
+      if (J->Okay == true)
+	 WriteRecord(J->Control.Section, J->R);
+      ReportErrors(J->R.OriginalPath.c_str());
+
+      Lock.lock();
+   }
+}
+									/*}}}*/
+// PackagesWriter::UpdateFromList - Update a previous Packages file	/*{{{*/
+// ---------------------------------------------------------------------
+/* Instead of scanning the whole directory Dir again, only the files in
+   the change list are looked at. Records of listed files are dropped
+   from the Previous Packages file while all others are copied as they
+   are. Listed files which still exist are inspected again: if they had a
+   record before, the new one takes its place, others are appended. This
+   way the work depends on the number of changes, not on the size of the
+   pool. Relative names in the list are prefixed with BaseDir, files not
+   below Dir are ignored like they are by a full scan.
+
+   The copied records keep the overrides, hashes and path prefix they were
+   written with. If an override file is newer than Previous, Dir is
+   scanned completely instead. Changes of the options are not noticed, so
+   they have to stay the same as for the Previous file. */
+bool PackagesWriter::UpdateFromList(FileFd &Previous, string const &Dir,
+				    string const &BaseDir, string const &ChangeList)
+{
+   time_t const PreviousMTime = Previous.ModificationTime();
+   for (auto const &File : OverrideFiles)
+      if (GetModificationTime(File) > PreviousMTime)
+	 return RecursiveScan(Dir);
+
+   char * const RealDir = realpath(Dir.c_str(), NULL);
+   if (RealDir == NULL)
+      return _error->Errno("realpath",_("Failed to resolve %s"),Dir.c_str());
+   string const Below = string(RealDir).append("/");
+   if (InternalPrefix.empty() == true)
+      InternalPrefix = RealDir;
+   free(RealDir);
+
+   FileFd List(ChangeList, FileFd::ReadOnly);
+   if (List.IsOpen() == false)
+      return false;
+   // the listed files which still exist below Dir by their Filename
+   std::vector<std::pair<string, string>> Files;
+   std::set<string> Changed;
+   char Line[1000];
+   while (List.ReadLine(Line, sizeof(Line)) != NULL)
+   {
+      string const FileName = _strstrip(Line);
+      if (FileName.empty() == true)
+	 continue;
+      string const Path = FileName[0] == '/' ? FileName : flCombine(BaseDir, FileName);
+      string const IndexName = IndexFileName(Path);
+      if (Changed.insert(IndexName).second == false)
+	 continue;
+      // removed files only drop their record
+      struct stat St;
+      if (stat(Path.c_str(), &St) != 0)
+	 continue;
+      char * const RealPath = realpath(flNotFile(Path).c_str(), NULL);
+      if (RealPath == NULL)
+	 continue;
+      string const Parent = string(RealPath).append("/");
+      free(RealPath);
+      if (Parent.compare(0, Below.length(), Below) == 0)
+	 Files.emplace_back(IndexName, Path);
+   }
+   if (List.Failed() == true)
+      return false;
+
+   Owner = this;
+   auto const Scan = [this](string const &Path) {
+      ScannerFile(Path.c_str(), true);
+   };
+   pkgTagFile Tags(&Previous);
+   pkgTagSection Section;
+   bool Inspecting = false;
+   while (Tags.Step(Section) == true)
+   {
+      string const FileName = Section.FindS("Filename");
+      if (Changed.find(FileName) != Changed.end())
+      {
+	 auto const F = std::find_if(Files.begin(), Files.end(),
+	       [&](std::pair<string, string> const &F) { return F.first == FileName; });
+	 if (F != Files.end())
+	 {
+	    Scan(F->second);
+	    Files.erase(F);
+	    Inspecting = true;
+	 }
+	 continue;
+      }
+
+      // records are written in order, so wait for the files before
+      if (Inspecting == true)
+      {
+	 Flush();
+	 Inspecting = false;
+      }
+
+      if (LongDescription == false && TransWriter != NULL)
+      {
+	 string const MD5 = Section.FindS("Description-md5");
+	 string Desc;
+	 if (TransWriter->FindPrevious(MD5, Desc) == false)
+	    return _error->Error(_("The previous Translation file has no description %s for %s"),
+				 MD5.c_str(), Section.FindS("Package").c_str());
+	 TransWriter->DoPackage(Section.FindS("Package"), Desc, MD5);
+      }
+
+      if (Section.Write(*Output, TFRewritePackageOrder, {}) == false ||
+	    Output->Write("\n", 1) == false)
+	 return false;
+   }
+   if (_error->PendingError() == true)
+      return false;
+
+   for (auto const &F : Files)
+      Scan(F.second);
+   Flush();
+   return true;
+}
+									/*}}}*/
+// PackagesWriter::Flush - Write all packages still in inspection	/*{{{*/
+void PackagesWriter::Flush()
+{
+   std::unique_lock<std::mutex> Lock(JobsLock);
+   WriteJobs(Lock, 0);
 }
 									/*}}}*/
 PackagesWriter::~PackagesWriter()					/*{{{*/
 {
+   {
+      std::lock_guard<std::mutex> Lock(JobsLock);
+      Stopping = true;
+   }
+   JobQueued.notify_all();
+   for (auto &T : Inspectors)
+      T.join();
 }
 									/*}}}*/
 
@@ -543,13 +824,24 @@ PackagesWriter::~PackagesWriter()					/*{{{*/
 // ---------------------------------------------------------------------
 /* Create a Translation-Master file for this Packages file */
 TranslationWriter::TranslationWriter(string const &File, string const &TransCompress,
-					mode_t const &Permissions) : Comp(NULL), Output(NULL)
+					mode_t const &Permissions) : Comp(NULL), Output(NULL),
+   Target(NULL), PreviousLoaded(false)
 {
    if (File.empty() == true)
       return;
 
    Comp = new MultiCompress(File, TransCompress, Permissions);
    Output = &Comp->Input;
+}
+									/*}}}*/
+// TranslationWriter::TranslationWriter - Constructor			/*{{{*/
+// ---------------------------------------------------------------------
+/* Collect the descriptions and pass them on to Target only on Flush, so
+   that Packages files generated in parallel can still write their shared
+   Translation-Master file in the order of a serial run */
+TranslationWriter::TranslationWriter(TranslationWriter * const Target) :
+   Comp(NULL), Output(NULL), Target(Target), PreviousLoaded(false)
+{
 }
 									/*}}}*/
 // TranslationWriter::DoPackage - Process a single package		/*{{{*/
@@ -558,7 +850,7 @@ TranslationWriter::TranslationWriter(string const &File, string const &TransComp
 bool TranslationWriter::DoPackage(string const &Pkg, string const &Desc,
 				  string const &MD5)
 {
-   if (Output == NULL)
+   if (Output == NULL && Target == NULL)
       return true;
 
    // Different archs can include different versions and therefore
@@ -568,6 +860,13 @@ bool TranslationWriter::DoPackage(string const &Pkg, string const &Desc,
    if (Included.find(Record) != Included.end())
       return true;
 
+   if (Target != NULL)
+   {
+      Delayed.push_back({Pkg, Desc, MD5});
+      Included.insert(Record);
+      return true;
+   }
+
    std::string out;
    strprintf(out, "Package: %s\nDescription-md5: %s\nDescription-en: %s\n",
 	   Pkg.c_str(), MD5.c_str(), Desc.c_str());
@@ -577,6 +876,56 @@ bool TranslationWriter::DoPackage(string const &Pkg, string const &Desc,
    return true;
 }
 									/*}}}*/
+// TranslationWriter::Flush - Pass the collected descriptions on	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool TranslationWriter::Flush()
+{
+   if (Target == NULL)
+      return true;
+   for (auto const &D : Delayed)
+      if (Target->DoPackage(D.Pkg, D.Desc, D.MD5) == false)
+	 return false;
+   Delayed.clear();
+   Included.clear();
+   return true;
+}
+									/*}}}*/
+// TranslationWriter::FindPrevious - Description of the previous file	/*{{{*/
+// ---------------------------------------------------------------------
+/* Packages files updated from a previous version need the descriptions
+   of the records they keep, which are only in the previous Translation
+   file. It is read on first use, shared by all Packages files. */
+bool TranslationWriter::FindPrevious(string const &MD5, string &Desc)
+{
+   if (Target != NULL)
+      return Target->FindPrevious(MD5, Desc);
+   if (Comp == NULL)
+      return false;
+
+   std::lock_guard<std::mutex> Lock(PreviousLock);
+   if (PreviousLoaded == false)
+   {
+      PreviousLoaded = true;
+      FileFd Fd;
+      _error->PushToStack();
+      if (Comp->OpenOld(Fd) == true)
+      {
+	 pkgTagFile Tags(&Fd);
+	 pkgTagSection Section;
+	 while (Tags.Step(Section) == true)
+	    Previous[Section.FindS("Description-md5")] = Section.FindS("Description-en").append("\n");
+      }
+      _error->RevertToStack();
+   }
+
+   auto const D = Previous.find(MD5);
+   if (D == Previous.end())
+      return false;
+   Desc = D->second;
+   return true;
+}
+									/*}}}*/
 // TranslationWriter::~TranslationWriter - Destructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -698,7 +1047,7 @@ bool SourcesWriter::DoPackage(string FileName)
       if (NoOverride == false)
       {
 	 NewLine(1);	 
-	 ioprintf(c1out, _("  %s has no override entry\n"), Tags.FindS("Source").c_str());
+	 ioprintf(*Notices, _("  %s has no override entry\n"), Tags.FindS("Source").c_str());
       }
       
       OverItem.reset(new Override::Item);
@@ -712,11 +1061,11 @@ bool SourcesWriter::DoPackage(string FileName)
    // const unique_ptr<Override::Item> autoSOverItem(SOverItem);
    if (SOverItem.get() == 0)
    {
-      ioprintf(c1out, _("  %s has no source override entry\n"), Tags.FindS("Source").c_str());
+      ioprintf(*Notices, _("  %s has no source override entry\n"), Tags.FindS("Source").c_str());
       SOverItem = unique_ptr<Override::Item>(BOver.GetItem(Tags.FindS("Source")));
       if (SOverItem.get() == 0)
       {
-        ioprintf(c1out, _("  %s has no binary override entry either\n"), Tags.FindS("Source").c_str());
+        ioprintf(*Notices, _("  %s has no binary override entry either\n"), Tags.FindS("Source").c_str());
 	 SOverItem = unique_ptr<Override::Item>(new Override::Item);
 	 *SOverItem = *OverItem;
       }
@@ -855,7 +1204,7 @@ bool SourcesWriter::DoPackage(string FileName)
       if (NoOverride == false)
       {
 	 NewLine(1);
-	 ioprintf(c1out, _("  %s maintainer is %s not %s\n"), Package.c_str(),
+	 ioprintf(*Notices, _("  %s maintainer is %s not %s\n"), Package.c_str(),
 	       Tags.FindS("Maintainer").c_str(), OverItem->OldMaint.c_str());
       }
    }
@@ -886,6 +1235,7 @@ ContentsWriter::ContentsWriter(FileFd * const GivenOutput, string const &DB,
 
 {
    SetExts(".deb");
+   Gen.SetMemoryLimit(_config->FindI("APT::FTPArchive::Contents::MemoryLimit", 0) * 1024ull);
 }
 									/*}}}*/
 // ContentsWriter::DoPackage - Process a single package			/*{{{*/
@@ -1048,10 +1398,17 @@ ReleaseWriter::ReleaseWriter(FileFd * const GivenOutput, string const &/*DB*/) :
    }
 
    ConfigToDoHashes(DoHashes, "APT::FTPArchive::Release");
+
+   HashThreads = std::max(1u, std::thread::hardware_concurrency());
+   if (_config->Exists("APT::FTPArchive::Release::Threads") == true)
+      HashThreads = std::max(1, _config->FindI("APT::FTPArchive::Release::Threads"));
 }
 									/*}}}*/
 // ReleaseWriter::DoPackage - Process a single package			/*{{{*/
 // ---------------------------------------------------------------------
+/* The checksums are taken from the manifest of the directory if generate
+   recorded them for the file as it is now, otherwise the file is queued
+   to be hashed by Flush. */
 bool ReleaseWriter::DoPackage(string FileName)
 {
    // Strip the DirStrip prefix from the FileName and add the PathPrefix
@@ -1071,28 +1428,64 @@ bool ReleaseWriter::DoPackage(string FileName)
    if (PathPrefix.empty() == false)
       NewFileName = flCombine(PathPrefix,NewFileName);
 
-   FileFd fd(FileName, FileFd::ReadOnly);
+   string const Dir = flNotFile(FileName);
+   string const Name = flNotDir(FileName);
+   if (Name == ChecksumsManifest::FileName)
+      return true;
 
-   if (!fd.IsOpen())
+   // A broken manifest only means that the files have to be hashed
+   auto Manifest = Manifests.find(Dir);
+   if (Manifest == Manifests.end())
    {
-      return false;
+      Manifest = Manifests.emplace(Dir, ChecksumsManifest()).first;
+      _error->PushToStack();
+      Manifest->second.Load(Dir);
+      _error->RevertToStack();
    }
 
-   CheckSums[NewFileName].size = fd.Size();
+   HashStringList Sums;
+   if (Manifest->second.Find(Name, DoHashes, Sums) == true)
+      return AddFile(FileName, NewFileName, Sums);
 
-   Hashes hs(DoHashes);
-   hs.AddFD(fd);
-   CheckSums[NewFileName].Hashes = hs.GetHashStringList();
-   fd.Close();
+   Queued.emplace_back(FileName, NewFileName);
+   return true;
+}
+									/*}}}*/
+// ReleaseWriter::Flush - Hash the queued files				/*{{{*/
+void ReleaseWriter::Flush()
+{
+   if (Queued.empty() == true)
+      return;
+
+   std::vector<string> Files;
+   for (auto const &Q : Queued)
+      Files.push_back(Q.first);
+   ChecksumsManifest::Calculate(Files, DoHashes, HashThreads,
+	 [this](size_t const I, HashStringList const &Sums) {
+	    bool const Res = Sums.empty() == false &&
+	       AddFile(Queued[I].first, Queued[I].second, Sums) == true;
+	    ReportErrors(Queued[I].first.c_str());
+	    return Res;
+	 });
+   Queued.clear();
+}
+									/*}}}*/
+// ReleaseWriter::AddFile - Note the checksums of a file		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool ReleaseWriter::AddFile(string const &FileName, string const &NewFileName,
+			    HashStringList const &Sums)
+{
+   CheckSums[NewFileName].size = Sums.FileSize();
+   CheckSums[NewFileName].Hashes = Sums;
 
    // FIXME: wrong layer in the code(?)
    // FIXME2: symlink instead of create a copy
    if (_config->FindB("APT::FTPArchive::DoByHash", false) == true)
    {
       std::string Input = FileName;
-      HashStringList hsl = hs.GetHashStringList();
-      for(HashStringList::const_iterator h = hsl.begin();
-          h != hsl.end(); ++h)
+      for(HashStringList::const_iterator h = Sums.begin();
+          h != Sums.end(); ++h)
       {
          if (!h->usable())
             continue;
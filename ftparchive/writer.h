@@ -17,13 +17,21 @@
 
 #include <string>
 #include <stdio.h>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <map>
 #include <set>
+#include <utility>
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include "checksums.h"
 #include "contents.h"
 #include "cachedb.h"
 #include "override.h"
@@ -47,9 +55,10 @@ class FTWScanner
    // Stuff for the delinker
    bool NoLinkAct;
 
-   static FTWScanner *Owner;
+   static thread_local FTWScanner *Owner;
    static int ScannerFTW(const char *File,const struct stat *sb,int Flag);
    static int ScannerFile(const char *File, bool const &ReadLink);
+   void ReportErrors(const char *File);
 
    bool Delink(string &FileName,const char *OriginalPath,
 	       unsigned long long &Bytes,unsigned long long const &FileSize);
@@ -58,7 +67,7 @@ class FTWScanner
    {
       if (ErrorPrinted == false && Quiet <= Priority)
       {
-	 c1out << endl;
+	 *Notices << endl;
 	 ErrorPrinted = true;
       }
    }
@@ -71,7 +80,14 @@ class FTWScanner
    unsigned long DeLinkLimit;
    string InternalPrefix;
 
+   /* Notices about the files and their errors are printed here, which
+      are c1out and cerr unless the output of a job is collected */
+   std::ostream *Notices;
+   std::ostream *Errors;
+
    virtual bool DoPackage(string FileName) = 0;
+   // Wait until all files passed to DoPackage are written
+   virtual void Flush() {};
    bool RecursiveScan(string const &Dir);
    bool LoadFileList(string const &BaseDir,string const &File);
    void ClearPatterns() { Patterns.clear(); };
@@ -92,18 +108,66 @@ class TranslationWriter
    std::set<string> Included;
    FileFd *Output;
 
+   // Descriptions kept back for the Target until Flush
+   TranslationWriter * const Target;
+   struct Description
+   {
+      string Pkg;
+      string Desc;
+      string MD5;
+   };
+   std::vector<Description> Delayed;
+
+   // Descriptions of the previous Translation-Master file by their md5
+   std::unordered_map<string, string> Previous;
+   bool PreviousLoaded;
+   std::mutex PreviousLock;
+
    public:
    bool DoPackage(string const &Pkg, string const &Desc, string const &MD5);
+   bool Flush();
+   bool FindPrevious(string const &MD5, string &Desc);
 
    TranslationWriter(string const &File, string const &TransCompress, mode_t const &Permissions);
+   explicit TranslationWriter(TranslationWriter * const Target);
    ~TranslationWriter();
 };
 
 class PackagesWriter : public FTWScanner
 {
    Override Over;
+   // the records of a previous Packages file are outdated if one changed
+   std::vector<string> OverrideFiles;
    CacheDB Db;
 
+   // The parts of a record which are gathered before it is written
+   struct Record
+   {
+      string FileName;
+      string OriginalPath;
+      string Package;
+      string Description;
+      string DescriptionMd5;
+      std::vector<pkgTagSection::Tag> Changes;
+      std::vector<string> Notes;
+   };
+   bool Inspect(CacheDB &Db, Record &R);
+   bool WriteRecord(pkgTagSection const &Tags, Record const &R);
+   string IndexFileName(string const &FileName) const;
+
+   /* Packages can be inspected by a pool of threads while the scan goes
+      on, but they are still written in the order they were found */
+   struct Job;
+   std::vector<std::thread> Inspectors;
+   std::mutex JobsLock;
+   std::condition_variable JobQueued;
+   std::condition_variable JobDone;
+   std::deque<Job *> Queue;
+   std::deque<std::unique_ptr<Job>> Pending;
+   bool Stopping;
+   void InspectJobs(std::unique_ptr<CacheDB> JobDb);
+   void WriteJobs(std::unique_lock<std::mutex> &Lock, size_t const Keep);
+
    public:
 
    // Some flags
@@ -118,10 +182,16 @@ class PackagesWriter : public FTWScanner
    struct CacheDB::Stats &Stats;
    TranslationWriter * const TransWriter;
 
-   inline bool ReadOverride(string const &File) {return Over.ReadOverride(File);};
+   unsigned long InspectThreads;
+
+   inline bool ReadOverride(string const &File)
+      {OverrideFiles.push_back(File); return Over.ReadOverride(File);};
    inline bool ReadExtraOverride(string const &File) 
-      {return Over.ReadExtraOverride(File);};
+      {OverrideFiles.push_back(File); return Over.ReadExtraOverride(File);};
    virtual bool DoPackage(string FileName) APT_OVERRIDE;
+   virtual void Flush() APT_OVERRIDE;
+   bool UpdateFromList(FileFd &Previous, string const &Dir, string const &BaseDir,
+		       string const &ChangeList);
 
    PackagesWriter(FileFd * const Output, TranslationWriter * const TransWriter, string const &DB,
                   string const &Overrides,
@@ -183,14 +253,22 @@ class SourcesWriter : public FTWScanner
 
 class ReleaseWriter : public FTWScanner
 {
+   /* Checksums recorded by generate are taken from the manifests, the
+      other files are hashed by a pool of threads once the scan is done */
+   std::map<string, ChecksumsManifest> Manifests;
+   std::vector<std::pair<string, string>> Queued;
+   bool AddFile(string const &FileName, string const &NewFileName, HashStringList const &Sums);
+
 public:
    ReleaseWriter(FileFd * const Output, string const &DB);
    virtual bool DoPackage(string FileName) APT_OVERRIDE;
+   virtual void Flush() APT_OVERRIDE;
    void Finish();
 
    // General options
    string PathPrefix;
    string DirStrip;
+   unsigned long HashThreads;
 
    struct CheckSum
    {
@@ -8,6 +8,8 @@
 #include <algorithm>
 #include <locale>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <sys/time.h>
@@ -24,12 +26,50 @@ static bool hasDoubleColon(std::string const &n)
 
 class aptMethod : public pkgAcqMethod
 {
+   // the configuration done by main() and the method before the first run
+   std::vector<std::pair<std::string, std::string>> InitialConfig;
+
+   static void SnapshotConfig(std::vector<std::pair<std::string, std::string>> &Snapshot)
+   {
+      Snapshot.clear();
+      Configuration::Item const *Top = _config->Tree(0);
+      while (Top != nullptr)
+      {
+	 // empty leaves are kept as their existence can be meaningful
+	 if (Top->Value.empty() == false || Top->Child == nullptr)
+	    Snapshot.emplace_back(Top->FullTag(), Top->Value);
+	 if (Top->Child != nullptr)
+	 {
+	    Top = Top->Child;
+	    continue;
+	 }
+	 while (Top != nullptr && Top->Next == nullptr)
+	    Top = Top->Parent;
+	 if (Top != nullptr)
+	    Top = Top->Next;
+      }
+   }
+
 protected:
    std::string const Binary;
+   bool Configured = false;
 
 public:
    virtual bool Configuration(std::string Message) APT_OVERRIDE
    {
+      /* a method reused for another acquire run gets the complete
+         configuration again which replaces the previous one, but not
+         the settings it had before it got its first configuration */
+      if (Configured == true)
+      {
+	 _config->Clear();
+	 for (auto const &Item : InitialConfig)
+	    _config->Set(Item.first, Item.second);
+      }
+      else
+	 SnapshotConfig(InitialConfig);
+      Configured = true;
+
       if (pkgAcqMethod::Configuration(Message) == false)
 	 return false;
 
@@ -145,6 +185,9 @@ public:
       } catch (...) {
 	 setlocale(LC_ALL, "");
       }
+      // methods hash everything they get, so helper threads pay off here
+      if (std::thread::hardware_concurrency() > 1)
+	 _config->CndSet("APT::Hashes::Parallel", "true");
    }
 };
 
@@ -10,12 +10,17 @@
 // Include Files							/*{{{*/
 #include <config.h>
 
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include <apt-pkg/strutl.h>
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +28,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <map>
@@ -185,14 +191,26 @@ bool RequestState::HeaderLine(string const &Line)			/*{{{*/
 
       // §14.16 says 'byte-range-resp-spec' should be a '*' in case of 416
       if (Result == 416 && sscanf(Val.c_str(), "bytes */%llu",&TotalFileSize) == 1)
-	 ; // we got the expected filesize which is all we wanted
-      else if (sscanf(Val.c_str(),"bytes %llu-%*u/%llu",&StartPos,&TotalFileSize) != 2)
+      {
+	 // we got the expected filesize which is all we wanted
+	 if ((unsigned long long)StartPos > TotalFileSize)
+	    return _error->Error(_("This HTTP server has broken range support"));
+	 DownloadSize = TotalFileSize - StartPos;
+	 return true;
+      }
+
+      unsigned long long EndPos = 0;
+      if (sscanf(Val.c_str(),"bytes %llu-%llu/%llu",&StartPos,&EndPos,&TotalFileSize) != 3)
 	 return _error->Error(_("The HTTP server sent an invalid Content-Range header"));
-      if ((unsigned long long)StartPos > TotalFileSize)
+      if ((unsigned long long)StartPos > TotalFileSize || EndPos >= TotalFileSize)
 	 return _error->Error(_("This HTTP server has broken range support"));
 
-      // figure out what we will download
-      DownloadSize = TotalFileSize - StartPos;
+      // figure out what we will download: usually the rest of the file,
+      // but a segment request asks for a bounded range
+      if (Result == 206 && StartPos <= EndPos)
+	 DownloadSize = EndPos - StartPos + 1;
+      else
+	 DownloadSize = TotalFileSize - StartPos;
       return true;
    }
 
@@ -253,12 +271,210 @@ ServerState::ServerState(URI Srv, BaseHttpMethod *Owner) :
    Reset();
 }
 									/*}}}*/
+bool RequestState::CheckRequestedRange(unsigned long long const RangeStart,/*{{{*/
+      unsigned long long const RangeEnd)
+{
+   unsigned long long const Length = RangeEnd - RangeStart + 1;
+   // https checks (and adjusts) the state already while receiving the headers
+   if (Result == 206 && StartPos == 0 && TotalFileSize == Length && DownloadSize == Length)
+      return true;
+   if (Result != 206 || StartPos != RangeStart || DownloadSize != Length)
+   {
+      Owner->SetFailReason("RangeNotSatisfied");
+      return _error->Error(_("The HTTP server did not send the requested range %llu-%llu"),
+	    RangeStart, RangeEnd);
+   }
+   // the file we write contains only the requested range
+   StartPos = 0;
+   TotalFileSize = Length;
+   return true;
+}
+									/*}}}*/
 bool RequestState::AddPartialFileToHashes(FileFd &File)			/*{{{*/
 {
    File.Truncate(StartPos);
-   return Server->GetHashes()->AddFD(File, StartPos);
+   if (Server->Decompress.IsActive() == false)
+      return Server->GetHashes()->AddFD(File, StartPos);
+
+   // the decompressor has to see the part we have already, too
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[64 * 1024]);
+   for (unsigned long long ToRead = StartPos; ToRead != 0;)
+   {
+      unsigned long long Actual = 0;
+      if (File.Read(Buffer.get(), std::min(ToRead, 64 * 1024ull), &Actual) == false)
+	 return false;
+      if (Actual == 0)
+	 break;
+      if (Server->GetHashes()->Add(Buffer.get(), Actual) == false)
+	 return false;
+      Server->Decompress.Add(Buffer.get(), Actual);
+      ToRead -= Actual;
+   }
+   return true;
 }
 									/*}}}*/
+// StreamDecompressor::Start - decompress the download if asked for	/*{{{*/
+bool StreamDecompressor::Start(std::string const &Download, std::string const &Decompressed, HashStringList const &Hashes)
+{
+   Abort();
+   if (Decompressed.empty() || _config->FindB("Acquire::Decompress-While-Downloading", true) == false)
+      return false;
+
+   std::vector<APT::Configuration::Compressor> const Compressors = APT::Configuration::getCompressors();
+   auto const Compressor = std::find_if(Compressors.begin(), Compressors.end(),
+	 [&](APT::Configuration::Compressor const &C) {
+	    return C.Name != "." && C.Extension.empty() == false && APT::String::Endswith(Download, C.Extension);
+	 });
+   if (Compressor == Compressors.end())
+      return false;
+
+   if (pipe(Pipe) != 0)
+   {
+      Pipe[0] = Pipe[1] = -1;
+      return false;
+   }
+#ifdef F_SETPIPE_SZ
+   // let the download run ahead a bit if the decompressor is busy
+   fcntl(Pipe[1], F_SETPIPE_SZ, 1024 * 1024);
+#endif
+   SetCloseExec(Pipe[0], true);
+   SetCloseExec(Pipe[1], true);
+
+   Target = Decompressed;
+   Types = Hashes;
+   Okay = false;
+   Result.clear();
+   Size = 0;
+   Worker = std::thread(&StreamDecompressor::Run, this, *Compressor);
+   return true;
+}
+									/*}}}*/
+// StreamDecompressor::Run - the decompressing thread			/*{{{*/
+void StreamDecompressor::Run(APT::Configuration::Compressor const Compressor)
+{
+   Hashes Hash(Types);
+   FileFd In, Out;
+   bool Good = In.OpenDescriptor(dup(Pipe[0]), FileFd::ReadOnly, Compressor, true) &&
+      Out.Open(Target, FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::Atomic);
+   if (Good == true)
+   {
+      Out.EraseOnFailure();
+      std::unique_ptr<unsigned char[]> Buffer(new unsigned char[64 * 1024]);
+      while (true)
+      {
+	 unsigned long long Actual = 0;
+	 if (In.Read(Buffer.get(), 64 * 1024, &Actual) == false)
+	 {
+	    Good = false;
+	    break;
+	 }
+	 if (Actual == 0)
+	    break;
+	 Size += Actual;
+	 Hash.Add(Buffer.get(), Actual);
+	 if (Out.Write(Buffer.get(), Actual) == false)
+	 {
+	    Good = false;
+	    break;
+	 }
+      }
+   }
+   In.Close();
+   if (Good == false && Out.IsOpen())
+      Out.OpFail();
+   if (Out.Close() == false)
+      Good = false;
+
+   // the download goes on even if we failed, so consume all of it
+   char Drain[4096];
+   while (true)
+   {
+      ssize_t const Res = read(Pipe[0], Drain, sizeof(Drain));
+      if (Res > 0 || (Res < 0 && errno == EINTR))
+	 continue;
+      break;
+   }
+   close(Pipe[0]);
+   Pipe[0] = -1;
+
+   if (Good == true)
+      Result = Hash.GetHashStringList();
+   else if (_config->FindB("Debug::Acquire::http", false) == true)
+      _error->DumpErrors(std::cerr, GlobalError::DEBUG, false);
+   // errors are local to this thread and nobody would look at them
+   _error->Discard();
+   Okay = Good;
+}
+									/*}}}*/
+// StreamDecompressor::Add - pass on data written to the download	/*{{{*/
+void StreamDecompressor::Add(unsigned char const * const Data, unsigned long long const Count)
+{
+   if (IsActive() == false)
+      return;
+   for (unsigned long long Done = 0; Done < Count;)
+   {
+      ssize_t const Res = write(Pipe[1], Data + Done, Count - Done);
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 // the file will be incomplete, so the hashes will not match
+	 close(Pipe[1]);
+	 Pipe[1] = -1;
+	 return;
+      }
+      Done += Res;
+   }
+}
+									/*}}}*/
+void StreamDecompressor::Join()						/*{{{*/
+{
+   if (Pipe[1] != -1)
+   {
+      close(Pipe[1]);
+      Pipe[1] = -1;
+   }
+   if (Worker.joinable())
+      Worker.join();
+}
+									/*}}}*/
+bool StreamDecompressor::Finish(bool const Keep, time_t const LastModified,/*{{{*/
+      std::string &File, unsigned long long &FileSize, HashStringList &FileHashes)
+{
+   if (IsActive() == false && Worker.joinable() == false)
+      return false;
+   Join();
+   if (Okay == false || Keep == false)
+   {
+      Abort();
+      return false;
+   }
+
+   if (LastModified > 0)
+   {
+      struct timeval times[2];
+      times[0].tv_sec = times[1].tv_sec = LastModified;
+      times[0].tv_usec = times[1].tv_usec = 0;
+      utimes(Target.c_str(), times);
+   }
+   File = Target;
+   FileSize = Size;
+   FileHashes = Result;
+   Target.clear();
+   return true;
+}
+									/*}}}*/
+void StreamDecompressor::Abort()					/*{{{*/
+{
+   Join();
+   if (Target.empty() == false)
+   {
+      RemoveFile("StreamDecompressor", Target);
+      Target.clear();
+   }
+}
+									/*}}}*/
+									/*}}}*/
 void ServerState::Reset()						/*{{{*/
 {
    Persistent = false;
@@ -438,12 +654,37 @@ BaseHttpMethod::DealWithHeaders(FetchResult &Res, RequestState &Req)
       return ERROR_UNRECOVERABLE;
    }
 
+   // a segment request is only satisfied by exactly the requested bytes
+   if (Queue->RangeEnd() != 0 && Req.CheckRequestedRange(Queue->RangeStart(), Queue->RangeEnd()) == false)
+   {
+      if (Req.HaveContent == true)
+	 return ERROR_WITH_CONTENT_PAGE;
+      return ERROR_UNRECOVERABLE;
+   }
+
    // This is some sort of 2xx 'data follows' reply
    Res.LastModified = Req.Date;
    Res.Size = Req.TotalFileSize;
    return FILE_IS_OPEN;
 }
 									/*}}}*/
+// BaseHttpMethod::StartDecompress - decompress while downloading	/*{{{*/
+void BaseHttpMethod::StartDecompress(FetchItem const * const Itm)
+{
+   if (Itm->RangeEnd() != 0)
+      Server->Decompress.Abort();
+   else
+      Server->Decompress.Start(Itm->DestFile, Itm->DecompressTo(), Itm->ExpectedHashes);
+}
+									/*}}}*/
+bool BaseHttpMethod::FinishDecompress(FetchResult &Alt, time_t const LastModified, bool const Keep)/*{{{*/
+{
+   if (Server->Decompress.Finish(Keep, LastModified, Alt.Filename, Alt.Size, Alt.Hashes) == false)
+      return false;
+   Alt.LastModified = LastModified;
+   return true;
+}
+									/*}}}*/
 // BaseHttpMethod::SigTerm - Handle a fatal signal			/*{{{*/
 // ---------------------------------------------------------------------
 /* This closes and timestamps the open file. This is necessary to get
@@ -527,6 +768,7 @@ bool BaseHttpMethod::Fetch(FetchItem *)
       }
       auto const Tmp = QueueBack;
       QueueBack = QueueBack->Next;
+      RequestSent(Tmp);
       SendReq(Tmp);
       ++CurrentDepth;
    } while (CurrentDepth <= AllowedDepth && QueueBack != nullptr);
@@ -575,6 +817,7 @@ int BaseHttpMethod::Loop()
 	 AllowRedirect = ConfigFindB("AllowRedirect", true);
 	 PipelineDepth = ConfigFindI("Pipeline-Depth", 10);
 	 Debug = DebugEnabled();
+	 ResetPipelineStats();
       }
 
       /* If the server has explicitly said this is the last connection
@@ -605,6 +848,7 @@ int BaseHttpMethod::Loop()
       switch (Server->RunHeaders(Req, Queue->Uri))
       {
 	 case ServerState::RUN_HEADERS_OK:
+	 ResponseStarted(Queue);
 	 break;
 	 
 	 // The header data is bad
@@ -664,6 +908,8 @@ int BaseHttpMethod::Loop()
 	       the size now */
 	    if (Res.Size == 0)
 	       Res.Size = Req.File.Size();
+	    if (Result == true)
+	       ResponseDone(Req.File.Size() - Req.StartPos);
 
 	    // Close the file, destroy the FD object and timestamp it
 	    FailFd = -1;
@@ -680,6 +926,9 @@ int BaseHttpMethod::Loop()
 	    {
 	       Hashes * const resultHashes = Server->GetHashes();
 	       HashStringList const hashList = resultHashes->GetHashStringList();
+	       FetchResult AltRes;
+	       bool const Decompressed = FinishDecompress(AltRes, Req.Date,
+		     Queue->ExpectedHashes.usable() == false || Queue->ExpectedHashes == hashList);
 	       if (PipelineDepth != 0 && Queue->ExpectedHashes.usable() == true && Queue->ExpectedHashes != hashList)
 	       {
 		  // we did not get the expected hash… mhhh:
@@ -708,10 +957,11 @@ int BaseHttpMethod::Loop()
 		  }
 	       }
 	       Res.TakeHashes(*resultHashes);
-	       URIDone(Res);
+	       URIDone(Res, Decompressed ? &AltRes : nullptr);
 	    }
 	    else
 	    {
+	       Server->Decompress.Abort();
 	       if (Server->IsOpen() == false)
 	       {
 		  FailCounter++;
@@ -752,6 +1002,7 @@ int BaseHttpMethod::Loop()
 	 // Hard internal error, kill the connection and fail
 	 case ERROR_NOT_FROM_SERVER:
 	 {
+	    Server->Decompress.Abort();
 	    Fail();
 	    RotateDNS();
 	    Server->Close();
@@ -795,6 +1046,112 @@ unsigned long long BaseHttpMethod::FindMaximumObjectSizeInQueue() const	/*{{{*/
    return MaxSizeInQueue;
 }
 									/*}}}*/
+// BaseHttpMethod::*Pipeline* - adapt the depth to the connection	/*{{{*/
+static double TimevalDiff(struct timeval const &Start, struct timeval const &Stop)
+{
+   return (Stop.tv_sec - Start.tv_sec) + (Stop.tv_usec - Start.tv_usec) / 1000000.0;
+}
+void BaseHttpMethod::ResetPipelineStats()
+{
+   bool const Reported = Stats.ReportedDepth != 0;
+   Stats = PipelineStats();
+   Stats.Adaptive = PipelineDepth != 0 && ConfigFindB("Pipeline-Depth::Adaptive", false);
+   // the recommendation for the previous server doesn't apply to the new one
+   if (Reported)
+   {
+      unsigned long const MaxDepth = std::max(1, _config->FindI("Acquire::Max-Pipeline-Depth", 10));
+      if (Debug == true)
+	 std::clog << "Reset pipeline depth to " << MaxDepth << " for " << Server->ServerName.Host << std::endl;
+      std::cout << "105 Pipeline Depth\n"
+		<< "Depth: " << MaxDepth << "\n"
+		<< "\n" << std::flush;
+   }
+}
+void BaseHttpMethod::RequestSent(FetchItem const * const Itm)
+{
+   if (Stats.Adaptive == false)
+      return;
+   // forget requests which were dequeued without a response, e.g. failures
+   for (auto S = Stats.RequestSent.begin(); S != Stats.RequestSent.end();)
+   {
+      FetchItem const *I = Queue;
+      for (; I != nullptr && I != QueueBack; I = I->Next)
+	 if (I->Uri == S->first)
+	    break;
+      if (I == nullptr || I == QueueBack)
+	 S = Stats.RequestSent.erase(S);
+      else
+	 ++S;
+   }
+   gettimeofday(&Stats.RequestSent[Itm->Uri], nullptr);
+}
+void BaseHttpMethod::ResponseStarted(FetchItem const * const Itm)
+{
+   if (Stats.Adaptive == false)
+      return;
+   struct timeval Now;
+   gettimeofday(&Now, nullptr);
+   auto const Sent = Stats.RequestSent.find(Itm->Uri);
+   if (Sent == Stats.RequestSent.end())
+   {
+      Stats.Busy = Now;
+      return;
+   }
+   double const TTFB = TimevalDiff(Sent->second, Now);
+   if (Stats.MinTimeToFirstByte <= 0 || TTFB < Stats.MinTimeToFirstByte)
+      Stats.MinTimeToFirstByte = TTFB;
+   // the connection was idle until this request was sent
+   if (TimevalDiff(Stats.LastDone, Sent->second) > 0)
+      Stats.Busy = Sent->second;
+   else
+      Stats.Busy = Stats.LastDone;
+   Stats.RequestSent.erase(Sent);
+}
+void BaseHttpMethod::ResponseDone(unsigned long long const Bytes)
+{
+   if (Stats.Adaptive == false)
+      return;
+   gettimeofday(&Stats.LastDone, nullptr);
+   Stats.Seconds += std::max(0.0, TimevalDiff(Stats.Busy, Stats.LastDone));
+   Stats.Bytes += Bytes;
+   ++Stats.Objects;
+   // prefer recent measurements as the mix of objects changes during the run
+   if (Stats.Objects > 32)
+   {
+      Stats.Seconds /= 2;
+      Stats.Bytes /= 2;
+      Stats.Objects /= 2;
+   }
+   if (Stats.Objects < 2 || Stats.Bytes == 0 || Stats.Seconds <= 0 ||
+	 Stats.MinTimeToFirstByte <= 0 || Server->Pipeline == false)
+      return;
+
+   /* the bytes in flight needed to fill the pipe (bandwidth-delay product)
+      in units of the average object plus the one currently received. If the
+      throughput is limited by the current depth this grows by one each time
+      until the connection is saturated. */
+   double const Throughput = Stats.Bytes / Stats.Seconds;
+   double const AverageSize = static_cast<double>(Stats.Bytes) / Stats.Objects;
+   double const Wanted = 1 + ceil(Stats.MinTimeToFirstByte * Throughput / AverageSize);
+   unsigned long const MaxDepth = std::max(1, _config->FindI("Acquire::Max-Pipeline-Depth", 10));
+   unsigned long const Depth = Wanted >= MaxDepth ? MaxDepth : static_cast<unsigned long>(Wanted);
+   if (Depth == Stats.ReportedDepth)
+      return;
+   Stats.ReportedDepth = Depth;
+   PipelineDepth = Depth;
+
+   if (Debug == true)
+      std::clog << "Recommend pipeline depth " << Depth << " for " << Server->ServerName.Host
+	 << " (time-to-first-byte: " << Stats.MinTimeToFirstByte << "s, throughput: "
+	 << static_cast<unsigned long long>(Throughput) << " B/s, average size: "
+	 << static_cast<unsigned long long>(AverageSize) << " B)" << std::endl;
+   std::cout << "105 Pipeline Depth\n"
+	     << "Depth: " << Depth << "\n"
+	     << "Time-To-First-Byte: " << Stats.MinTimeToFirstByte << "\n"
+	     << "Throughput: " << static_cast<unsigned long long>(Throughput) << "\n"
+	     << "\n" << std::flush;
+}
+									/*}}}*/
 BaseHttpMethod::BaseHttpMethod(std::string &&Binary, char const * const Ver,unsigned long const Flags) :/*{{{*/
    aptMethod(std::move(Binary), Ver, Flags), Server(nullptr), PipelineDepth(10),
    AllowRedirect(false), Debug(false)
@@ -806,6 +1163,9 @@ bool BaseHttpMethod::Configuration(std::string Message)			/*{{{*/
    if (aptMethod::Configuration(Message) == false)
       return false;
 
+   // the connection was setup with the previous configuration
+   Server = nullptr;
+
    _config->CndSet("Acquire::tor::Proxy",
 	 "socks5h://apt-transport-tor@localhost:9050");
    return true;
@@ -11,14 +11,19 @@
 #ifndef APT_SERVER_H
 #define APT_SERVER_H
 
+#include <apt-pkg/aptconfiguration.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
 #include "aptmethod.h"
 
+#include <sys/time.h>
 #include <time.h>
 #include <iostream>
+#include <map>
 #include <string>
 #include <memory>
+#include <thread>
 
 using std::cout;
 using std::endl;
@@ -27,6 +32,54 @@ class Hashes;
 class BaseHttpMethod;
 struct ServerState;
 
+/** \brief decompresses a file while it is downloaded
+ *
+ *  If the acquire system asks for it with Decompress-To, everything
+ *  written to the downloaded file is passed on through a pipe to a thread
+ *  which decompresses it into the given file and hashes the result. The
+ *  acquire system can use this file directly instead of reading the
+ *  download again with the store method. Failing to decompress is no
+ *  error, the download just has no alternative file then.
+ */
+class StreamDecompressor
+{
+   int Pipe[2] = {-1, -1};
+   std::thread Worker;
+   std::string Target;
+   HashStringList Types;
+   // only touched by the worker until it was joined
+   bool Okay = false;
+   HashStringList Result;
+   unsigned long long Size = 0;
+
+   void Run(APT::Configuration::Compressor const Compressor);
+   void Join();
+
+   public:
+   /** \brief start decompressing the download into \b Target
+    *
+    *  \param Download is the name of the downloaded file, its extension
+    *  decides which compressor is used
+    *  \param Types are the hashes of the download, the same types are
+    *  calculated for the decompressed file */
+   bool Start(std::string const &Download, std::string const &Target, HashStringList const &Types);
+   bool IsActive() const { return Pipe[1] != -1; }
+   /** \brief pass on data which was written to the downloaded file */
+   void Add(unsigned char const * const Data, unsigned long long const Count);
+   /** \brief wait for the decompression to finish
+    *
+    *  \param Keep is false if the download itself isn't usable
+    *  \return true if the decompressed file \b File can be used */
+   bool Finish(bool const Keep, time_t const LastModified, std::string &File,
+	 unsigned long long &FileSize, HashStringList &FileHashes);
+   /** \brief stop decompressing and remove the decompressed file */
+   void Abort();
+
+   StreamDecompressor() = default;
+   StreamDecompressor(StreamDecompressor const &) = delete;
+   ~StreamDecompressor() { Abort(); }
+};
+
 struct RequestState
 {
    unsigned int Major = 0;
@@ -58,6 +111,9 @@ struct RequestState
 
    bool HeaderLine(std::string const &Line);
    bool AddPartialFileToHashes(FileFd &File);
+   /** \brief verify a response to a request of a byte range and setup
+    *  the state to store only this range in the file */
+   bool CheckRequestedRange(unsigned long long const RangeStart, unsigned long long const RangeEnd);
 
    RequestState(BaseHttpMethod * const Owner, ServerState * const Server) :
       Owner(Owner), Server(Server) { time(&Date); }
@@ -73,6 +129,7 @@ struct ServerState
    URI ServerName;
    URI Proxy;
    unsigned long TimeOut;
+   StreamDecompressor Decompress;
 
    protected:
    BaseHttpMethod *Owner;
@@ -126,6 +183,37 @@ class BaseHttpMethod : public aptMethod
    unsigned long PipelineDepth;
    bool AllowRedirect;
 
+   /** \brief decompress the download of \b Itm on the fly if it asks for it */
+   void StartDecompress(FetchItem const * const Itm);
+   /** \brief describe the file decompressed on the fly in \b Alt
+    *
+    *  \param Keep is false if the download itself isn't usable
+    *  \return true if \b Alt can be sent along with the download */
+   bool FinishDecompress(FetchResult &Alt, time_t const LastModified, bool const Keep);
+
+   /** \brief measurements of the current server for the adaptive pipeline depth
+    *
+    *  The smallest time-to-first-byte seen approximates the round trip time,
+    *  the bytes received over the time the pipeline was busy the throughput.
+    *  Together with the average size of the objects they give the number of
+    *  requests which need to be in flight to keep the connection busy. */
+   struct PipelineStats
+   {
+      bool Adaptive = false;
+      std::map<std::string, struct timeval> RequestSent;
+      struct timeval Busy = {0, 0};
+      struct timeval LastDone = {0, 0};
+      double MinTimeToFirstByte = 0;
+      double Seconds = 0;
+      unsigned long long Bytes = 0;
+      unsigned long long Objects = 0;
+      unsigned long ReportedDepth = 0;
+   } Stats;
+   void ResetPipelineStats();
+   void RequestSent(FetchItem const * const Itm);
+   void ResponseStarted(FetchItem const * const Itm);
+   void ResponseDone(unsigned long long const Bytes);
+
    // Find the biggest item in the fetch queue for the checking of the maximum
    // size
    unsigned long long FindMaximumObjectSizeInQueue() const APT_PURE;
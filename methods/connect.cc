@@ -22,11 +22,20 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <iostream>
+#include <limits>
 #include <sstream>
 #include <string.h>
 #include<set>
 #include<string>
+#include <vector>
 
 // Internet stuff
 #include <netinet/in.h>
@@ -43,6 +52,9 @@ static std::string LastHost;
 static int LastPort = 0;
 static struct addrinfo *LastHostAddr = 0;
 static struct addrinfo *LastUsed = 0;
+// storage of LastHostAddr if it was taken from the resolver cache
+static std::vector<struct addrinfo> CachedHostAddr;
+static std::vector<struct sockaddr_storage> CachedHostSockAddr;
 
 static std::vector<SrvRec> SrvRecords;
 
@@ -76,63 +88,286 @@ static bool ConnectionAllowed(char const * const Service, std::string const &Hos
    return true;
 }
 									/*}}}*/
-// DoConnect - Attempt a connect operation				/*{{{*/
+// ResolverCache - Name resolutions shared by all method processes	/*{{{*/
 // ---------------------------------------------------------------------
-/* This helper function attempts a connection to a single address. */
-static bool DoConnect(struct addrinfo *Addr,std::string const &Host,
-		      unsigned long TimeOut,int &Fd,pkgAcqMethod *Owner)
+/* The acquire parent creates the cache file for the duration of a run.
+   Each line consists of the time the entry expires, the key of the lookup
+   and its results as whitespace free words. The file is rewritten in place
+   while holding an exclusive lock on it, so readers only need a shared lock.
+   Failures are silently ignored as the cache is just an optimization. */
+static std::string ResolverCacheFile(std::string const &Key)
 {
-   // Show a status indicator
+   if (_config->FindB("Acquire::Connect::Cache", true) == false ||
+	 Key.find_first_of(" \t\n") != std::string::npos)
+      return "";
+   return _config->Find("Acquire::Connect::Cache::File");
+}
+static bool ReadResolverCache(int const Fd, std::vector<std::string> &Lines)
+{
+   std::string Data;
+   char Buf[4096];
+   ssize_t Res;
+   while ((Res = read(Fd, Buf, sizeof(Buf))) > 0 || (Res < 0 && errno == EINTR))
+      if (Res > 0)
+	 Data.append(Buf, Res);
+   if (Res < 0)
+      return false;
+   for (auto &&Line : VectorizeString(Data, '\n'))
+      if (Line.empty() == false)
+	 Lines.push_back(std::move(Line));
+   return true;
+}
+static bool ResolverCacheLookup(std::string const &Key, std::vector<std::string> &Values)
+{
+   std::string const File = ResolverCacheFile(Key);
+   if (File.empty())
+      return false;
+   bool Found = false;
+   std::vector<std::string> Lines;
+   int const Fd = open(File.c_str(), O_RDONLY | O_CLOEXEC);
+   if (Fd != -1 && flock(Fd, LOCK_SH) == 0 && ReadResolverCache(Fd, Lines) == true)
+   {
+      unsigned long long const Now = time(nullptr);
+      for (auto const &Line : Lines)
+      {
+	 auto const Words = VectorizeString(Line, ' ');
+	 if (Words.size() < 2 || Words[1] != Key || strtoull(Words[0].c_str(), nullptr, 10) <= Now)
+	    continue;
+	 Values.assign(Words.begin() + 2, Words.end());
+	 Found = true;
+	 break;
+      }
+   }
+   if (Fd != -1)
+      close(Fd);
+   if (_config->FindB("Debug::Acquire::Connect", false) == true)
+      std::clog << "Resolver cache " << (Found ? "hit" : "miss") << " for " << Key << std::endl;
+   return Found;
+}
+static void ResolverCacheStore(std::string const &Key, std::vector<std::string> const &Values,
+			       unsigned long TTL)
+{
+   std::string const File = ResolverCacheFile(Key);
+   TTL = std::min<unsigned long>(TTL, _config->FindI("Acquire::Connect::Cache::Max-Age", 60));
+   if (File.empty() || TTL == 0)
+      return;
+   int const Fd = open(File.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+   if (Fd == -1)
+      return;
+   std::vector<std::string> Lines;
+   if (flock(Fd, LOCK_EX) == 0 && ReadResolverCache(Fd, Lines) == true)
+   {
+      // drop expired entries and the previous one for this key
+      unsigned long long const Now = time(nullptr);
+      std::string Data;
+      std::vector<std::string> Keep;
+      for (auto const &Line : Lines)
+      {
+	 auto const Words = VectorizeString(Line, ' ');
+	 if (Words.size() >= 2 && Words[1] != Key && strtoull(Words[0].c_str(), nullptr, 10) > Now)
+	    Keep.push_back(Line);
+      }
+      // the oldest entries are at the start and go first if we have too many
+      size_t const MaxEntries = 255;
+      if (Keep.size() > MaxEntries)
+	 Keep.erase(Keep.begin(), Keep.end() - MaxEntries);
+      for (auto const &Line : Keep)
+	 Data.append(Line).append("\n");
+      Data.append(std::to_string(Now + TTL)).append(" ").append(Key);
+      for (auto const &Value : Values)
+	 Data.append(" ").append(Value);
+      Data.append("\n");
+
+      if (ftruncate(Fd, 0) == 0 && pwrite(Fd, Data.c_str(), Data.length(), 0) == static_cast<ssize_t>(Data.length()) &&
+	    _config->FindB("Debug::Acquire::Connect", false) == true)
+	 std::clog << "Resolver cache stored " << Key << " for " << TTL << " seconds" << std::endl;
+   }
+   close(Fd);
+}
+									/*}}}*/
+// Cached addresses and SRV records					/*{{{*/
+static void FreeLastHostAddr()
+{
+   if (LastHostAddr != 0 && CachedHostAddr.empty() == true)
+      freeaddrinfo(LastHostAddr);
+   CachedHostAddr.clear();
+   CachedHostSockAddr.clear();
+   LastHostAddr = 0;
+   LastUsed = 0;
+}
+static void StoreAddresses(std::string const &Key, struct addrinfo const * const Addrs)
+{
+   std::vector<std::string> Values;
+   for (auto Addr = Addrs; Addr != 0; Addr = Addr->ai_next)
+   {
+      char Name[NI_MAXHOST];
+      char Service[NI_MAXSERV];
+      if ((Addr->ai_family != AF_INET && Addr->ai_family != AF_INET6) ||
+	    getnameinfo(Addr->ai_addr, Addr->ai_addrlen, Name, sizeof(Name), Service, sizeof(Service),
+			NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+	 return;
+      std::string Value;
+      strprintf(Value, "%d,%d,%d,%s,%s", Addr->ai_family, Addr->ai_socktype, Addr->ai_protocol, Name, Service);
+      Values.push_back(Value);
+   }
+   // getaddrinfo doesn't tell us the TTLs, so we use the maximum age
+   ResolverCacheStore(Key, Values, std::numeric_limits<unsigned long>::max());
+}
+static bool LookupAddresses(std::string const &Key)
+{
+   std::vector<std::string> Values;
+   if (ResolverCacheLookup(Key, Values) == false || Values.empty() == true)
+      return false;
+   std::vector<struct addrinfo> Addrs(Values.size());
+   std::vector<struct sockaddr_storage> SockAddrs(Values.size());
+   for (size_t I = 0; I < Values.size(); ++I)
+   {
+      auto const Fields = VectorizeString(Values[I], ',');
+      if (Fields.size() != 5)
+	 return false;
+      struct addrinfo &Addr = Addrs[I];
+      memset(&Addr, 0, sizeof(Addr));
+      memset(&SockAddrs[I], 0, sizeof(SockAddrs[I]));
+      Addr.ai_family = atoi(Fields[0].c_str());
+      Addr.ai_socktype = atoi(Fields[1].c_str());
+      Addr.ai_protocol = atoi(Fields[2].c_str());
+      Addr.ai_addr = reinterpret_cast<struct sockaddr *>(&SockAddrs[I]);
+      uint16_t const Port = htons(atoi(Fields[4].c_str()));
+      if (Addr.ai_family == AF_INET)
+      {
+	 auto const In = reinterpret_cast<struct sockaddr_in *>(Addr.ai_addr);
+	 In->sin_family = AF_INET;
+	 In->sin_port = Port;
+	 Addr.ai_addrlen = sizeof(*In);
+	 if (inet_pton(AF_INET, Fields[3].c_str(), &In->sin_addr) != 1)
+	    return false;
+      }
+      else if (Addr.ai_family == AF_INET6)
+      {
+	 auto const In6 = reinterpret_cast<struct sockaddr_in6 *>(Addr.ai_addr);
+	 In6->sin6_family = AF_INET6;
+	 In6->sin6_port = Port;
+	 Addr.ai_addrlen = sizeof(*In6);
+	 if (inet_pton(AF_INET6, Fields[3].c_str(), &In6->sin6_addr) != 1)
+	    return false;
+      }
+      else
+	 return false;
+      if (I != 0)
+	 Addrs[I - 1].ai_next = &Addr;
+   }
+   CachedHostAddr.swap(Addrs);
+   CachedHostSockAddr.swap(SockAddrs);
+   LastHostAddr = CachedHostAddr.data();
+   return true;
+}
+static void GetCachedSrvRecords(std::string const &Host, int const Port, std::vector<SrvRec> &Result)
+{
+   std::string const Key = "srv:" + Host + ":" + std::to_string(Port);
+   std::vector<std::string> Values;
+   if (ResolverCacheLookup(Key, Values) == true)
+   {
+      for (auto const &Value : Values)
+      {
+	 auto const Fields = VectorizeString(Value, ',');
+	 if (Fields.size() != 4)
+	 {
+	    Result.clear();
+	    break;
+	 }
+	 // the RFC2782 '.' target is stored as such to keep the field
+	 Result.emplace_back(Fields[0] == "." ? "" : Fields[0], atoi(Fields[1].c_str()),
+			     atoi(Fields[2].c_str()), atoi(Fields[3].c_str()));
+      }
+      if (Result.size() == Values.size())
+	 return;
+   }
+
+   unsigned long TTL;
+   GetSrvRecords(Host, Port, Result, TTL);
+   Values.clear();
+   for (auto const &Rec : Result)
+   {
+      std::string Value;
+      strprintf(Value, "%s,%u,%u,%u", Rec.target.empty() ? "." : Rec.target.c_str(),
+		Rec.priority, Rec.weight, Rec.port);
+      Values.push_back(Value);
+   }
+   ResolverCacheStore(Key, Values, TTL);
+}
+									/*}}}*/
+// ConnectAttempt - A connection in progress to a single address	/*{{{*/
+struct ConnectAttempt
+{
+   struct addrinfo *Addr;
+   int Fd;
+   struct timeval Deadline;
    char Name[NI_MAXHOST];
    char Service[NI_MAXSERV];
-   
-   Name[0] = 0;   
-   Service[0] = 0;
-   getnameinfo(Addr->ai_addr,Addr->ai_addrlen,
-	       Name,sizeof(Name),Service,sizeof(Service),
-	       NI_NUMERICHOST|NI_NUMERICSERV);
-   Owner->Status(_("Connecting to %s (%s)"),Host.c_str(),Name);
-
-   // if that addr did timeout before, we do not try it again
-   if(bad_addr.find(std::string(Name)) != bad_addr.end())
-      return false;
 
-   /* If this is an IP rotation store the IP we are using.. If something goes
-      wrong this will get tacked onto the end of the error message */
-   if (LastHostAddr->ai_next != 0)
+   explicit ConnectAttempt(struct addrinfo * const Addr) : Addr(Addr), Fd(-1)
    {
-      std::stringstream ss;
-      ioprintf(ss, _("[IP: %s %s]"),Name,Service);
-      Owner->SetIP(ss.str());
+      Name[0] = 0;
+      Service[0] = 0;
+      getnameinfo(Addr->ai_addr,Addr->ai_addrlen,
+		  Name,sizeof(Name),Service,sizeof(Service),
+		  NI_NUMERICHOST|NI_NUMERICSERV);
    }
-      
+};
+static void SetAttemptIP(ConnectAttempt const &A, bool const Rotation, pkgAcqMethod * const Owner)
+{
+   /* If this is an IP rotation store the IP we are using.. If something goes
+      wrong this will get tacked onto the end of the error message */
+   if (Rotation == false)
+      return;
+   std::stringstream ss;
+   ioprintf(ss, _("[IP: %s %s]"),A.Name,A.Service);
+   Owner->SetIP(ss.str());
+}
+static int MillisecondsUntil(struct timeval const &When, struct timeval const &Now)
+{
+   long long const Diff = (When.tv_sec - Now.tv_sec) * 1000ll + (When.tv_usec - Now.tv_usec) / 1000;
+   return std::max(0ll, std::min(Diff, 24ll * 60 * 60 * 1000));
+}
+									/*}}}*/
+// StartConnect - Start a connect operation				/*{{{*/
+// ---------------------------------------------------------------------
+/* This helper function initiates a nonblocking connection to a single
+   address which times out after TimeOut seconds. */
+static bool StartConnect(ConnectAttempt &A,std::string const &Host,
+		      unsigned long TimeOut,pkgAcqMethod *Owner)
+{
+   // Show a status indicator
+   Owner->Status(_("Connecting to %s (%s)"),Host.c_str(),A.Name);
+
    // Get a socket
-   if ((Fd = socket(Addr->ai_family,Addr->ai_socktype,
+   struct addrinfo const * const Addr = A.Addr;
+   if ((A.Fd = socket(Addr->ai_family,Addr->ai_socktype,
 		    Addr->ai_protocol)) < 0)
       return _error->Errno("socket",_("Could not create a socket for %s (f=%u t=%u p=%u)"),
-			   Name,Addr->ai_family,Addr->ai_socktype,Addr->ai_protocol);
-   
-   SetNonBlock(Fd,true);
-   if (connect(Fd,Addr->ai_addr,Addr->ai_addrlen) < 0 &&
+			   A.Name,Addr->ai_family,Addr->ai_socktype,Addr->ai_protocol);
+
+   SetNonBlock(A.Fd,true);
+   if (connect(A.Fd,Addr->ai_addr,Addr->ai_addrlen) < 0 &&
        errno != EINPROGRESS)
       return _error->Errno("connect",_("Cannot initiate the connection "
-			   "to %s:%s (%s)."),Host.c_str(),Service,Name);
-   
-   /* This implements a timeout for connect by opening the connection
-      nonblocking */
-   if (WaitFd(Fd,true,TimeOut) == false) {
-      bad_addr.insert(bad_addr.begin(), std::string(Name));
-      Owner->SetFailReason("Timeout");
-      return _error->Error(_("Could not connect to %s:%s (%s), "
-			   "connection timed out"),Host.c_str(),Service,Name);
-   }
+			   "to %s:%s (%s)."),Host.c_str(),A.Service,A.Name);
 
+   gettimeofday(&A.Deadline, nullptr);
+   A.Deadline.tv_sec += TimeOut;
+   return true;
+}
+									/*}}}*/
+// FinishConnect - Check the result of a completed connect operation	/*{{{*/
+static bool FinishConnect(ConnectAttempt const &A,std::string const &Host,
+			  pkgAcqMethod *Owner)
+{
    // Check the socket for an error condition
    unsigned int Err;
    unsigned int Len = sizeof(Err);
-   if (getsockopt(Fd,SOL_SOCKET,SO_ERROR,&Err,&Len) != 0)
+   if (getsockopt(A.Fd,SOL_SOCKET,SO_ERROR,&Err,&Len) != 0)
       return _error->Errno("getsockopt",_("Failed"));
-   
+
    if (Err != 0)
    {
       errno = Err;
@@ -140,14 +375,154 @@ static bool DoConnect(struct addrinfo *Addr,std::string const &Host,
          Owner->SetFailReason("ConnectionRefused");
       else if (errno == ETIMEDOUT)
 	 Owner->SetFailReason("ConnectionTimedOut");
-      bad_addr.insert(bad_addr.begin(), std::string(Name));
+      bad_addr.insert(bad_addr.begin(), std::string(A.Name));
       return _error->Errno("connect",_("Could not connect to %s:%s (%s)."),Host.c_str(),
-			   Service,Name);
+			   A.Service,A.Name);
    }
-   
+
    return true;
 }
 									/*}}}*/
+// ConnectToAddresses - Race connections to the addresses of a host	/*{{{*/
+// ---------------------------------------------------------------------
+/* Implements the connection racing of "Happy Eyeballs" (RFC 8305): the
+   address families are interleaved starting with the one of the first
+   address and a new attempt is started whenever the previous one failed
+   or hasn't succeeded within Acquire::Connect::Attempt-Delay milliseconds,
+   without giving up on it, so that a blackholed address (e.g. a broken
+   IPv6 route) doesn't stall us for the whole TimeOut. The first attempt
+   to succeed wins and all others are closed. */
+bool ConnectToAddresses(std::vector<struct addrinfo *> const &Addresses,
+			std::string const &Host, unsigned long const TimeOut,
+			int &Fd, struct addrinfo *&Used, pkgAcqMethod * const Owner)
+{
+   Fd = -1;
+   Used = nullptr;
+
+   std::vector<ConnectAttempt> Candidates;
+   {
+      std::vector<ConnectAttempt> Preferred, Others;
+      for (auto const Addr : Addresses)
+      {
+	 // Ignore UNIX domain sockets
+	 if (Addr->ai_family == AF_UNIX)
+	    continue;
+	 ConnectAttempt A(Addr);
+	 // if that addr did timeout before, we do not try it again
+	 if (bad_addr.find(std::string(A.Name)) != bad_addr.end())
+	    continue;
+	 if (Addr->ai_family == Addresses.front()->ai_family)
+	    Preferred.push_back(A);
+	 else
+	    Others.push_back(A);
+      }
+      for (size_t I = 0; I < std::max(Preferred.size(), Others.size()); ++I)
+      {
+	 if (I < Preferred.size())
+	    Candidates.push_back(Preferred[I]);
+	 if (I < Others.size())
+	    Candidates.push_back(Others[I]);
+      }
+   }
+   bool const Rotation = Addresses.size() > 1;
+   int const AttemptDelay = _config->FindI("Acquire::Connect::Attempt-Delay", 250);
+
+   /* only the errors of the last failed attempt are reported, so the
+      previous ones are discarded before another attempt can fail */
+   auto const Prepare = [&](ConnectAttempt const &A) {
+      _error->Discard();
+      SetAttemptIP(A, Rotation, Owner);
+   };
+
+   std::vector<ConnectAttempt> Pending;
+   std::vector<struct pollfd> Poll;
+   auto Next = Candidates.begin();
+   struct timeval Now, NextStart;
+   gettimeofday(&NextStart, nullptr);
+   while (Next != Candidates.end() || Pending.empty() == false)
+   {
+      gettimeofday(&Now, nullptr);
+      if (Next != Candidates.end() && MillisecondsUntil(NextStart, Now) == 0)
+      {
+	 ConnectAttempt A = *Next++;
+	 Prepare(A);
+	 if (StartConnect(A, Host, TimeOut, Owner) == false)
+	 {
+	    // the next one can start right away
+	    if (A.Fd != -1)
+	       close(A.Fd);
+	    continue;
+	 }
+	 Pending.push_back(A);
+	 NextStart = Now;
+	 NextStart.tv_sec += AttemptDelay / 1000;
+	 NextStart.tv_usec += (AttemptDelay % 1000) * 1000;
+	 if (NextStart.tv_usec >= 1000000)
+	 {
+	    ++NextStart.tv_sec;
+	    NextStart.tv_usec -= 1000000;
+	 }
+	 continue;
+      }
+
+      // wait for an attempt to complete or time out or the next to be due
+      int Wait = -1;
+      if (Next != Candidates.end())
+	 Wait = MillisecondsUntil(NextStart, Now);
+      Poll.clear();
+      for (auto const &A : Pending)
+      {
+	 struct pollfd P = { A.Fd, POLLOUT, 0 };
+	 Poll.push_back(P);
+	 int const Remaining = MillisecondsUntil(A.Deadline, Now);
+	 if (Wait == -1 || Remaining < Wait)
+	    Wait = Remaining;
+      }
+      if (poll(Poll.data(), Poll.size(), Wait) < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 for (auto const &A : Pending)
+	    close(A.Fd);
+	 return _error->Errno("poll", _("Failed"));
+      }
+      gettimeofday(&Now, nullptr);
+
+      for (size_t I = Pending.size(); I-- > 0;)
+      {
+	 ConnectAttempt const A = Pending[I];
+	 if (Poll[I].revents != 0)
+	 {
+	    Prepare(A);
+	    if (FinishConnect(A, Host, Owner) == true)
+	    {
+	       for (auto const &O : Pending)
+		  if (O.Fd != A.Fd)
+		     close(O.Fd);
+	       Fd = A.Fd;
+	       Used = A.Addr;
+	       return true;
+	    }
+	    // a failed attempt lets the next one start right away
+	    NextStart = Now;
+	 }
+	 else if (MillisecondsUntil(A.Deadline, Now) == 0)
+	 {
+	    Prepare(A);
+	    bad_addr.insert(bad_addr.begin(), std::string(A.Name));
+	    Owner->SetFailReason("Timeout");
+	    _error->Error(_("Could not connect to %s:%s (%s), "
+			    "connection timed out"),Host.c_str(),A.Service,A.Name);
+	 }
+	 else
+	    continue;
+	 close(A.Fd);
+	 Pending.erase(Pending.begin() + I);
+      }
+   }
+   return false;
+}
+									/*}}}*/
 // Connect to a given Hostname						/*{{{*/
 static bool ConnectToHostname(std::string const &Host, int const Port,
       const char * const Service, int DefPort, int &Fd,
@@ -170,12 +545,7 @@ static bool ConnectToHostname(std::string const &Host, int const Port,
       Owner->Status(_("Connecting to %s"),Host.c_str());
 
       // Free the old address structure
-      if (LastHostAddr != 0)
-      {
-	 freeaddrinfo(LastHostAddr);
-	 LastHostAddr = 0;
-	 LastUsed = 0;
-      }
+      FreeLastHostAddr();
       
       // We only understand SOCK_STREAM sockets.
       struct addrinfo Hints;
@@ -204,8 +574,11 @@ static bool ConnectToHostname(std::string const &Host, int const Port,
       if(bad_addr.find(Host) != bad_addr.end()) 
 	 return _error->Error(_("Could not resolve '%s'"),Host.c_str());
 
+      std::string CacheKey;
+      strprintf(CacheKey, "addr:%s:%s:%d:%d", Host.c_str(), ServStr, Hints.ai_family, Hints.ai_flags);
+
       // Resolve both the host and service simultaneously
-      while (1)
+      while (LookupAddresses(CacheKey) == false)
       {
 	 int Res;
 	 if ((Res = getaddrinfo(Host.c_str(),ServStr,&Hints,&LastHostAddr)) != 0 ||
@@ -236,6 +609,7 @@ static bool ConnectToHostname(std::string const &Host, int const Port,
 	    return _error->Error(_("Something wicked happened resolving '%s:%s' (%i - %s)"),
 				 Host.c_str(),ServStr,Res,gai_strerror(Res));
 	 }
+	 StoreAddresses(CacheKey, LastHostAddr);
 	 break;
       }
       
@@ -247,36 +621,20 @@ static bool ConnectToHostname(std::string const &Host, int const Port,
    struct addrinfo *CurHost = LastHostAddr;
    if (LastUsed != 0)
        CurHost = LastUsed;
-   
-   while (CurHost != 0)
-   {
-      if (DoConnect(CurHost,Host,TimeOut,Fd,Owner) == true)
-      {
-	 LastUsed = CurHost;
-	 return true;
-      }      
-      close(Fd);
-      Fd = -1;
-      
-      // Ignore UNIX domain sockets
-      do
-      {
-	 CurHost = CurHost->ai_next;
-      }
-      while (CurHost != 0 && CurHost->ai_family == AF_UNIX);
 
-      /* If we reached the end of the search list then wrap around to the
-         start */
-      if (CurHost == 0 && LastUsed != 0)
-	 CurHost = LastHostAddr;
-      
-      // Reached the end of the search cycle
-      if (CurHost == LastUsed)
-	 break;
-      
-      if (CurHost != 0)
-	 _error->Discard();
-   }   
+   // try all addresses starting with that one and wrapping around
+   std::vector<struct addrinfo *> Addresses;
+   for (struct addrinfo *Addr = CurHost; Addr != 0; Addr = Addr->ai_next)
+      Addresses.push_back(Addr);
+   for (struct addrinfo *Addr = LastHostAddr; Addr != CurHost; Addr = Addr->ai_next)
+      Addresses.push_back(Addr);
+
+   struct addrinfo *Used = nullptr;
+   if (ConnectToAddresses(Addresses, Host, TimeOut, Fd, Used, Owner) == true)
+   {
+      LastUsed = Used;
+      return true;
+   }
 
    if (_error->PendingError() == true)
       return false;   
@@ -301,7 +659,7 @@ bool Connect(std::string Host,int Port,const char *Service,
       SrvRecords.clear();
       if (_config->FindB("Acquire::EnableSrvRecords", true) == true)
       {
-         GetSrvRecords(Host, DefPort, SrvRecords);
+         GetCachedSrvRecords(Host, DefPort, SrvRecords);
 	 // RFC2782 defines that a lonely '.' target is an abort reason
 	 if (SrvRecords.size() == 1 && SrvRecords[0].target.empty())
 	    return _error->Error("SRV records for %s indicate that "
@@ -11,11 +11,16 @@
 #define CONNECT_H
 
 #include <string>
+#include <vector>
 
 class pkgAcqMethod;
+struct addrinfo;
 
 bool Connect(std::string To,int Port,const char *Service,int DefPort,
 	     int &Fd,unsigned long TimeOut,pkgAcqMethod *Owner);
 void RotateDNS();
+bool ConnectToAddresses(std::vector<struct addrinfo *> const &Addresses,
+			std::string const &Host, unsigned long TimeOut,
+			int &Fd, struct addrinfo *&Used, pkgAcqMethod *Owner);
 
 #endif
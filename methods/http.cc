@@ -47,6 +47,7 @@
 #include <arpa/inet.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 
 #include "config.h"
 #include "connect.h"
@@ -60,12 +61,13 @@ unsigned long long CircleBuf::BwReadLimit=0;
 unsigned long long CircleBuf::BwTickReadData=0;
 struct timeval CircleBuf::BwReadTick={0,0};
 const unsigned int CircleBuf::BW_HZ=10;
+static constexpr size_t PassThroughSize = 1024 * 1024;
 
 // CircleBuf::CircleBuf - Circular input buffer				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
 CircleBuf::CircleBuf(HttpMethod const * const Owner, unsigned long long Size)
-   : Size(Size), Hash(NULL), TotalWriten(0)
+   : Size(Size), Hash(NULL), Decompress(nullptr), TotalWriten(0)
 {
    Buf = new unsigned char[Size];
    Reset();
@@ -224,11 +226,71 @@ bool CircleBuf::Write(int Fd)
       
       if (Hash != NULL)
 	 Hash->Add(Buf + (OutP%Size),Res);
+      if (Decompress != nullptr)
+	 Decompress->Add(Buf + (OutP%Size),Res);
       
       OutP += Res;
    }
 }
 									/*}}}*/
+// CircleBuf::PassThrough - Move data from FD to FD bypassing the ring	/*{{{*/
+// ---------------------------------------------------------------------
+/* If the ring is empty and the end of the data is known, reading can't
+   overrun into the next response, so the data is read into a large buffer,
+   written out and hashed from there. This avoids splitting the data into
+   the small pieces the ring allows, which makes a big difference on fast
+   links, but can't be used if the bandwidth is limited. */
+bool CircleBuf::PassThroughPossible() const
+{
+   return BwReadLimit == 0 && InP == OutP && OutQueue.empty() == true &&
+      MaxGet != (unsigned long long)-1 && MaxGet > OutP;
+}
+bool CircleBuf::PassThrough(int const InFd, int const OutFd, bool &WriteFailed)
+{
+   WriteFailed = false;
+   if (PassThroughBuf == nullptr)
+      PassThroughBuf.reset(new unsigned char[PassThroughSize]);
+   unsigned char * const PBuf = PassThroughBuf.get();
+
+   // return to the select loop now and then to handle the other fds
+   for (unsigned int Rounds = 0; Rounds < 16 && OutP != MaxGet; ++Rounds)
+   {
+      ssize_t const Res = read(InFd, PBuf, std::min<unsigned long long>(PassThroughSize, MaxGet - OutP));
+      if (Res == 0)
+	 return false;
+      if (Res < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 return errno == EAGAIN;
+      }
+
+      for (ssize_t Written = 0; Written < Res;)
+      {
+	 ssize_t const W = write(OutFd, PBuf + Written, Res - Written);
+	 if (W < 0 && errno == EINTR)
+	    continue;
+	 if (W <= 0)
+	 {
+	    WriteFailed = true;
+	    return false;
+	 }
+	 Written += W;
+      }
+
+      if (InP == 0)
+	 gettimeofday(&Start,0);
+      TotalWriten += Res;
+      if (Hash != NULL)
+	 Hash->Add(PBuf, Res);
+      if (Decompress != nullptr)
+	 Decompress->Add(PBuf, Res);
+      InP += Res;
+      OutP += Res;
+   }
+   return true;
+}
+									/*}}}*/
 // CircleBuf::WriteTillEl - Write from the buffer to a string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This copies till the first empty line */
@@ -291,6 +353,7 @@ CircleBuf::~CircleBuf()
 HttpServerState::HttpServerState(URI Srv,HttpMethod *Owner) : ServerState(Srv, Owner), In(Owner, 64*1024), Out(Owner, 4*1024)
 {
    TimeOut = Owner->ConfigFindI("Timeout", TimeOut);
+   In.Decompress = &Decompress;
    Reset();
 }
 									/*}}}*/
@@ -836,7 +899,17 @@ bool HttpServerState::Go(bool ToFile, RequestState &Req)
    if (ServerFd != -1 && FD_ISSET(ServerFd,&rfds))
    {
       errno = 0;
-      if (In.Read(ServerFd) == false)
+      if (ToFile == true && FileFD != -1 && In.PassThroughPossible() == true)
+      {
+	 bool WriteFailed;
+	 if (In.PassThrough(ServerFd, FileFD, WriteFailed) == false)
+	 {
+	    if (WriteFailed == true)
+	       return _error->Errno("write",_("Error writing to output file"));
+	    return Die(Req);
+	 }
+      }
+      else if (In.Read(ServerFd) == false)
 	 return Die(Req);
    }
 	 
@@ -940,7 +1013,10 @@ void HttpMethod::SendReq(FetchItem *Itm)
 
    // Check for a partial file and send if-queries accordingly
    struct stat SBuf;
-   if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+   if (Itm->RangeEnd() != 0)
+      Req << "Range: bytes=" << std::to_string(Itm->RangeStart()) << "-"
+	 << std::to_string(Itm->RangeEnd()) << "\r\n";
+   else if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
       Req << "Range: bytes=" << std::to_string(SBuf.st_size) << "-\r\n"
 	 << "If-Range: " << TimeRFC1123(SBuf.st_mtime, false) << "\r\n";
    else if (Itm->LastModified != 0)
@@ -990,6 +1066,7 @@ BaseHttpMethod::DealWithHeadersResult HttpMethod::DealWithHeaders(FetchResult &R
    FailFd = Req.File.Fd();
    FailTime = Req.Date;
 
+   StartDecompress(Queue);
    if (Server->InitHashes(Queue->ExpectedHashes) == false || Req.AddPartialFileToHashes(Req.File) == false)
    {
       _error->Errno("read",_("Problem hashing file"));
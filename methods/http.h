@@ -13,6 +13,7 @@
 
 #include <apt-pkg/strutl.h>
 
+#include <memory>
 #include <string>
 #include <sys/time.h>
 #include <iostream>
@@ -36,6 +37,8 @@ class CircleBuf
    unsigned long long StrPos;
    unsigned long long MaxGet;
    struct timeval Start;
+   // the data passes through this instead of the ring if possible
+   std::unique_ptr<unsigned char[]> PassThroughBuf;
 
    static unsigned long long BwReadLimit;
    static unsigned long long BwTickReadData;
@@ -62,6 +65,8 @@ class CircleBuf
 
    public:
    Hashes *Hash;
+   // gets everything written out as well if set
+   StreamDecompressor *Decompress;
    // total amount of data that got written so far
    unsigned long long TotalWriten;
 
@@ -69,6 +74,10 @@ class CircleBuf
    bool Read(int Fd);
    bool Read(std::string const &Data);
 
+   // Read data in and write it out again right away bypassing the ring
+   bool PassThroughPossible() const;
+   bool PassThrough(int InFd, int OutFd, bool &WriteFailed);
+
    // Write data out
    bool Write(int Fd);
    bool WriteTillEl(std::string &Data,bool Single = false);
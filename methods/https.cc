@@ -68,7 +68,13 @@ HttpsMethod::parse_header(void *buffer, size_t size, size_t nmemb, void *userp)
 	 return ERROR_NOT_FROM_SERVER;
 
       me->Req->JunkSize = 0;
-      if (me->Req->Result != 416 && me->Req->StartPos != 0)
+      if (me->Itm->RangeEnd() != 0)
+      {
+	 if (me->Req->Result >= 200 && me->Req->Result < 300 &&
+	       me->Req->CheckRequestedRange(me->Itm->RangeStart(), me->Itm->RangeEnd()) == false)
+	    return 0;
+      }
+      else if (me->Req->Result != 416 && me->Req->StartPos != 0)
 	 ;
       else if (me->Req->Result == 416)
       {
@@ -109,6 +115,7 @@ HttpsMethod::parse_header(void *buffer, size_t size, size_t nmemb, void *userp)
       {
 	 if (me->Res->Size != 0 && me->Res->Size > me->Res->ResumePoint)
 	    me->https->URIStart(*me->Res);
+	 me->https->StartDecompress(me->Itm);
 	 if (me->Req->AddPartialFileToHashes(me->Req->File) == false)
 	    return 0;
       }
@@ -148,6 +155,7 @@ HttpsMethod::write_data(void *buffer, size_t size, size_t nmemb, void *userp)
 
    if (me->https->Server->GetHashes()->Add((unsigned char const * const)buffer, buffer_size) == false)
       return 0;
+   me->https->Server->Decompress.Add(static_cast<unsigned char const *>(buffer), buffer_size);
 
    return buffer_size;
 }
@@ -399,7 +407,13 @@ bool HttpsMethod::Fetch(FetchItem *Itm)
    }
 
    // if we have the file send an if-range query with a range header
-   if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+   if (Itm->RangeEnd() != 0)
+   {
+      std::string Buf;
+      strprintf(Buf, "Range: bytes=%llu-%llu", Itm->RangeStart(), Itm->RangeEnd());
+      headers = curl_slist_append(headers, Buf.c_str());
+   }
+   else if (Server->RangesAllowed && stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
    {
       std::string Buf;
       strprintf(Buf, "Range: bytes=%lli-", (long long) SBuf.st_size);
@@ -435,6 +449,7 @@ bool HttpsMethod::Fetch(FetchItem *Itm)
    // cleanup
    if (success != CURLE_OK)
    {
+      Server->Decompress.Abort();
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wswitch"
       switch (success)
@@ -460,7 +475,10 @@ bool HttpsMethod::Fetch(FetchItem *Itm)
       return false;
    }
 
-   switch (DealWithHeaders(Res, Req))
+   auto const Result = DealWithHeaders(Res, Req);
+   if (Result != BaseHttpMethod::FILE_IS_OPEN)
+      Server->Decompress.Abort();
+   switch (Result)
    {
       case BaseHttpMethod::IMS_HIT:
 	 URIDone(Res);
@@ -503,7 +521,14 @@ bool HttpsMethod::Fetch(FetchItem *Itm)
 	 Res.TakeHashes(*(Server->GetHashes()));
 
 	 // keep apt updated
-	 URIDone(Res);
+	 {
+	    FetchResult AltRes;
+	    if (FinishDecompress(AltRes, Res.LastModified,
+		     Itm->ExpectedHashes.usable() == false || Itm->ExpectedHashes == Res.Hashes))
+	       URIDone(Res, &AltRes);
+	    else
+	       URIDone(Res);
+	 }
 	 break;
    }
    return true;
@@ -13,95 +13,165 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/hashes.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/mmap.h>
 #include "aptmethod.h"
 
 #include <stddef.h>
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <string>
 #include <list>
 #include <vector>
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <apti18n.h>
 
 #define BLOCK_SIZE (512*1024)
 
-class MemBlock {
-   char *start;
+/* The complete content of a file: uncompressed files are mapped, everything
+   else (compressed files, pipes) is read into memory in one go. Changes keep
+   pointing into the content, so it can't be copied or moved. */
+class FileContent {
+   std::unique_ptr<MMap> map;
+   std::string buffer;
+   char const *start;
    size_t size;
-   char *free;
-   MemBlock *next;
 
-   explicit MemBlock(size_t size) : size(size), next(NULL)
+   public:
+   FileContent() : start(NULL), size(0) {}
+   FileContent(FileContent const &) = delete;
+   FileContent &operator=(FileContent const &) = delete;
+
+   bool open(FileFd &f)
    {
-      free = start = new char[size];
+      struct stat buf;
+      if (f.IsCompressed() == false && fstat(f.Fd(), &buf) == 0 &&
+	    S_ISREG(buf.st_mode) && buf.st_size != 0) {
+	 map.reset(new MMap(f, MMap::ReadOnly));
+	 if (map->validData() == false)
+	    return _error->Error("Mapping file %s failed", f.Name().c_str());
+	 start = static_cast<char const *>(map->Data());
+	 size = map->Size();
+	 return true;
+      }
+      char block[BLOCK_SIZE];
+      unsigned long long l = 0;
+      do {
+	 if (f.Read(block, sizeof(block), &l) == false)
+	    return _error->Error("Reading file %s failed", f.Name().c_str());
+	 buffer.append(block, l);
+      } while (l != 0);
+      start = buffer.data();
+      size = buffer.size();
+      return true;
    }
 
-   size_t avail(void) { return size - (free - start); }
-
-   public:
+   char const *begin() const { return start; }
+   char const *end() const { return start + size; }
+   bool empty() const { return size == 0; }
+};
 
-   MemBlock(void) {
-      free = start = new char[BLOCK_SIZE];
-      size = BLOCK_SIZE;
-      next = NULL;
+/* forward over <n> lines, a missing newline at the end still ends a line */
+static char const *forward_lines(char const *p, char const * const end, size_t n)
+{
+   for (; n > 0 && p != end; --n) {
+      char const * const nl = static_cast<char const *>(memchr(p, '\n', end - p));
+      if (nl == NULL)
+	 return end;
+      p = nl + 1;
    }
+   return p;
+}
+
+/* Collects the pieces of the result and writes them in large batches,
+   with writev directly to the file descriptor if the output isn't
+   compressed. Pieces are only referenced, so unchanged lines of the
+   input and the added lines of the patches are never copied. */
+class BatchWriter {
+#ifdef IOV_MAX
+   enum { batch_size = IOV_MAX };
+#else
+   enum { batch_size = 1024 };
+#endif
+   FileFd &out;
+   Hashes * const hash;
+   std::vector<struct iovec> pieces;
+   bool direct;
 
-   ~MemBlock() {
-      delete [] start;
-      delete next;
+   bool write_direct()
+   {
+      struct iovec *iov = pieces.data();
+      size_t cnt = pieces.size();
+      while (cnt > 0) {
+	 ssize_t const res = writev(out.Fd(), iov, std::min<size_t>(cnt, static_cast<size_t>(batch_size)));
+	 if (res < 0) {
+	    if (errno == EINTR)
+	       continue;
+	    return _error->Errno("writev", "Write error in file %s", out.Name().c_str());
+	 }
+	 size_t written = res;
+	 while (cnt > 0 && written >= iov->iov_len) {
+	    written -= iov->iov_len;
+	    ++iov;
+	    --cnt;
+	 }
+	 if (written != 0) {
+	    iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+	    iov->iov_len -= written;
+	 }
+      }
+      return true;
    }
 
-   void clear(void) {
-      free = start;
-      if (next)
-	 next->clear();
+   public:
+   BatchWriter(FileFd &out, Hashes * const hash) : out(out), hash(hash)
+   {
+      direct = out.IsCompressed() == false && out.Flush();
+      pieces.reserve(batch_size);
    }
 
-   char *add_easy(char *src, size_t len, char *last)
+   bool add(char const * const p, size_t const l)
    {
-      if (last) {
-	 for (MemBlock *k = this; k; k = k->next) {
-	    if (k->free == last) {
-	       if (len <= k->avail()) {
-		  char *n = k->add(src, len);
-		  assert(last == n);
-		  if (last == n)
-		     return NULL;
-		  return n;
-	       } else {
-		  break;
-	       }
-	    } else if (last >= start && last < free) {
-	       break;
-	    }
+      if (l == 0)
+	 return true;
+      if (pieces.empty() == false) {
+	 struct iovec &last = pieces.back();
+	 if (static_cast<char const *>(last.iov_base) + last.iov_len == p) {
+	    last.iov_len += l;
+	    return true;
 	 }
+	 if (pieces.size() == batch_size && flush() == false)
+	    return false;
       }
-      return add(src, len);
+      pieces.push_back({const_cast<char *>(p), l});
+      return true;
    }
 
-   char *add(char *src, size_t len) {
-      if (len > avail()) {
-	 if (!next) {
-	    if (len > BLOCK_SIZE)  {
-	       next = new MemBlock(len);
-	    } else {
-	       next = new MemBlock;
-	    }
-	 }
-	 return next->add(src, len);
-      }
-      char *dst = free;
-      free += len;
-      memcpy(dst, src, len);
-      return dst;
+   bool flush()
+   {
+      if (hash != nullptr)
+	 for (auto const &piece : pieces)
+	    hash->Add(static_cast<unsigned char const *>(piece.iov_base), piece.iov_len);
+      bool okay = true;
+      if (direct)
+	 okay = write_direct();
+      else
+	 for (auto const &piece : pieces)
+	    if ((okay = out.Write(piece.iov_base, piece.iov_len)) == false)
+	       break;
+      pieces.clear();
+      return okay;
    }
 };
 
@@ -116,7 +186,7 @@ struct Change {
    size_t del_cnt;
    size_t add_cnt; /* lines */
    size_t add_len; /* bytes */
-   char *add;
+   char const *add;
 
    explicit Change(size_t off)
    {
@@ -129,7 +199,7 @@ struct Change {
    void skip_lines(size_t lines)
    {
       while (lines > 0) {
-	 char *s = (char*) memchr(add, '\n', add_len);
+	 char const *s = (char const*) memchr(add, '\n', add_len);
 	 assert(s != NULL);
 	 s++;
 	 add_len -= (s - add);
@@ -333,96 +403,56 @@ class FileChanges {
 
 class Patch {
    FileChanges filechanges;
-   MemBlock add_text;
-
-   static bool retry_fwrite(char *b, size_t l, FileFd &f, Hashes * const start_hash, Hashes * const end_hash = nullptr) APT_NONNULL(1)
-   {
-      if (f.Write(b, l) == false)
-	 return false;
-      if (start_hash)
-	 start_hash->Add((unsigned char*)b, l);
-      if (end_hash)
-	 end_hash->Add((unsigned char*)b, l);
-      return true;
-   }
-
-   static void dump_rest(FileFd &o, FileFd &i,
-	 Hashes * const start_hash, Hashes * const end_hash)
-   {
-      char buffer[BLOCK_SIZE];
-      unsigned long long l = 0;
-      while (i.Read(buffer, sizeof(buffer), &l)) {
-	 if (l ==0  || !retry_fwrite(buffer, l, o, start_hash, end_hash))
-	    break;
-      }
-   }
-
-   static void dump_lines(FileFd &o, FileFd &i, size_t n,
-	 Hashes * const start_hash, Hashes * const end_hash)
-   {
-      char buffer[BLOCK_SIZE];
-      while (n > 0) {
-	 if (i.ReadLine(buffer, sizeof(buffer)) == NULL)
-	    buffer[0] = '\0';
-	 size_t const l = strlen(buffer);
-	 if (l == 0 || buffer[l-1] == '\n')
-	    n--;
-	 retry_fwrite(buffer, l, o, start_hash, end_hash);
-      }
-   }
+   std::list<FileContent> add_text;
 
-   static void skip_lines(FileFd &i, int n, Hashes * const start_hash)
+   static bool parse_number(char const *&p, char const * const end, size_t &n)
    {
-      char buffer[BLOCK_SIZE];
-      while (n > 0) {
-	 if (i.ReadLine(buffer, sizeof(buffer)) == NULL)
-	    buffer[0] = '\0';
-	 size_t const l = strlen(buffer);
-	 if (l == 0 || buffer[l-1] == '\n')
-	    n--;
-	 if (start_hash)
-	    start_hash->Add((unsigned char*)buffer, l);
+      char const * const start = p;
+      n = 0;
+      for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+	 size_t const next = n * 10 + (*p - '0');
+	 if (next / 10 != n)
+	    return false;
+	 n = next;
       }
-   }
-
-   static void dump_mem(FileFd &o, char *p, size_t s, Hashes *hash) APT_NONNULL(2) {
-      retry_fwrite(p, s, o, nullptr, hash);
+      return p != start && n != std::numeric_limits<size_t>::max();
    }
 
    public:
 
    bool read_diff(FileFd &f, Hashes * const h)
    {
-      char buffer[BLOCK_SIZE];
-      bool cmdwanted = true;
+      add_text.emplace_back();
+      FileContent &text = add_text.back();
+      if (text.open(f) == false)
+	 return false;
+      if (text.empty())
+	 return _error->Error("Reading first line of patchfile %s failed", f.Name().c_str());
+      if (h != NULL)
+	 h->Add(reinterpret_cast<unsigned char const *>(text.begin()), text.end() - text.begin());
 
+      bool cmdwanted = true;
       Change ch(std::numeric_limits<size_t>::max());
-      if (f.ReadLine(buffer, sizeof(buffer)) == NULL)
-	 return _error->Error("Reading first line of patchfile %s failed", f.Name().c_str());
-      do {
-	 if (h != NULL)
-	    h->Add(buffer);
+      char const * const end = text.end();
+      for (char const *line = text.begin(), *next; line != end; line = next) {
+	 next = forward_lines(line, end, 1);
 	 if (cmdwanted) {
-	    char *m, *c;
+	    char const *c = line;
 	    size_t s, e;
-	    errno = 0;
-	    s = strtoul(buffer, &m, 10);
-	    if (unlikely(m == buffer || s == std::numeric_limits<unsigned long>::max() || errno != 0))
+	    if (unlikely(parse_number(c, next, s) == false))
 	       return _error->Error("Parsing patchfile %s failed: Expected an effected line start", f.Name().c_str());
-	    else if (*m == ',') {
-	       ++m;
-	       e = strtol(m, &c, 10);
-	       if (unlikely(m == c || e == std::numeric_limits<unsigned long>::max() || errno != 0))
+	    else if (c != next && *c == ',') {
+	       ++c;
+	       if (unlikely(parse_number(c, next, e) == false))
 		  return _error->Error("Parsing patchfile %s failed: Expected an effected line end", f.Name().c_str());
 	       if (unlikely(e < s))
 		  return _error->Error("Parsing patchfile %s failed: Effected lines end %lu is before start %lu", f.Name().c_str(), e, s);
 	    } else {
 	       e = s;
-	       c = m;
 	    }
 	    if (s > ch.offset)
 	       return _error->Error("Parsing patchfile %s failed: Effected line is after previous effected line", f.Name().c_str());
-	    switch(*c) {
+	    switch(c != next ? *c : '\0') {
 	       case 'a':
 		  cmdwanted = false;
 		  ch.add = NULL;
@@ -455,33 +485,19 @@ class Patch {
 		  return _error->Error("Parsing patchfile %s failed: Unknown command", f.Name().c_str());
 	    }
 	 } else { /* !cmdwanted */
-	    if (strcmp(buffer, ".\n") == 0) {
+	    if (next - line == 2 && line[0] == '.' && line[1] == '\n') {
 	       cmdwanted = true;
 	       filechanges.add_change(ch);
 	    } else {
-	       char *last = NULL;
-	       char *add;
-	       size_t l;
-	       if (ch.add)
-		  last = ch.add + ch.add_len;
-	       l = strlen(buffer);
-	       add = add_text.add_easy(buffer, l, last);
-	       if (!add) {
-		  ch.add_len += l;
-		  ch.add_cnt++;
-	       } else {
-		  if (ch.add) {
-		     filechanges.add_change(ch);
-		     ch.del_cnt = 0;
-		  }
-		  ch.offset += ch.add_cnt;
-		  ch.add = add;
-		  ch.add_len = l;
-		  ch.add_cnt = 1;
-	       }
+	       // the added lines follow each other in the patch, so they
+	       // are referenced as one block rather than copied
+	       if (ch.add == NULL)
+		  ch.add = line;
+	       ch.add_len += next - line;
+	       ch.add_cnt++;
 	    }
 	 }
-      } while(f.ReadLine(buffer, sizeof(buffer)));
+      }
       return true;
    }
 
@@ -515,7 +531,7 @@ class Patch {
 
 	    mg_i = ch;
 	    do {
-	       dump_mem(f, mg_i->add, mg_i->add_len, NULL);
+	       f.Write(mg_i->add, mg_i->add_len);
 	    } while (mg_i-- != mg_e);
 
 	    buf = ".\n";
@@ -531,18 +547,28 @@ class Patch {
       }
    }
 
-   void apply_against_file(FileFd &out, FileFd &in,
+   bool apply_against_file(FileFd &out, FileFd &in,
 	 Hashes * const start_hash = nullptr, Hashes * const end_hash = nullptr)
    {
+      FileContent base;
+      if (base.open(in) == false)
+	 return false;
+      char const *pos = base.begin();
+      char const * const end = base.end();
+      if (start_hash)
+	 start_hash->Add(reinterpret_cast<unsigned char const *>(pos), end - pos);
+
+      BatchWriter writer(out, end_hash);
       std::list<struct Change>::iterator ch;
       for (ch = filechanges.begin(); ch != filechanges.end(); ++ch) {
-	 dump_lines(out, in, ch->offset, start_hash, end_hash);
-	 skip_lines(in, ch->del_cnt, start_hash);
-	 if (ch->add_len != 0)
-	    dump_mem(out, ch->add, ch->add_len, end_hash);
+	 char const * const keep = forward_lines(pos, end, ch->offset);
+	 if (writer.add(pos, keep - pos) == false)
+	    return false;
+	 pos = forward_lines(keep, end, ch->del_cnt);
+	 if (writer.add(ch->add, ch->add_len) == false)
+	    return false;
       }
-      dump_rest(out, in, start_hash, end_hash);
-      out.Flush();
+      return writer.add(pos, end - pos) && writer.flush() && out.Flush();
    }
 };
 
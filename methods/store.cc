@@ -24,6 +24,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -87,7 +88,12 @@ bool StoreMethod::Fetch(FetchItem *Itm)					/*{{{*/
    if (Itm->DestFile != "/dev/null" && Itm->DestFile != Path)
    {
       if (_config->FindB("Method::Compress", false) == false)
-	 To.Open(Itm->DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Atomic, FileFd::Extension);
+      {
+	 unsigned int Mode = FileFd::WriteOnly | FileFd::Create | FileFd::Atomic;
+	 if (_config->FindB("Acquire::Seekable-Indexes", false) == true)
+	    Mode |= FileFd::BlockCompress;
+	 To.Open(Itm->DestFile, Mode, FileFd::Extension);
+      }
       else if (OpenFileWithCompressorByName(To, Itm->DestFile, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, Binary) == false)
 	    return false;
 
@@ -100,12 +106,14 @@ bool StoreMethod::Fetch(FetchItem *Itm)					/*{{{*/
    Hashes Hash(Itm->ExpectedHashes);
    bool Failed = false;
    Res.Size = 0;
+   // big enough to keep the number of syscalls and hash rounds low
+   constexpr unsigned long long BufferSize = 64 * 1024;
+   std::unique_ptr<unsigned char[]> Buffer(new unsigned char[BufferSize]);
    while (1)
    {
-      unsigned char Buffer[4*1024];
       unsigned long long Count = 0;
 
-      if (!From.Read(Buffer,sizeof(Buffer),&Count))
+      if (!From.Read(Buffer.get(),BufferSize,&Count))
       {
 	 if (To.IsOpen())
 	    To.OpFail();
@@ -115,8 +123,8 @@ bool StoreMethod::Fetch(FetchItem *Itm)					/*{{{*/
 	 break;
       Res.Size += Count;
 
-      Hash.Add(Buffer,Count);
-      if (To.IsOpen() && To.Write(Buffer,Count) == false)
+      Hash.Add(Buffer.get(),Count);
+      if (To.IsOpen() && To.Write(Buffer.get(),Count) == false)
       {
 	 Failed = true;
 	 break;
@@ -0,0 +1,51 @@
+#include <config.h>
+
+#include <apt-pkg/acquire.h>
+#include <apt-pkg/acquire-item.h>
+#include <apt-pkg/cmndline.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/init.h>
+#include <apt-pkg/pkgsystem.h>
+
+#include <iostream>
+#include <string>
+
+/* Downloads each given uri to the filename following it with a pkgAcquire
+   instance of its own, like a long-running libapt user would. Each run
+   identifies itself with a User-Agent of its own. */
+int main(int const argc, const char * argv[])
+{
+   CommandLine::Args Args[] = {
+      {'c',"config-file",0,CommandLine::ConfigFile},
+      {'o',"option",0,CommandLine::ArbItem},
+      {0,0,0,0}
+   };
+
+   CommandLine CmdL(Args, _config);
+   if (pkgInitConfig(*_config) == false || CmdL.Parse(argc,argv) == false ||
+	 pkgInitSystem(*_config, _system) == false)
+   {
+      _error->DumpErrors(std::cerr, GlobalError::DEBUG);
+      return 42;
+   }
+
+   for (unsigned int I = 0; I + 1 < CmdL.FileSize(); I += 2)
+   {
+      std::string const Run = std::to_string(I / 2 + 1);
+      _config->Set("Acquire::http::User-Agent", "acquireruns/" + Run);
+      std::clog << "Run " << Run << std::endl;
+
+      pkgAcquire Fetcher;
+      auto const Itm = new pkgAcqFile(&Fetcher, CmdL.FileList[I], HashStringList(), 0,
+	    CmdL.FileList[I], CmdL.FileList[I + 1], "", CmdL.FileList[I + 1]);
+      if (Fetcher.Run() != pkgAcquire::Continue || Itm->Status != pkgAcquire::Item::StatDone)
+      {
+	 _error->Error("Run %s failed to download %s", Run.c_str(), CmdL.FileList[I]);
+	 _error->DumpErrors(std::cerr, GlobalError::DEBUG);
+	 return 1;
+      }
+   }
+   return 0;
+}
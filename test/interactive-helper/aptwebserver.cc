@@ -23,6 +23,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -157,17 +158,37 @@ static bool sendHead(std::ostream &log, int const client, int const httpcode, st
    return Success;
 }
 									/*}}}*/
-static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data)/*{{{*/
+static void throttleConnection(std::chrono::steady_clock::time_point const &start,/*{{{*/
+      unsigned long long const sent)
+{
+   // simulate a server (or CDN) limiting the bandwidth per connection
+   long long const throttle = _config->FindI("aptwebserver::throttle", 0);
+   if (throttle <= 0)
+      return;
+   auto const expected = std::chrono::microseconds((sent * 1000000) / throttle);
+   auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+   if (expected > elapsed)
+      std::this_thread::sleep_for(expected - elapsed);
+}
+									/*}}}*/
+static bool sendFile(int const client, std::list<std::string> const &headers, FileFd &data,/*{{{*/
+      unsigned long long const length = 0)
 {
    bool Success = true;
    bool const chunked = chunkedTransferEncoding(headers);
    char buffer[500];
    unsigned long long actual = 0;
-   while ((Success &= data.Read(buffer, sizeof(buffer), &actual)) == true)
+   unsigned long long sent = 0;
+   auto const start = std::chrono::steady_clock::now();
+   while ((Success &= data.Read(buffer, length == 0 ? sizeof(buffer) :
+	       std::min<unsigned long long>(sizeof(buffer), length - sent), &actual)) == true)
    {
       if (actual == 0)
 	 break;
 
+      sent += actual;
+      throttleConnection(start, sent);
+
       if (chunked == true)
       {
 	 std::string size;
@@ -749,28 +770,32 @@ static void * handleClient(int const client, size_t const id)		/*{{{*/
 	       {
 		  size_t start = 6;
 		  unsigned long long filestart = strtoull(condition.c_str() + start, NULL, 10);
-		  // FIXME: no support for last-byte-pos being not the end of the file (APT clients do not do this)
 		  size_t dash = condition.find('-') + 1;
 		  unsigned long long fileend = strtoull(condition.c_str() + dash, NULL, 10);
 		  unsigned long long filesize = data.FileSize();
-		  if ((fileend == 0 || (fileend == filesize && fileend >= filestart)) &&
+		  // a last-byte-pos before the end of the file is used by segmented downloads
+		  bool const boundedrange = fileend != 0 && fileend >= filestart && fileend < filesize &&
+		     _config->FindB("aptwebserver::support::bounded-range", true) == true;
+		  if ((fileend == 0 || boundedrange || (fileend == filesize && fileend >= filestart)) &&
 			validrange == true)
 		  {
 		     if (filesize > filestart)
 		     {
+			if (boundedrange == false)
+			   fileend = filesize - 1;
 			data.Skip(filestart);
                         // make sure to send content-range before conent-length
                         // as regression test for LP: #1445239
 			std::ostringstream contentrange;
 			contentrange << "Content-Range: bytes " << filestart << "-"
-			   << filesize - 1 << "/" << filesize;
+			   << fileend << "/" << filesize;
 			headers.push_back(contentrange.str());
 			std::ostringstream contentlength;
-			contentlength << "Content-Length: " << (filesize - filestart);
+			contentlength << "Content-Length: " << (fileend - filestart + 1);
 			headers.push_back(contentlength.str());
 			sendHead(log, client, 206, headers);
 			if (sendContent == true)
-			   sendFile(client, headers, data);
+			   sendFile(client, headers, data, fileend - filestart + 1);
 			continue;
 		     }
 		     else
@@ -0,0 +1,134 @@
+#include <config.h>
+
+#include <apt-pkg/aptconfiguration.h>
+#include <apt-pkg/cmndline.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static double Elapsed(struct timeval const &Start)
+{
+   struct timeval Stop;
+   gettimeofday(&Stop, nullptr);
+   return (Stop.tv_sec - Start.tv_sec) + (Stop.tv_usec - Start.tv_usec) / 1000000.0;
+}
+
+/* Measures the throughput of compressing an index like apt-ftparchive's
+   MultiCompress does and of decompressing and hashing it like the store
+   method does for each of the given APT::Compressor::<name>::Threads
+   settings, e.g. compressbench -z xz -t '1 2 4 0' */
+int main(int const argc, const char * argv[])
+{
+   CommandLine::Args Args[] = {
+      {'c',"config-file",0,CommandLine::ConfigFile},
+      {'o',"option",0,CommandLine::ArbItem},
+      {'s',"size","compressbench::size",CommandLine::HasArg},
+      {'t',"threads","compressbench::threads",CommandLine::HasArg},
+      {'z',"compressor","compressbench::compressor",CommandLine::HasArg},
+      {0,0,0,0}
+   };
+
+   CommandLine CmdL(Args, _config);
+   if(CmdL.Parse(argc,argv) == false)
+   {
+      _error->DumpErrors(std::cerr, GlobalError::DEBUG);
+      return 42;
+   }
+
+   std::string const Name = _config->Find("compressbench::compressor", "xz");
+   APT::Configuration::Compressor Compressor;
+   for (auto const &C : APT::Configuration::getCompressors())
+      if (C.Name == Name)
+	 Compressor = C;
+   if (Compressor.Name.empty())
+   {
+      std::cerr << "Unknown compressor " << Name << std::endl;
+      return 1;
+   }
+
+   // a Packages file of the given size in MiB
+   unsigned long long const Size = _config->FindI("compressbench::size", 64) * 1024ull * 1024ull;
+   std::string Data;
+   Data.reserve(Size + 1024);
+   srand(42);
+   for (unsigned long I = 0; Data.size() < Size; ++I)
+   {
+      std::string const Pkg = "package" + std::to_string(I);
+      std::string Stanza;
+      strprintf(Stanza, "Package: %s\nVersion: %d.%d-%d\nInstalled-Size: %d\n"
+	    "Maintainer: Joe Sixpack <joe@example.org>\nArchitecture: amd64\n"
+	    "Depends: libc6 (>= 2.%d), lib%s%d\n"
+	    "Filename: pool/main/%c/%s/%s_%d_amd64.deb\nSize: %d\n"
+	    "SHA256: %08x%08x%08x%08x%08x%08x%08x%08x\n"
+	    "Description: dummy package number %lu\n\n",
+	    Pkg.c_str(), rand() % 10, rand() % 100, rand() % 5, rand() % 100000,
+	    rand() % 30, Pkg.c_str(), rand() % 3, Pkg[0], Pkg.c_str(), Pkg.c_str(), rand() % 10, rand(),
+	    rand(), rand(), rand(), rand(), rand(), rand(), rand(), rand(), I);
+      Data.append(Stanza);
+   }
+   Hashes DataHash(Hashes::SHA256SUM);
+   DataHash.Add(reinterpret_cast<unsigned char const *>(Data.c_str()), Data.size());
+   HashStringList const Expected = DataHash.GetHashStringList();
+
+   std::string const File = GetTempDir() + "/compressbench" + Compressor.Extension;
+   std::cout << std::left << std::setw(8) << "threads" << std::right << std::setw(16) << "compress"
+      << std::setw(16) << "decompress" << std::setw(12) << "ratio" << std::endl;
+   for (auto const &Threads : VectorizeString(_config->Find("compressbench::threads", "1 2 4 0"), ' '))
+   {
+      if (Threads.empty())
+	 continue;
+      _config->Set("APT::Compressor::" + Compressor.Name + "::Threads", Threads);
+
+      struct timeval Start;
+      gettimeofday(&Start, nullptr);
+      FileFd Out;
+      if (Out.Open(File, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, Compressor) == false)
+	 break;
+      // MultiCompress passes the data on in chunks of this size
+      for (size_t Pos = 0; Pos < Data.size(); Pos += 32 * 1024)
+	 if (Out.Write(Data.c_str() + Pos, std::min<size_t>(Data.size() - Pos, 32 * 1024)) == false)
+	    break;
+      if (Out.Close() == false)
+	 break;
+      double const Compress = Elapsed(Start);
+      unsigned long long const CompressedSize = FileFd(File, FileFd::ReadOnly).FileSize();
+
+      gettimeofday(&Start, nullptr);
+      FileFd In;
+      if (In.Open(File, FileFd::ReadOnly, Compressor) == false)
+	 break;
+      Hashes Hash(Hashes::SHA256SUM);
+      unsigned char Buffer[4 * 1024];
+      unsigned long long Actual = 0;
+      while (In.Read(Buffer, sizeof(Buffer), &Actual) && Actual != 0)
+	 Hash.Add(Buffer, Actual);
+      In.Close();
+      double const Decompress = Elapsed(Start);
+      if (Hash.GetHashStringList() != Expected)
+	 _error->Error("Decompressed data with %s threads differs", Threads.c_str());
+
+      std::cout << std::left << std::setw(8) << Threads << std::right << std::fixed << std::setprecision(1)
+	 << std::setw(10) << (Data.size() / Compress / 1024 / 1024) << " MiB/s"
+	 << std::setw(10) << (Data.size() / Decompress / 1024 / 1024) << " MiB/s"
+	 << std::setw(11) << (100.0 * CompressedSize / Data.size()) << "%" << std::endl;
+   }
+   unlink(File.c_str());
+
+   if (_error->PendingError())
+   {
+      _error->DumpErrors(std::cerr);
+      return 1;
+   }
+   return 0;
+}
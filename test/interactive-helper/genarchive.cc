@@ -0,0 +1,315 @@
+#include <config.h>
+
+#include <apt-pkg/cmndline.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/strutl.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// a fixed mtime for all files, so that the same seed creates the same pool
+static unsigned long const MTime = 1500000000;
+static char const * const Sections[] = {"admin", "devel", "doc", "libs", "net", "text", "utils", "web"};
+static char const * const Suffixes[] = {"", "-data", "-dev", "-doc", "-utils", "-common"};
+
+/* The number of files in a package or the size of a file is taken from a
+   distribution given as const:N, uniform:MIN:MAX or exp:MEAN, the latter
+   for the long tail of a real archive with many small and few big ones */
+class Distribution
+{
+   enum { Const, Uniform, Exp } Type;
+   double A, B;
+
+   public:
+   bool Parse(std::string const &Option, std::string const &Default)
+   {
+      std::string const Spec = _config->Find(Option, Default);
+      auto const Fields = VectorizeString(Spec, ':');
+      if (Fields.size() == 2 && Fields[0] == "const")
+	 Type = Const;
+      else if (Fields.size() == 3 && Fields[0] == "uniform")
+	 Type = Uniform;
+      else if (Fields.size() == 2 && Fields[0] == "exp")
+	 Type = Exp;
+      else
+	 return _error->Error("Invalid distribution %s for %s", Spec.c_str(), Option.c_str());
+      char *EndA = nullptr, *EndB = nullptr;
+      A = strtod(Fields[1].c_str(), &EndA);
+      B = Type == Uniform ? strtod(Fields[2].c_str(), &EndB) : A;
+      if (*EndA != '\0' || (EndB != nullptr && *EndB != '\0') || A < 0 || B < A)
+	 return _error->Error("Invalid distribution %s for %s", Spec.c_str(), Option.c_str());
+      return true;
+   }
+   unsigned long long operator()(std::mt19937 &Random) const
+   {
+      switch (Type)
+      {
+	 case Const: return A;
+	 case Uniform: return std::uniform_int_distribution<unsigned long long>(A, B)(Random);
+	 case Exp: return A == 0 ? 0 : std::exponential_distribution<double>(1 / A)(Random);
+      }
+      return A;
+   }
+};
+
+// ustar header, the checksum is calculated with spaces in its field
+static void TarEntry(std::string &Tar, std::string const &Name, bool const Directory,
+		     std::string const &Data)
+{
+   char Header[512];
+   memset(Header, 0, sizeof(Header));
+   strncpy(Header, Name.c_str(), 99);
+   sprintf(Header + 100, "%07o", Directory ? 0755 : 0644);
+   sprintf(Header + 108, "%07o", 0);
+   sprintf(Header + 116, "%07o", 0);
+   sprintf(Header + 124, "%011lo", static_cast<unsigned long>(Data.size()));
+   sprintf(Header + 136, "%011lo", MTime);
+   memset(Header + 148, ' ', 8);
+   Header[156] = Directory ? '5' : '0';
+   memcpy(Header + 257, "ustar\0" "00", 8);
+   strcpy(Header + 265, "root");
+   strcpy(Header + 297, "root");
+   unsigned int Sum = 0;
+   for (unsigned char const C : Header)
+      Sum += C;
+   sprintf(Header + 148, "%06o", Sum);
+   Tar.append(Header, sizeof(Header));
+   Tar.append(Data);
+   Tar.append((512 - Data.size() % 512) % 512, '\0');
+}
+static void TarEnd(std::string &Tar)
+{
+   Tar.append(1024, '\0');
+}
+
+static bool Gzip(std::string const &Dir, std::string const &Data, std::string &Compressed)
+{
+   std::string const File = flCombine(Dir, ".genarchive.gz");
+   {
+      FileFd Out;
+      if (Out.Open(File, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Gzip) == false ||
+	    Out.Write(Data.c_str(), Data.size()) == false || Out.Close() == false)
+	 return false;
+   }
+   FileFd In(File, FileFd::ReadOnly);
+   Compressed.resize(In.FileSize());
+   if (In.Read(&Compressed[0], Compressed.size()) == false)
+      return false;
+   unlink(File.c_str());
+   return true;
+}
+
+static void ArMember(std::string &Ar, std::string const &Name, std::string const &Data)
+{
+   std::string Header;
+   strprintf(Header, "%-16s%-12lu%-6u%-6u%-8o%-10lu`\n", Name.c_str(), MTime, 0, 0, 0100644,
+	 static_cast<unsigned long>(Data.size()));
+   Ar.append(Header);
+   Ar.append(Data);
+   if (Data.size() % 2 != 0)
+      Ar.append("\n");
+}
+
+// text-like content compresses about as well as the files in real packages
+static std::string Content(std::mt19937 &Random, unsigned long long const Size)
+{
+   std::string Data;
+   Data.reserve(Size);
+   std::uniform_int_distribution<int> Letter(0, 31);
+   while (Data.size() < Size)
+   {
+      int const C = Letter(Random);
+      Data.push_back(C < 26 ? 'a' + C : (C < 30 ? ' ' : '\n'));
+   }
+   return Data;
+}
+
+static bool WriteFile(std::string const &File, std::string const &Data)
+{
+   FileFd Out(File, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, 0644);
+   return Out.Write(Data.c_str(), Data.size()) && Out.Close();
+}
+
+static bool MakeDirectories(std::string const &Dir)
+{
+   std::string Path;
+   for (auto const &Part : VectorizeString(Dir, '/'))
+   {
+      Path.append(Part).append("/");
+      if (Part.empty() == false && DirectoryExists(Path) == false && mkdir(Path.c_str(), 0755) != 0)
+	 return _error->Errno("mkdir", "Failed to create directory %s", Path.c_str());
+   }
+   return true;
+}
+
+/* Creates a pool of small but valid source and binary packages in the
+   layout of the Debian archive with override files for them in indices/,
+   e.g. genarchive -o genarchive::sources=1000 -o genarchive::files=exp:50 DIR */
+int main(int const argc, const char * argv[])
+{
+   CommandLine::Args Args[] = {
+      {'c',"config-file",0,CommandLine::ConfigFile},
+      {'o',"option",0,CommandLine::ArbItem},
+      {'a',"arch","genarchive::arch",CommandLine::HasArg},
+      {'n',"sources","genarchive::sources",CommandLine::HasArg},
+      {'s',"seed","genarchive::seed",CommandLine::HasArg},
+      {0,0,0,0}
+   };
+
+   CommandLine CmdL(Args, _config);
+   if(CmdL.Parse(argc,argv) == false || CmdL.FileSize() != 1)
+   {
+      _error->Error("Usage: genarchive [options] DIR");
+      _error->DumpErrors(std::cerr, GlobalError::DEBUG);
+      return 42;
+   }
+
+   std::string const Dir = CmdL.FileList[0];
+   std::string const Arch = _config->Find("genarchive::arch", "amd64");
+   unsigned long const Count = _config->FindI("genarchive::sources", 1000);
+   Distribution Binaries, Files, FileSize;
+   if (Binaries.Parse("genarchive::binaries", "uniform:1:3") == false ||
+	 Files.Parse("genarchive::files", "exp:20") == false ||
+	 FileSize.Parse("genarchive::filesize", "exp:4096") == false ||
+	 MakeDirectories(flCombine(Dir, "indices")) == false)
+   {
+      _error->DumpErrors(std::cerr);
+      return 1;
+   }
+   std::mt19937 Random(_config->FindI("genarchive::seed", 42));
+
+   std::string Override, SrcOverride;
+   unsigned long long BinaryCount = 0, FileCount = 0, Bytes = 0;
+   for (unsigned long I = 0; I < Count && _error->PendingError() == false; ++I)
+   {
+      std::string const Source = std::string(1, 'a' + I % 26) + "pkg" + std::to_string(I);
+      std::string const Version = "1." + std::to_string(I % 10);
+      char const * const Section = Sections[Random() % (sizeof(Sections) / sizeof(Sections[0]))];
+      std::string const PoolDir = flCombine(Dir, std::string("pool/main/") + Source[0] + "/" + Source + "/");
+      if (MakeDirectories(PoolDir) == false)
+	 break;
+
+      std::vector<std::string> Names;
+      unsigned long long const Binary = std::max(1ull, Binaries(Random));
+      for (unsigned long long B = 0; B < Binary; ++B)
+      {
+	 std::string Name = Source;
+	 if (B < sizeof(Suffixes) / sizeof(Suffixes[0]))
+	    Name.append(Suffixes[B]);
+	 else
+	    Name.append("-extra").append(std::to_string(B));
+	 // the -data, -doc and -common packages are architecture independent
+	 std::string const BinArch = (B == 1 || B == 3 || B == 5) ? "all" : Arch;
+
+	 std::string Data;
+	 std::string const DocDir = "./usr/share/doc/" + Name + "/";
+	 for (auto const &D : {"./", "./usr/", "./usr/share/", "./usr/share/doc/"})
+	    TarEntry(Data, D, true, "");
+	 TarEntry(Data, DocDir, true, "");
+	 unsigned long long Size = 0;
+	 unsigned long long const FilesInPackage = Files(Random);
+	 for (unsigned long long F = 0; F < FilesInPackage; ++F)
+	 {
+	    std::string const Text = Content(Random, FileSize(Random));
+	    TarEntry(Data, DocDir + "file" + std::to_string(F), false, Text);
+	    Size += Text.size();
+	 }
+	 TarEnd(Data);
+
+	 std::string Depends = "libc6 (>= 2.24)";
+	 if (Names.empty() == false)
+	    Depends.append(", ").append(Names[0]).append(" (= ").append(Version).append(")");
+	 else if (I != 0)
+	 {
+	    unsigned long const Other = Random() % I;
+	    Depends.append(", ").append(1, 'a' + Other % 26).append("pkg").append(std::to_string(Other));
+	 }
+	 std::string Control;
+	 strprintf(Control, "Package: %s\nSource: %s\nVersion: %s\nArchitecture: %s\n"
+	       "Maintainer: Joe Sixpack <joe@example.org>\nInstalled-Size: %llu\n"
+	       "Depends: %s\nSection: %s\nPriority: optional\n"
+	       "Description: synthetic package %s\n"
+	       " It is one of the %lu source packages generated for benchmarking.\n",
+	       Name.c_str(), Source.c_str(), Version.c_str(), BinArch.c_str(), (Size + 1023) / 1024,
+	       Depends.c_str(), Section, Name.c_str(), Count);
+	 std::string ControlTar;
+	 TarEntry(ControlTar, "./", true, "");
+	 TarEntry(ControlTar, "./control", false, Control);
+	 TarEnd(ControlTar);
+
+	 std::string ControlGz, DataGz;
+	 if (Gzip(PoolDir, ControlTar, ControlGz) == false || Gzip(PoolDir, Data, DataGz) == false)
+	    break;
+	 std::string Deb = "!<arch>\n";
+	 ArMember(Deb, "debian-binary", "2.0\n");
+	 ArMember(Deb, "control.tar.gz", ControlGz);
+	 ArMember(Deb, "data.tar.gz", DataGz);
+	 if (WriteFile(PoolDir + Name + "_" + Version + "_" + BinArch + ".deb", Deb) == false)
+	    break;
+
+	 Override.append(Name).append(" optional ").append(Section).append("\n");
+	 Names.push_back(Name);
+	 ++BinaryCount;
+	 FileCount += FilesInPackage;
+	 Bytes += Deb.size();
+      }
+
+      std::string const Base = Source + "-" + Version + "/";
+      std::string Tar;
+      TarEntry(Tar, Base, true, "");
+      TarEntry(Tar, Base + "debian/", true, "");
+      TarEntry(Tar, Base + "debian/source/", true, "");
+      TarEntry(Tar, Base + "debian/source/format", false, "3.0 (native)\n");
+      TarEntry(Tar, Base + "README", false, Content(Random, FileSize(Random)));
+      TarEnd(Tar);
+      std::string TarGz;
+      std::string const TarName = Source + "_" + Version + ".tar.gz";
+      if (Gzip(PoolDir, Tar, TarGz) == false || WriteFile(PoolDir + TarName, TarGz) == false)
+	 break;
+      Hashes TarHashes(Hashes::MD5SUM | Hashes::SHA1SUM | Hashes::SHA256SUM);
+      TarHashes.Add(reinterpret_cast<unsigned char const *>(TarGz.c_str()), TarGz.size());
+      HashStringList const Sums = TarHashes.GetHashStringList();
+
+      std::string PackageList;
+      for (auto const &Name : Names)
+	 PackageList.append(" ").append(Name).append(" deb ").append(Section).append(" optional\n");
+      std::string Dsc;
+      strprintf(Dsc, "Format: 3.0 (native)\nSource: %s\nBinary: %s\nArchitecture: any all\n"
+	    "Version: %s\nMaintainer: Joe Sixpack <joe@example.org>\nStandards-Version: 3.9.8\n"
+	    "Build-Depends: debhelper (>= 9)\nPackage-List:\n%s"
+	    "Checksums-Sha1:\n %s %zu %s\nChecksums-Sha256:\n %s %zu %s\nFiles:\n %s %zu %s\n",
+	    Source.c_str(), APT::String::Join(Names, ", ").c_str(), Version.c_str(), PackageList.c_str(),
+	    Sums.find("SHA1")->HashValue().c_str(), TarGz.size(), TarName.c_str(),
+	    Sums.find("SHA256")->HashValue().c_str(), TarGz.size(), TarName.c_str(),
+	    Sums.find("MD5Sum")->HashValue().c_str(), TarGz.size(), TarName.c_str());
+      if (WriteFile(PoolDir + Source + "_" + Version + ".dsc", Dsc) == false)
+	 break;
+      SrcOverride.append(Source).append(" ").append(Section).append("\n");
+      Bytes += TarGz.size() + Dsc.size();
+   }
+
+   if (_error->PendingError() == false)
+   {
+      WriteFile(flCombine(Dir, "indices/override.main"), Override);
+      WriteFile(flCombine(Dir, "indices/override.main.src"), SrcOverride);
+   }
+   if (_error->PendingError())
+   {
+      _error->DumpErrors(std::cerr);
+      return 1;
+   }
+   std::cout << "Sources: " << Count << "\nBinaries: " << BinaryCount
+      << "\nFiles: " << FileCount << "\nBytes: " << Bytes << std::endl;
+   return 0;
+}
@@ -0,0 +1,82 @@
+#include <config.h>
+
+#include <apt-pkg/cmndline.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/hashes.h>
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Measures the throughput of each hash algorithm over a buffer in memory
+   and of all of them together. Pass -o APT::Hashes::Hardware-Acceleration=false
+   to compare with the portable implementations and -o APT::Hashes::Parallel=false
+   to calculate the hashes one after another. */
+int main(int const argc, const char * argv[])
+{
+   CommandLine::Args Args[] = {
+      {'c',"config-file",0,CommandLine::ConfigFile},
+      {'o',"option",0,CommandLine::ArbItem},
+      {'s',"size","hashbench::size",CommandLine::HasArg},
+      {0,0,0,0}
+   };
+
+   CommandLine CmdL(Args, _config);
+   if(CmdL.Parse(argc,argv) == false)
+   {
+      _error->DumpErrors(std::cerr, GlobalError::DEBUG);
+      return 42;
+   }
+
+   // size of the hashed data in MiB
+   unsigned long long const Size = _config->FindI("hashbench::size", 256) * 1024ull * 1024ull;
+   std::vector<unsigned char> Data(Size);
+   srand(42);
+   for (auto &c: Data)
+      c = rand();
+
+   struct Algorithm {
+      char const * const Name;
+      unsigned int const Which;
+   } const Algorithms[] = {
+      {"MD5Sum", Hashes::MD5SUM},
+      {"SHA1", Hashes::SHA1SUM},
+      {"SHA256", Hashes::SHA256SUM},
+      {"SHA512", Hashes::SHA512SUM},
+   };
+   for (auto const &A: Algorithms)
+   {
+      Hashes Hash(A.Which);
+      struct timeval Start, Stop;
+      gettimeofday(&Start, nullptr);
+      // feed it in the chunks AddFD would use
+      for (unsigned long long Pos = 0; Pos < Size; Pos += 64 * 1024)
+	 Hash.Add(Data.data() + Pos, std::min(Size - Pos, 64 * 1024ull));
+      HashStringList const List = Hash.GetHashStringList();
+      gettimeofday(&Stop, nullptr);
+      double const Seconds = (Stop.tv_sec - Start.tv_sec) + (Stop.tv_usec - Start.tv_usec) / 1000000.0;
+      std::cout << std::left << std::setw(8) << A.Name << std::right << std::fixed << std::setprecision(1)
+	 << std::setw(10) << (Size / Seconds / 1024 / 1024) << " MiB/s  "
+	 << List.find(A.Name)->HashValue() << std::endl;
+   }
+
+   {
+      Hashes Hash;
+      struct timeval Start, Stop;
+      gettimeofday(&Start, nullptr);
+      // the buffer size AddFD uses if all hashes are calculated
+      for (unsigned long long Pos = 0; Pos < Size; Pos += 1024 * 1024)
+	 Hash.Add(Data.data() + Pos, std::min(Size - Pos, 1024 * 1024ull));
+      Hash.GetHashStringList();
+      gettimeofday(&Stop, nullptr);
+      double const Seconds = (Stop.tv_sec - Start.tv_sec) + (Stop.tv_usec - Start.tv_usec) / 1000000.0;
+      std::cout << std::left << std::setw(8) << "all" << std::right << std::fixed << std::setprecision(1)
+	 << std::setw(10) << (Size / Seconds / 1024 / 1024) << " MiB/s" << std::endl;
+   }
+   return 0;
+}
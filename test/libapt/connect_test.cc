@@ -0,0 +1,184 @@
+#include <config.h>
+
+#include <apt-pkg/acquire-method.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../../methods/connect.h"
+
+#include <gtest/gtest.h>
+
+class ConnectTestMethod : public pkgAcqMethod
+{
+   public:
+   ConnectTestMethod() : pkgAcqMethod("1.0") {}
+};
+
+static int Listen(char const * const Address, int const Backlog, int &Port)
+{
+   int const Fd = socket(AF_INET, SOCK_STREAM, 0);
+   struct sockaddr_in Addr;
+   memset(&Addr, 0, sizeof(Addr));
+   Addr.sin_family = AF_INET;
+   inet_pton(AF_INET, Address, &Addr.sin_addr);
+   socklen_t Len = sizeof(Addr);
+   if (Fd == -1 || bind(Fd, reinterpret_cast<struct sockaddr *>(&Addr), Len) != 0 ||
+	 (Backlog >= 0 && listen(Fd, Backlog) != 0) ||
+	 getsockname(Fd, reinterpret_cast<struct sockaddr *>(&Addr), &Len) != 0)
+      return -1;
+   Port = ntohs(Addr.sin_port);
+   return Fd;
+}
+/* a listening socket which is never accepted from drops all further
+   connection attempts once its backlog is full, so they just hang */
+static int Blackhole(char const * const Address, int &Port, int &Filler)
+{
+   int const Fd = Listen(Address, 0, Port);
+   Filler = socket(AF_INET, SOCK_STREAM, 0);
+   struct sockaddr_in Addr;
+   memset(&Addr, 0, sizeof(Addr));
+   Addr.sin_family = AF_INET;
+   Addr.sin_port = htons(Port);
+   inet_pton(AF_INET, Address, &Addr.sin_addr);
+   if (connect(Filler, reinterpret_cast<struct sockaddr *>(&Addr), sizeof(Addr)) != 0)
+      return -1;
+   return Fd;
+}
+static struct addrinfo *Resolve(char const * const Address, int const Port)
+{
+   struct addrinfo Hints;
+   memset(&Hints, 0, sizeof(Hints));
+   Hints.ai_socktype = SOCK_STREAM;
+   Hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+   struct addrinfo *Res = nullptr;
+   if (getaddrinfo(Address, std::to_string(Port).c_str(), &Hints, &Res) != 0)
+      return nullptr;
+   return Res;
+}
+static int PeerPort(int const Fd)
+{
+   struct sockaddr_in Addr;
+   socklen_t Len = sizeof(Addr);
+   if (getpeername(Fd, reinterpret_cast<struct sockaddr *>(&Addr), &Len) != 0)
+      return -1;
+   return ntohs(Addr.sin_port);
+}
+static double Elapsed(struct timeval const &Start)
+{
+   struct timeval Stop;
+   gettimeofday(&Stop, nullptr);
+   return (Stop.tv_sec - Start.tv_sec) + (Stop.tv_usec - Start.tv_usec) / 1000000.0;
+}
+
+TEST(ConnectTest, RaceBlackholedAddress)
+{
+   int BlackPort, Filler, GoodPort;
+   int const Black = Blackhole("127.0.0.11", BlackPort, Filler);
+   int const Good = Listen("127.0.0.12", 5, GoodPort);
+   ASSERT_NE(-1, Black);
+   ASSERT_NE(-1, Good);
+   struct addrinfo * const BlackAddr = Resolve("127.0.0.11", BlackPort);
+   struct addrinfo * const GoodAddr = Resolve("127.0.0.12", GoodPort);
+   ASSERT_NE(nullptr, BlackAddr);
+   ASSERT_NE(nullptr, GoodAddr);
+
+   // the blackholed address doesn't hold us up until the timeout
+   _config->Set("Acquire::Connect::Attempt-Delay", 100);
+   testing::internal::CaptureStdout();
+   ConnectTestMethod Owner;
+   int Fd = -1;
+   struct addrinfo *Used = nullptr;
+   struct timeval Start;
+   gettimeofday(&Start, nullptr);
+   EXPECT_TRUE(ConnectToAddresses({BlackAddr, GoodAddr}, "example.org", 30, Fd, Used, &Owner));
+   EXPECT_GT(5, Elapsed(Start));
+   std::string const Output = testing::internal::GetCapturedStdout();
+   EXPECT_NE(std::string::npos, Output.find("Connecting to example.org (127.0.0.11)"));
+   EXPECT_NE(std::string::npos, Output.find("Connecting to example.org (127.0.0.12)"));
+   EXPECT_EQ(GoodAddr, Used);
+   EXPECT_EQ(GoodPort, PeerPort(Fd));
+   EXPECT_FALSE(_error->PendingError());
+   close(Fd);
+
+   _config->Clear("Acquire::Connect::Attempt-Delay");
+   freeaddrinfo(BlackAddr);
+   freeaddrinfo(GoodAddr);
+   close(Filler);
+   close(Black);
+   close(Good);
+}
+TEST(ConnectTest, RefusedAddressStartsNextImmediately)
+{
+   int RefusedPort, GoodPort;
+   // bound, but not listening: connections are refused
+   int const Refused = Listen("127.0.0.13", -1, RefusedPort);
+   int const Good = Listen("127.0.0.14", 5, GoodPort);
+   ASSERT_NE(-1, Refused);
+   ASSERT_NE(-1, Good);
+   struct addrinfo * const RefusedAddr = Resolve("127.0.0.13", RefusedPort);
+   struct addrinfo * const GoodAddr = Resolve("127.0.0.14", GoodPort);
+
+   _config->Set("Acquire::Connect::Attempt-Delay", 20000);
+   testing::internal::CaptureStdout();
+   ConnectTestMethod Owner;
+   int Fd = -1;
+   struct addrinfo *Used = nullptr;
+   struct timeval Start;
+   gettimeofday(&Start, nullptr);
+   EXPECT_TRUE(ConnectToAddresses({RefusedAddr, GoodAddr}, "example.org", 30, Fd, Used, &Owner));
+   EXPECT_GT(5, Elapsed(Start));
+   testing::internal::GetCapturedStdout();
+   EXPECT_EQ(GoodAddr, Used);
+   EXPECT_EQ(GoodPort, PeerPort(Fd));
+   EXPECT_FALSE(_error->PendingError());
+   close(Fd);
+
+   _config->Clear("Acquire::Connect::Attempt-Delay");
+   freeaddrinfo(RefusedAddr);
+   freeaddrinfo(GoodAddr);
+   close(Refused);
+   close(Good);
+}
+TEST(ConnectTest, AllAddressesBlackholed)
+{
+   int BlackPort, Filler;
+   int const Black = Blackhole("127.0.0.15", BlackPort, Filler);
+   ASSERT_NE(-1, Black);
+   struct addrinfo * const BlackAddr = Resolve("127.0.0.15", BlackPort);
+   ASSERT_NE(nullptr, BlackAddr);
+
+   testing::internal::CaptureStdout();
+   ConnectTestMethod Owner;
+   int Fd = -1;
+   struct addrinfo *Used = nullptr;
+   struct timeval Start;
+   gettimeofday(&Start, nullptr);
+   EXPECT_FALSE(ConnectToAddresses({BlackAddr}, "example.org", 1, Fd, Used, &Owner));
+   EXPECT_LE(0.9, Elapsed(Start));
+   EXPECT_EQ(-1, Fd);
+   EXPECT_EQ(nullptr, Used);
+   std::string Msg;
+   EXPECT_TRUE(_error->PopMessage(Msg));
+   EXPECT_NE(std::string::npos, Msg.find("connection timed out")) << Msg;
+   EXPECT_FALSE(_error->PendingError());
+
+   // the address which timed out isn't tried again
+   EXPECT_FALSE(ConnectToAddresses({BlackAddr}, "example.org", 1, Fd, Used, &Owner));
+   EXPECT_FALSE(_error->PendingError());
+   testing::internal::GetCapturedStdout();
+
+   freeaddrinfo(BlackAddr);
+   close(Filler);
+   close(Black);
+}
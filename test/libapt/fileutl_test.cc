@@ -165,7 +165,7 @@ static void TestFileFd(mode_t const a_umask, mode_t const ExpectedFilePermission
 static void TestFileFd(unsigned int const filemode)
 {
    auto const compressors = APT::Configuration::getCompressors();
-   EXPECT_EQ(7, compressors.size());
+   EXPECT_EQ(8, compressors.size());
    bool atLeastOneWasTested = false;
    for (auto const &c: compressors)
    {
@@ -189,7 +189,7 @@ TEST(FileUtlTest, FileFD)
    _config->Set("APT::Compressor::rev::Binary", "rev");
    _config->Set("APT::Compressor::rev::Cost", 10);
    auto const compressors = APT::Configuration::getCompressors(false);
-   EXPECT_EQ(7, compressors.size());
+   EXPECT_EQ(8, compressors.size());
    EXPECT_TRUE(std::any_of(compressors.begin(), compressors.end(), [](APT::Configuration::Compressor const &c) { return c.Name == "rev"; }));
 
    std::string const startdir = SafeGetCWD();
@@ -389,3 +389,163 @@ TEST(FileUtlTest, FailingAtomic)
    if (filename.empty() == false)
       unlink(filename.c_str());
 }
+static void TestBlockCompress(APT::Configuration::Compressor const &compressor)
+{
+   SCOPED_TRACE(compressor.Name);
+   std::string const fname = "apt-filefd-blocks" + compressor.Extension;
+   std::string const index = fname + ".seekindex";
+   unlink(fname.c_str());
+   unlink(index.c_str());
+
+   std::string content;
+   for (int i = 0; i < 20000; ++i)
+      content.append("Line ").append(std::to_string(i)).append(" of a seekable file\n");
+
+   FileFd f;
+   ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Atomic | FileFd::BlockCompress, compressor));
+   for (size_t i = 0; i < content.length(); i += 3000)
+      EXPECT_TRUE(f.Write(content.c_str() + i, std::min<size_t>(3000, content.length() - i)));
+   EXPECT_TRUE(f.Close());
+   EXPECT_TRUE(RealFileExists(index));
+
+   FileFd idx(index, FileFd::ReadOnly);
+   char line[1024];
+   EXPECT_NE(nullptr, idx.ReadLine(line, sizeof(line)));
+   EXPECT_STREQ("APT-Seek-Index: 1\n", line);
+   int blocks = 0;
+   while (idx.ReadLine(line, sizeof(line)) != nullptr)
+      ++blocks;
+   // two header lines after the first one, 16 KiB of content per block
+   EXPECT_EQ(2 + (content.length() + 16383) / 16384, blocks);
+
+   std::vector<unsigned long long> const offsets = { 500000, 5, 400000, 16384, 16383, 123456, 0, 300000, 300010, 500000 };
+   for (auto const stale : { false, true })
+   {
+      SCOPED_TRACE(stale ? "stale index" : "index");
+      ASSERT_TRUE(f.Open(fname, FileFd::ReadOnly, compressor));
+      EXPECT_EQ(content.length(), f.Size());
+      for (auto const o : offsets)
+      {
+	 ASSERT_LT(o, content.length());
+	 EXPECT_TRUE(f.Seek(o));
+	 EXPECT_EQ(o, f.Tell());
+	 char buffer[100];
+	 unsigned long long const size = std::min<unsigned long long>(sizeof(buffer), content.length() - o);
+	 EXPECT_TRUE(f.Read(buffer, size));
+	 EXPECT_EQ(content.substr(o, size), std::string(buffer, size));
+	 EXPECT_EQ(o + size, f.Tell());
+      }
+      std::string all;
+      EXPECT_TRUE(f.Seek(0));
+      char buffer[4096];
+      unsigned long long actual;
+      while (f.Read(buffer, sizeof(buffer), &actual) && actual != 0)
+	 all.append(buffer, actual);
+      EXPECT_EQ(content, all);
+      EXPECT_TRUE(f.Close());
+
+      // replace the file behind the back of the index
+      content = content.substr(4242);
+      ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+      EXPECT_TRUE(f.Write(content.c_str(), content.length()));
+      EXPECT_TRUE(f.Close());
+      EXPECT_TRUE(RealFileExists(index));
+   }
+   unlink(fname.c_str());
+   unlink(index.c_str());
+}
+TEST(FileUtlTest, BlockCompress)
+{
+   _config->Set("APT::FileFd::Block-Size", 16);
+   for (auto const &c : APT::Configuration::getCompressors())
+      if (c.Name == "gzip" || c.Name == "xz" || c.Name == "lz4" || c.Name == "zstd")
+	 TestBlockCompress(c);
+   _config->Clear("APT::FileFd::Block-Size");
+}
+TEST(FileUtlTest, XzThreads)
+{
+   APT::Configuration::Compressor compressor;
+   for (auto const &c : APT::Configuration::getCompressors())
+      if (c.Name == "xz")
+	 compressor = c;
+   if (compressor.Name.empty())
+      return;
+
+   std::string content;
+   for (int i = 0; content.size() < 2 * 1024 * 1024; ++i)
+      content.append("Package: pkg" + std::to_string(i) + "\nVersion: " + std::to_string(i % 7) + "\n\n");
+   std::string const fname = GetTempDir() + "/apt-fileutl-test-threads" + compressor.Extension;
+
+   for (auto const threads : {"1", "2", "0"})
+   {
+      _config->Set("APT::Compressor::xz::Threads", threads);
+      FileFd f;
+      ASSERT_TRUE(f.Open(fname, FileFd::WriteOnly | FileFd::Create | FileFd::Empty, compressor));
+      EXPECT_TRUE(f.Write(content.c_str(), content.length()));
+      EXPECT_TRUE(f.Close());
+
+      // the output is a normal .xz file whatever the reader uses
+      for (auto const readthreads : {"1", "2"})
+      {
+	 _config->Set("APT::Compressor::xz::Threads", readthreads);
+	 ASSERT_TRUE(f.Open(fname, FileFd::ReadOnly, compressor));
+	 EXPECT_EQ(content.length(), f.Size());
+	 std::string all;
+	 char buffer[4096];
+	 unsigned long long actual;
+	 while (f.Read(buffer, sizeof(buffer), &actual) && actual != 0)
+	    all.append(buffer, actual);
+	 EXPECT_EQ(content, all);
+	 EXPECT_TRUE(f.Close());
+      }
+   }
+   _config->Clear("APT::Compressor::xz::Threads");
+   unlink(fname.c_str());
+}
+TEST(FileUtlTest, CopyFile)
+{
+   std::string content;
+   for (int i = 0; content.size() < 3 * 1024 * 1024; ++i)
+      content.append("Package: pkg" + std::to_string(i) + "\n\n");
+   std::string const src = GetTempDir() + "/apt-fileutl-test-copy-src";
+   std::string const dst = GetTempDir() + "/apt-fileutl-test-copy-dst";
+   FileFd f;
+   ASSERT_TRUE(f.Open(src, FileFd::WriteOnly | FileFd::Create | FileFd::Empty));
+   EXPECT_TRUE(f.Write(content.c_str(), content.length()));
+   EXPECT_TRUE(f.Close());
+
+   // copying the rest of a partly read file behind partly written data
+   FileFd in(src, FileFd::ReadOnly);
+   FileFd out(dst, FileFd::WriteOnly | FileFd::Create | FileFd::Empty | FileFd::BufferedWrite);
+   char buffer[1000];
+   EXPECT_TRUE(in.Read(buffer, sizeof(buffer)));
+   EXPECT_TRUE(out.Write("header\n", 7));
+   EXPECT_TRUE(CopyFile(in, out));
+   EXPECT_EQ(content.length(), in.Tell());
+   EXPECT_EQ(content.length() - sizeof(buffer) + 7, out.Tell());
+   EXPECT_TRUE(out.Write("footer\n", 7));
+   EXPECT_TRUE(in.Close());
+   EXPECT_TRUE(out.Close());
+
+   ASSERT_TRUE(f.Open(dst, FileFd::ReadOnly));
+   std::string all;
+   unsigned long long actual;
+   while (f.Read(buffer, sizeof(buffer), &actual) && actual != 0)
+      all.append(buffer, actual);
+   EXPECT_TRUE(f.Close());
+   EXPECT_EQ("header\n" + content.substr(sizeof(buffer)) + "footer\n", all);
+
+   // compressed files are copied as the data they contain
+   ASSERT_TRUE(in.Open(src, FileFd::ReadOnly));
+   ASSERT_TRUE(out.Open(dst + ".gz", FileFd::WriteOnly | FileFd::Create | FileFd::Empty, FileFd::Gzip));
+   EXPECT_TRUE(CopyFile(in, out));
+   EXPECT_TRUE(in.Close());
+   EXPECT_TRUE(out.Close());
+   ASSERT_TRUE(f.Open(dst + ".gz", FileFd::ReadOnly, FileFd::Gzip));
+   EXPECT_EQ(content.length(), f.Size());
+   EXPECT_TRUE(f.Close());
+
+   unlink(src.c_str());
+   unlink(dst.c_str());
+   unlink((dst + ".gz").c_str());
+}
@@ -11,6 +11,9 @@
 #include <iostream>
 #include <stdlib.h>
 #include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
@@ -102,6 +105,80 @@ TEST(HashSumsTest, Mill)
    EXPECT_EQ("34aa973cd4c4daa4f61eeb2bdbad27316534016f", Sum1.Result().Value());
 }
 
+TEST(HashSumsTest, Chunks)
+{
+   // the block functions see different alignments and amounts of
+   // complete blocks depending on how the data is fed in
+   unsigned char Data[1000];
+   for (size_t i = 0; i < sizeof(Data); ++i)
+      Data[i] = (i * 7 + 3) % 256;
+   for (size_t const Chunk : {1, 3, 63, 64, 65, 127, 128, 500, 1000})
+   {
+      SHA1Summation Sum1;
+      SHA256Summation Sum256;
+      for (size_t Pos = 0; Pos < sizeof(Data); Pos += Chunk)
+      {
+	 size_t const Len = std::min(Chunk, sizeof(Data) - Pos);
+	 Sum1.Add(Data + Pos, Len);
+	 Sum256.Add(Data + Pos, Len);
+      }
+      EXPECT_EQ("4231a8a50a10fa9758db8ec71fdef855b751048a", Sum1.Result().Value()) << "Chunk size " << Chunk;
+      EXPECT_EQ("1e9bc38cbf860b9ec31918b065f9b52476c549a782e0e7990bed8ce3868d2371", Sum256.Result().Value()) << "Chunk size " << Chunk;
+   }
+}
+
+TEST(HashSumsTest, Parallel)
+{
+   // large buffers are hashed by all digests at the same time
+   std::vector<unsigned char> Data(3 * 1024 * 1024 + 17);
+   for (size_t i = 0; i < Data.size(); ++i)
+      Data[i] = (i * 7 + 3) % 251;
+   HashStringList Expected;
+   for (bool const Parallel : {false, true})
+   {
+      _config->Set("APT::Hashes::Parallel", Parallel);
+      for (size_t const Chunk : {100, 64 * 1024, 1000 * 1000, 4 * 1024 * 1024})
+      {
+	 Hashes Hash;
+	 for (size_t Pos = 0; Pos < Data.size(); Pos += Chunk)
+	    EXPECT_TRUE(Hash.Add(Data.data() + Pos, std::min(Chunk, Data.size() - Pos)));
+	 HashStringList const List = Hash.GetHashStringList();
+	 EXPECT_EQ(5u, List.size());
+	 if (Expected.empty())
+	    Expected = List;
+	 for (auto const &H : Expected)
+	    EXPECT_EQ(H.HashValue(), List.find(H.HashType())->HashValue()) << H.HashType() << " with chunk size " << Chunk << " and parallel " << Parallel;
+      }
+   }
+   _config->Clear("APT::Hashes::Parallel");
+}
+
+TEST(HashSumsTest, ParallelAfterFork)
+{
+   // a child hashes with helpers of its own, the ones of the parent are gone
+   std::vector<unsigned char> Data(1024 * 1024);
+   for (size_t i = 0; i < Data.size(); ++i)
+      Data[i] = i % 253;
+   _config->Set("APT::Hashes::Parallel", true);
+   Hashes Parent;
+   EXPECT_TRUE(Parent.Add(Data.data(), Data.size()));
+   std::string const Expected = Parent.GetHashStringList().find("SHA256")->HashValue();
+
+   pid_t const Child = fork();
+   ASSERT_NE(-1, Child);
+   if (Child == 0)
+   {
+      Hashes Hash;
+      bool const Res = Hash.Add(Data.data(), Data.size());
+      _exit((Res && Hash.GetHashStringList().find("SHA256")->HashValue() == Expected) ? 0 : 1);
+   }
+   int Status;
+   ASSERT_EQ(Child, waitpid(Child, &Status, 0));
+   EXPECT_TRUE(WIFEXITED(Status));
+   EXPECT_EQ(0, WEXITSTATUS(Status));
+   _config->Clear("APT::Hashes::Parallel");
+}
+
 static void getSummationString(char const * const type, std::string &sum)
 {
    /* to compare our result with an independent source we call the specific binaries